@@ -0,0 +1,78 @@
+#include "islx86.h"
+
+#include <array>
+#include <utility>
+
+using namespace std;
+
+// Effective addresses of ModRM memory operands. Every addressing form has its own kernel, a template
+// instantiated for the registers and scale it names, so an address is one call that adds exactly those
+// registers and the displacement, with no switches on mod, r/m, scale or index. decode_ea fetches the
+// SIB byte and the displacement once and picks the kernel from tables built at compile time:
+//   32 bit   [reg + disp], [disp32] (mod 0 r/m 5), [base + index * scale + disp],
+//            [index * scale + disp32] (SIB base 5 with mod 0); SIB index 4 means no index
+//   16 bit   with 0x67: [BX+SI] [BX+DI] [BP+SI] [BP+DI] [SI] [DI] [BP] [BX] + disp8 / disp16,
+//            [disp16] for mod 0 r/m 6; the sum wraps to 16 bits
+// Kernels return offsets, the callers add the DS base (for the ESP / EBP / BP based forms as well).
+const int NO_REG = 8; //a form without a base or an index
+
+template<int BASE, int INDEX, int SHIFT>
+uint32_t ea_kernel32(const state_t& s, int32_t disp){
+    uint32_t ea = (uint32_t)disp;
+    if constexpr(BASE != NO_REG) ea += (uint32_t)s.GPR[BASE];
+    if constexpr(INDEX != NO_REG) ea += (uint32_t)s.GPR[INDEX] << SHIFT;
+    return ea;
+}
+
+template<int BASE, int INDEX>
+uint32_t ea_kernel16(const state_t& s, int32_t disp){
+    uint32_t ea = (uint32_t)disp;
+    if constexpr(BASE != NO_REG) ea += (uint32_t)s.GPR[BASE];
+    if constexpr(INDEX != NO_REG) ea += (uint32_t)s.GPR[INDEX];
+    return ea & 0xFFFF;
+}
+
+//[base + disp] for r/m 0-7 (4 is never used, it means SIB), [disp32] at NO_REG
+template<size_t... I>
+constexpr array<ea_kernel_t, sizeof...(I)> modrm_kernels(index_sequence<I...>){
+    return {{ea_kernel32<(int)I, NO_REG, 0>...}};
+}
+
+//[scale][index][base] flattened, base NO_REG for SIB base 5 with mod 0
+template<size_t... I>
+constexpr array<ea_kernel_t, sizeof...(I)> sib_kernels(index_sequence<I...>){
+    return {{ea_kernel32<(int)(I % 9), ((I / 9) % 8 == 4 ? NO_REG : (int)((I / 9) % 8)), (int)(I / 72)>...}};
+}
+
+const array<ea_kernel_t, 9> EA32_MODRM = modrm_kernels(make_index_sequence<9>());
+const array<ea_kernel_t, 4 * 8 * 9> EA32_SIB = sib_kernels(make_index_sequence<4 * 8 * 9>());
+const ea_kernel_t EA16_MODRM[9] = {
+    ea_kernel16<EBX, ESI>, ea_kernel16<EBX, EDI>, ea_kernel16<EBP, ESI>, ea_kernel16<EBP, EDI>,
+    ea_kernel16<ESI, NO_REG>, ea_kernel16<EDI, NO_REG>, ea_kernel16<EBP, NO_REG>, ea_kernel16<EBX, NO_REG>,
+    ea_kernel16<NO_REG, NO_REG> //mod 0 r/m 6
+};
+
+//displacement bytes following the ModRM (and SIB) byte of a memory operand
+int ea_disp_bytes(modrm_t modrm, modrm_t sib, bool a16){
+    if(modrm.mod == 1) return 1;
+    if(modrm.mod == 2) return a16 ? 2 : 4;
+    if(a16) return modrm.r_m == 6 ? 2 : 0;
+    return (modrm.r_m == 5 || (modrm.r_m == 4 && sib.r_m == 5)) ? 4 : 0;
+}
+
+ea_kernel_t ea_kernel(modrm_t modrm, modrm_t sib, bool a16){
+    if(a16) return EA16_MODRM[(modrm.mod == 0 && modrm.r_m == 6) ? NO_REG : modrm.r_m];
+    if(modrm.r_m != 4) return EA32_MODRM[(modrm.mod == 0 && modrm.r_m == 5) ? NO_REG : modrm.r_m];
+    int base = (modrm.mod == 0 && sib.r_m == 5) ? NO_REG : sib.r_m;
+    return EA32_SIB[(sib.mod * 8 + sib.reg) * 9 + base];
+}
+
+//memory operand (modrm.mod != 3): fetches its SIB byte and displacement, picks its kernel
+ea_t decode_ea(machine_t* m, int& len, modrm_t modrm, bool a16){
+    modrm_t sib = {0, 0, 0};
+    if(!a16 && modrm.r_m == 4) sib = get_modrm_byte(fetch_byte(m, len));
+    ea_t ea;
+    ea.disp = fetch_simm(m, len, ea_disp_bytes(modrm, sib, a16));
+    ea.kernel = ea_kernel(modrm, sib, a16);
+    return ea;
+}
@@ -0,0 +1,316 @@
+#include "islx86.h"
+
+using namespace std;
+
+// Integer ALU and branch instructions next to the original ADD / JNE set:
+//   OR AND SUB XOR CMP        08-0D 20-25 28-2D 30-35 38-3D, 80/81/83 /1 /4 /5 /6 /7
+//   TEST                      84/85, A8/A9, F6/F7 /0
+//   INC DEC                   40-4F, FE/FF /0 /1
+//   Jcc rel8, JMP rel8/rel32  70-7F, EB, E9 (Jcc rel32 0F 80-8F lives in fetch_and_execute)
+//   LOOPNE LOOPE LOOP JECXZ   E0-E3
+// Byte registers 4-7 are AH CH DH BH, memory operands are DS relative like the ADDs.
+
+//ALU operation in bits 5:3 of the opcode / the reg field of 80/81/83
+enum ALU_OPS {
+    ALU_ADD,
+    ALU_OR,
+    ALU_ADC,
+    ALU_SBB,
+    ALU_AND,
+    ALU_SUB,
+    ALU_XOR,
+    ALU_CMP
+};
+
+uint8_t fetch_byte(machine_t* m, int& len){
+    uint8_t b = mem_fetch(m, fetch_address(m->curr_state) + len);
+    m->curr_state.INSTR.push_back(b);
+    len++;
+    return b;
+}
+
+//little endian immediate / displacement, sign extended from its width
+int32_t fetch_simm(machine_t* m, int& len, int bytes){
+    uint32_t value = 0;
+    for(int i = 0; i < bytes; i++) value |= (uint32_t)fetch_byte(m, len) << (8*i);
+    if(bytes == 1) return (int8_t)value;
+    if(bytes == 2) return (int16_t)value;
+    return (int32_t)value;
+}
+
+//ModRM (+ SIB + displacement) operand, the reg field goes to reg_field
+operand_t decode_rm(machine_t* m, int& len, int size, int& reg_field){
+    const state_t& s = m->curr_state;
+    modrm_t modrm = get_modrm_byte(fetch_byte(m, len));
+    reg_field = modrm.reg;
+    operand_t op;
+    op.size = size;
+    op.is_reg = modrm.mod == 3;
+    op.reg = modrm.r_m;
+    op.addr = 0;
+    if(op.is_reg) return op;
+
+    ea_t ea = decode_ea(m, len, modrm, m->addr16);
+    uint32_t DS_BASE = (uint32_t)((uint16_t)s.SEGR[DS]) << 16;
+    op.addr = DS_BASE + ea.kernel(s, ea.disp);
+    return op;
+}
+
+uint32_t get_reg(const state_t& s, int reg, int size){
+    if(size == 1) return reg < 4 ? (uint32_t)s.GPR[reg] & 0xFF : ((uint32_t)s.GPR[reg - 4] >> 8) & 0xFF;
+    if(size == 2) return (uint32_t)s.GPR[reg] & 0xFFFF;
+    return (uint32_t)s.GPR[reg];
+}
+
+void set_reg(state_t& s, int reg, int size, uint32_t value){
+    if(size == 1){
+        if(reg < 4) s.GPR[reg] = (int32_t)(((uint32_t)s.GPR[reg] & 0xFFFFFF00) | (value & 0xFF));
+        else s.GPR[reg - 4] = (int32_t)(((uint32_t)s.GPR[reg - 4] & 0xFFFF00FF) | ((value & 0xFF) << 8));
+    }
+    else if(size == 2) s.GPR[reg] = (int32_t)(((uint32_t)s.GPR[reg] & 0xFFFF0000) | (value & 0xFFFF));
+    else s.GPR[reg] = (int32_t)value;
+}
+
+uint32_t read_operand(machine_t* m, const operand_t& op){
+    if(op.is_reg) return get_reg(m->curr_state, op.reg, op.size);
+    uint32_t value = 0;
+    for(int i = 0; i < op.size; i++) value |= (uint32_t)mem_read(m, op.addr + i) << (8*i);
+    return value;
+}
+
+void write_operand(machine_t* m, const operand_t& op, uint32_t value){
+    if(op.is_reg){
+        set_reg(m->next_state, op.reg, op.size, value);
+        return;
+    }
+    for(int i = 0; i < op.size; i++) mem_write(m, op.addr + i, (uint8_t)(value >> (8*i)));
+}
+
+//flags of AND / OR / XOR / TEST: CF and OF cleared
+void update_flags_logic(state_t& next_state, uint32_t result, int num_bits){
+    uint32_t mask = num_bits == 32 ? 0xFFFFFFFF : ((1u << num_bits) - 1);
+    result &= mask;
+    next_state.FLAGS[CF] = false;
+    next_state.FLAGS[OF] = false;
+    next_state.FLAGS[AF] = false;
+    next_state.FLAGS[PF] = parity((int)result, 8);
+    next_state.FLAGS[ZF] = result == 0;
+    next_state.FLAGS[SF] = (result >> (num_bits - 1)) & 1;
+}
+
+//INC / DEC leave CF alone
+void update_flags_incdec(state_t& next_state, uint32_t operand, int num_bits, bool inc){
+    bool carry = next_state.FLAGS[CF];
+    if(inc){
+        uint32_t mask = num_bits == 32 ? 0xFFFFFFFF : ((1u << num_bits) - 1);
+        uint32_t result = (operand + 1) & mask;
+        update_flags_logic(next_state, result, num_bits);
+        next_state.FLAGS[OF] = result == (1u << (num_bits - 1));
+        next_state.FLAGS[AF] = (operand & 0x0F) == 0x0F;
+    }
+    else update_flags_sub(next_state, operand, 1, num_bits);
+    next_state.FLAGS[CF] = carry;
+}
+
+//computes a op b, sets the flags and returns the result (CMP returns a, nothing is written for it)
+uint32_t alu_op(state_t& next_state, int op, uint32_t a, uint32_t b, int num_bits){
+    uint32_t result = a;
+    switch(op){
+        case ALU_OR:  result = a | b; update_flags_logic(next_state, result, num_bits); break;
+        case ALU_AND: result = a & b; update_flags_logic(next_state, result, num_bits); break;
+        case ALU_XOR: result = a ^ b; update_flags_logic(next_state, result, num_bits); break;
+        case ALU_SUB: result = a - b; update_flags_sub(next_state, a, b, num_bits); break;
+        case ALU_CMP: update_flags_sub(next_state, a, b, num_bits); break;
+    }
+    return result;
+}
+
+bool alu_op_supported(int op){
+    return op == ALU_OR || op == ALU_AND || op == ALU_SUB || op == ALU_XOR || op == ALU_CMP;
+}
+
+//true for the opcodes execute_alu handles, modrm is the byte after the opcode (for the 80-83 / F6 F7 / FE FF groups)
+bool is_alu_opcode(uint8_t opcode, uint8_t modrm){
+    int reg = (modrm >> 3) & 7;
+    if(opcode < 0x40) return (opcode & 0x07) <= 5 && alu_op_supported(opcode >> 3);
+    if(opcode <= 0x4F) return true; //INC / DEC r16/32
+    if(opcode == 0x80 || opcode == 0x81 || opcode == 0x83) return alu_op_supported(reg);
+    if(opcode == 0x84 || opcode == 0x85 || opcode == 0xA8 || opcode == 0xA9) return true;
+    if(opcode == 0xF6 || opcode == 0xF7) return reg == 0;
+    if(opcode == 0xFE) return reg <= 1;
+    if(opcode == 0xFF) return reg <= 1;
+    return false;
+}
+
+// A CMP / TEST directly followed by a Jcc is executed as one step when islx86_run_until allows it
+// (machine_t::fuse_branches). The branch is decided straight from the compared values, the Jcc still
+// counts as its own cycle.
+bool fused_condition(bool test, uint32_t a, uint32_t b, int num_bits, int cc){
+    uint32_t sign = 1u << (num_bits - 1);
+    uint32_t mask = sign | (sign - 1);
+    int shift = 32 - num_bits;
+    a &= mask;
+    b &= mask;
+    bool result = false;
+    if(test){ //r = a & b, CF = OF = 0
+        uint32_t r = a & b;
+        switch(cc >> 1){
+            case 0: case 1: result = false; break;    //O, B
+            case 2: result = r == 0; break;           //E
+            case 3: result = r == 0; break;           //BE
+            case 4: result = (r & sign) != 0; break;  //S
+            case 5: result = parity((int)r, 8); break;//P
+            case 6: result = (r & sign) != 0; break;  //L
+            case 7: result = r == 0 || (r & sign); break; //LE
+        }
+    }
+    else{ //d = a - b
+        uint32_t d = (a - b) & mask;
+        int32_t sa = (int32_t)(a << shift), sb = (int32_t)(b << shift);
+        switch(cc >> 1){
+            case 0: result = ((a ^ b) & (a ^ d) & sign) != 0; break; //O
+            case 1: result = a < b; break;                           //B
+            case 2: result = a == b; break;                          //E
+            case 3: result = a <= b; break;                          //BE
+            case 4: result = (d & sign) != 0; break;                 //S
+            case 5: result = parity((int)d, 8); break;               //P
+            case 6: result = sa < sb; break;                         //L
+            case 7: result = sa <= sb; break;                        //LE
+        }
+    }
+    return (cc & 1) ? !result : result;
+}
+
+//len is the CMP / TEST length; on success the Jcc is fetched, retired and EIP set
+bool try_fuse_jcc(machine_t* m, int& len, bool test, uint32_t a, uint32_t b, int num_bits){
+    state_t& s = m->curr_state;
+    uint32_t jcc_eip = (uint32_t)s.EIP + len;
+    if(jcc_eip == m->fuse_stop_eip || m->cycles + 2 > m->fuse_max_cycles) return false;
+    if(m->cycles + 1 >= m->next_event_cycle) return false; //an event is due in front of the Jcc
+    uint32_t at = fetch_address(s) + len;
+    uint8_t b0 = mem_peek(m, at);
+    int disp_bytes = 0;
+    int cc = 0;
+    if((b0 & 0xF0) == 0x70){
+        cc = b0 & 0x0F;
+        disp_bytes = 1;
+    }
+    else if(b0 == 0x0F && (mem_peek(m, at + 1) & 0xF0) == 0x80){
+        cc = mem_peek(m, at + 1) & 0x0F;
+        disp_bytes = 4;
+    }
+    else return false;
+
+    fetch_byte(m, len);
+    if(disp_bytes == 4) fetch_byte(m, len);
+    int32_t disp = fetch_simm(m, len, disp_bytes);
+    uint32_t fall_through = (uint32_t)s.EIP + len;
+    m->next_state.EIP = (int32_t)(fused_condition(test, a, b, num_bits, cc) ? fall_through + disp : fall_through);
+    m->cycles++; //the Jcc's own cycle, islx86_step counts the CMP / TEST
+    return true;
+}
+
+//instr_len is what fetch_and_execute already fetched (prefixes + opcode)
+void execute_alu(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len){
+    state_t& curr_state = m->curr_state;
+    state_t& next_state = m->next_state;
+    int len = instr_len;
+    int full_size = has_prefix_x66 ? 2 : 4;
+    int size = (opcode & 0x01) ? full_size : 1;
+    int reg_field = 0;
+    bool fused = false;
+
+    if(opcode < 0x40 && (opcode & 0x07) <= 3){ //op r/m, r (bit 1 clear) / op r, r/m (bit 1 set)
+        int op = opcode >> 3;
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        operand_t reg = {true, reg_field, 0, size};
+        const operand_t& dst = (opcode & 0x02) ? reg : rm;
+        const operand_t& src = (opcode & 0x02) ? rm : reg;
+        uint32_t a = read_operand(m, dst), b = read_operand(m, src);
+        uint32_t result = alu_op(next_state, op, a, b, 8*size);
+        if(op != ALU_CMP) write_operand(m, dst, result);
+        else if(m->fuse_branches) fused = try_fuse_jcc(m, len, false, a, b, 8*size);
+    }
+    else if(opcode < 0x40){ //op AL/AX/EAX, imm
+        int op = opcode >> 3;
+        operand_t acc = {true, EAX, 0, size};
+        uint32_t b = (uint32_t)fetch_simm(m, len, size);
+        uint32_t a = read_operand(m, acc);
+        uint32_t result = alu_op(next_state, op, a, b, 8*size);
+        if(op != ALU_CMP) write_operand(m, acc, result);
+        else if(m->fuse_branches) fused = try_fuse_jcc(m, len, false, a, b, 8*size);
+    }
+    else if(opcode <= 0x4F){ //INC / DEC r16/32
+        operand_t reg = {true, opcode & 0x07, 0, full_size};
+        uint32_t a = read_operand(m, reg);
+        bool inc = opcode < 0x48;
+        update_flags_incdec(next_state, a, 8*full_size, inc);
+        write_operand(m, reg, inc ? a + 1 : a - 1);
+    }
+    else if(opcode == 0x80 || opcode == 0x81 || opcode == 0x83){ //op r/m, imm (83: imm8 sign extended)
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        uint32_t b = (uint32_t)fetch_simm(m, len, opcode == 0x81 ? size : 1);
+        uint32_t a = read_operand(m, rm);
+        uint32_t result = alu_op(next_state, reg_field, a, b, 8*size);
+        if(reg_field != ALU_CMP) write_operand(m, rm, result);
+        else if(m->fuse_branches) fused = try_fuse_jcc(m, len, false, a, b, 8*size);
+    }
+    else if(opcode == 0x84 || opcode == 0x85){ //TEST r/m, r
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        operand_t reg = {true, reg_field, 0, size};
+        uint32_t a = read_operand(m, rm), b = read_operand(m, reg);
+        update_flags_logic(next_state, a & b, 8*size);
+        if(m->fuse_branches) fused = try_fuse_jcc(m, len, true, a, b, 8*size);
+    }
+    else if(opcode == 0xA8 || opcode == 0xA9){ //TEST AL/AX/EAX, imm
+        operand_t acc = {true, EAX, 0, size};
+        uint32_t b = (uint32_t)fetch_simm(m, len, size);
+        uint32_t a = read_operand(m, acc);
+        update_flags_logic(next_state, a & b, 8*size);
+        if(m->fuse_branches) fused = try_fuse_jcc(m, len, true, a, b, 8*size);
+    }
+    else if(opcode == 0xF6 || opcode == 0xF7){ //TEST r/m, imm
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        uint32_t b = (uint32_t)fetch_simm(m, len, size);
+        uint32_t a = read_operand(m, rm);
+        update_flags_logic(next_state, a & b, 8*size);
+        if(m->fuse_branches) fused = try_fuse_jcc(m, len, true, a, b, 8*size);
+    }
+    else{ //FE / FF: INC / DEC r/m
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        uint32_t a = read_operand(m, rm);
+        bool inc = reg_field == 0;
+        update_flags_incdec(next_state, a, 8*size, inc);
+        write_operand(m, rm, inc ? a + 1 : a - 1);
+    }
+    if(!fused) next_state.EIP = curr_state.EIP + len;
+}
+
+//Jcc rel8, JMP rel8 / rel32, LOOPcc / JECXZ; with 0x66 the target wraps to 16 bits, with 0x67 ECX becomes CX
+void execute_branch(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len){
+    const state_t& curr_state = m->curr_state;
+    state_t& next_state = m->next_state;
+    int len = instr_len;
+    int32_t disp = fetch_simm(m, len, opcode == 0xE9 ? (has_prefix_x66 ? 2 : 4) : 1);
+    bool taken = true;
+
+    if(opcode >= 0x70 && opcode <= 0x7F) taken = cond_holds(curr_state.FLAGS, opcode & 0x0F);
+    else if(opcode >= 0xE0 && opcode <= 0xE3){
+        uint32_t count_mask = m->addr16 ? 0xFFFF : 0xFFFFFFFF;
+        uint32_t count = (uint32_t)curr_state.GPR[ECX] & count_mask;
+        if(opcode == 0xE3) taken = count == 0; //JECXZ
+        else{
+            count = (count - 1) & count_mask;
+            next_state.GPR[ECX] = (int32_t)(((uint32_t)curr_state.GPR[ECX] & ~count_mask) | count);
+            taken = count != 0;
+            if(opcode == 0xE0) taken = taken && !curr_state.FLAGS[ZF]; //LOOPNE
+            if(opcode == 0xE1) taken = taken && curr_state.FLAGS[ZF];  //LOOPE
+        }
+    }
+    uint32_t target = (uint32_t)curr_state.EIP + len;
+    if(taken){
+        target += disp;
+        if(has_prefix_x66) target &= 0xFFFF;
+    }
+    next_state.EIP = (int32_t)target;
+}
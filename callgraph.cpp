@@ -0,0 +1,100 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Call graph profiles. Every CALL pushes a frame on a shadow stack of return addresses; a RET pops
+// back to the newest frame whose return address it actually returns to, so frames left by code
+// that returns past its caller (or unwinds by hand) are closed on the way. A RET to no open frame
+// is counted and otherwise ignored. Cycles of a call run from the CALL to the RET, both included;
+// self cycles leave out the callees. Recursive functions count every level in their total.
+// The file is text:
+//   # islx86 call graph: <calls> calls, <returns> returns to no open call
+//   # function calls self_cycles total_cycles
+//   <address> <calls> <self> <total>            (linear addresses in hex, most self cycles first)
+//   # caller callee calls total_cycles
+//   <caller> <callee> <calls> <total>           (caller of outermost calls: where profiling started)
+const size_t MAX_SHADOW_DEPTH = 1 << 16; //deeper calls are counted, not tracked
+
+void islx86_start_call_graph(machine_t* m, const string& path){
+    islx86_stop_call_graph(m);
+    ofstream probe(path, std::ios::out | std::ios::trunc);
+    if(!probe.is_open()) throw runtime_error("Could not open " + path);
+    call_graph_t* g = new call_graph_t();
+    g->path = path;
+    g->root = fetch_address(m->curr_state);
+    m->call_graph = g;
+}
+
+void call_graph_call(machine_t* m, uint32_t ret, uint32_t callee){
+    call_graph_t* g = m->call_graph;
+    uint32_t caller = g->shadow.empty() ? g->root : g->shadow.back().callee;
+    g->calls++;
+    g->functions[callee].calls++;
+    g->edges[((uint64_t)caller << 32) | callee].calls++;
+    if(g->shadow.size() < MAX_SHADOW_DEPTH) g->shadow.push_back({ret, callee, m->cycles, 0});
+}
+
+//closes the newest open frame at cycle end
+void close_frame(call_graph_t* g, uint64_t end){
+    call_frame_t f = g->shadow.back();
+    g->shadow.pop_back();
+    uint32_t caller = g->shadow.empty() ? g->root : g->shadow.back().callee;
+    uint64_t total = end - f.start;
+    call_stats_t& fn = g->functions[f.callee];
+    fn.total_cycles += total;
+    fn.self_cycles += total - f.child_cycles;
+    g->edges[((uint64_t)caller << 32) | f.callee].total_cycles += total;
+    if(!g->shadow.empty()) g->shadow.back().child_cycles += total;
+}
+
+void call_graph_return(machine_t* m, uint32_t target){
+    call_graph_t* g = m->call_graph;
+    size_t i = g->shadow.size();
+    while(i > 0 && g->shadow[i - 1].ret != target) i--;
+    if(i == 0){
+        g->unmatched++;
+        return;
+    }
+    while(g->shadow.size() >= i) close_frame(g, m->cycles + 1);
+}
+
+//closes the frames still open, writes the profile; returns the calls it counted
+uint64_t islx86_stop_call_graph(machine_t* m){
+    call_graph_t* g = m->call_graph;
+    if(!g) return 0;
+    while(!g->shadow.empty()) close_frame(g, m->cycles);
+    vector<pair<uint32_t, call_stats_t>> functions(g->functions.begin(), g->functions.end());
+    sort(functions.begin(), functions.end(), [](const pair<uint32_t, call_stats_t>& a, const pair<uint32_t, call_stats_t>& b){
+        return a.second.self_cycles != b.second.self_cycles ? a.second.self_cycles > b.second.self_cycles : a.first < b.first;
+    });
+    vector<pair<uint64_t, call_stats_t>> edges(g->edges.begin(), g->edges.end());
+    sort(edges.begin(), edges.end(), [](const pair<uint64_t, call_stats_t>& a, const pair<uint64_t, call_stats_t>& b){
+        return a.first < b.first;
+    });
+    ofstream out(g->path, std::ios::out | std::ios::trunc);
+    out << "# islx86 call graph: " << g->calls << " calls, " << g->unmatched << " returns to no open call\n";
+    out << "# function calls self_cycles total_cycles\n";
+    char line[128];
+    for(const auto& f : functions){
+        snprintf(line, sizeof(line), "%08x %llu %llu %llu\n", f.first, (unsigned long long)f.second.calls,
+                 (unsigned long long)f.second.self_cycles, (unsigned long long)f.second.total_cycles);
+        out << line;
+    }
+    out << "# caller callee calls total_cycles\n";
+    for(const auto& e : edges){
+        snprintf(line, sizeof(line), "%08x %08x %llu %llu\n", (uint32_t)(e.first >> 32), (uint32_t)e.first,
+                 (unsigned long long)e.second.calls, (unsigned long long)e.second.total_cycles);
+        out << line;
+    }
+    uint64_t calls = g->calls;
+    delete g;
+    m->call_graph = nullptr;
+    return calls;
+}
@@ -0,0 +1,258 @@
+#include "islx86.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//captures registers plus every page dirtied since the previous checkpoint (by the guest, the loader or
+//islx86_page_written), then starts a new dirty epoch
+checkpoint_t* islx86_checkpoint(machine_t* m){
+    checkpoint_t* cp = new checkpoint_t();
+    cp->cycles = m->cycles;
+    cp->state = m->curr_state;
+    cp->state.INSTR.clear();
+    cp->irq = m->irq;
+    for(page_t* page : m->dirty_pages){
+        page_t* copy = new page_t(*page);
+        copy->dirty = false;
+        cp->pages.push_back(copy);
+        page->dirty = false;
+    }
+    m->dirty_pages.clear();
+    return cp;
+}
+
+//checkpoints are incremental: apply 0..i in order to rebuild the machine as it was at checkpoint i
+void islx86_apply_checkpoint(machine_t* m, const checkpoint_t* cp){
+    for(const page_t* saved : cp->pages){
+        page_t* page = mem_page_slow(m, saved->page_num, true);
+        if(page->mmio) continue; //a device sits there now
+        if(page->shared) page = unshare_page(m, page);
+        memcpy(page->bytes, saved->bytes, PAGE_SIZE);
+        memcpy(page->present, saved->present, sizeof(page->present));
+        mark_dirty(m, page);
+        revalidate_code_page(m, page);
+    }
+    if(m->fingerprint) fingerprint_rehash(m);
+    m->curr_state = cp->state;
+    m->next_state = cp->state;
+    m->cycles = cp->cycles;
+    m->irq = cp->irq;
+    refresh_next_event(m);
+    m->halt_reason = HALT_NONE;
+    m->run = true;
+}
+
+void islx86_free_checkpoint(checkpoint_t* cp){
+    if(!cp) return;
+    for(page_t* page : cp->pages) delete page;
+    delete cp;
+}
+
+//standalone checkpoint holding every allocated page, does not disturb the dirty page tracking
+checkpoint_t* islx86_full_checkpoint(machine_t* m){
+    checkpoint_t* cp = new checkpoint_t();
+    cp->cycles = m->cycles;
+    cp->state = m->curr_state;
+    cp->state.INSTR.clear();
+    cp->irq = m->irq;
+    for(const mem_span_t& span : islx86_mapped_pages(m)){
+        page_t* copy = new page_t(*mem_page_slow(m, span.base >> PAGE_BITS, false));
+        copy->dirty = false;
+        copy->shared = false;
+        cp->pages.push_back(copy);
+    }
+    return cp;
+}
+
+// Checkpoint files:
+//   "ISLXCKP2", uint64 cycles, int32 EIP, int32 GPR[8], int64 MMX[8], int16 SEGR[6], uint8 FLAGS[7], uint8 IF,
+//   interrupt state { uint32 idt_base, uint16 idt_limit, uint64 pending[4], uint64 shadow_end, uint8 idle,
+//                     uint32 timer period, uint8 timer vector, uint8 timer one_shot, uint64 timer expiry,
+//                     uint32 event_count, event_count x { int32 source, uint64 delta } },
+//   uint32 page_count, page_count x { uint32 page_num, uint64 present[64], uint8 bytes[4096] }
+// "ISLXCKP1" files (before interrupts) lack IF and the interrupt state and still load.
+static const char CHECKPOINT_MAGIC[8] = {'I','S','L','X','C','K','P','2'};
+static const char CHECKPOINT_MAGIC_V1[8] = {'I','S','L','X','C','K','P','1'};
+
+template<typename T> void put_field(ofstream& out, const T& v){ out.write((const char*)&v, sizeof(v)); }
+template<typename T> void get_field(ifstream& in, T& v){ in.read((char*)&v, sizeof(v)); }
+
+void save_irq(ofstream& out, const irq_t& q){
+    put_field(out, q.idt_base);
+    put_field(out, q.idt_limit);
+    put_field(out, q.pending);
+    put_field(out, q.shadow_end);
+    out.put(q.idle ? 1 : 0);
+    put_field(out, q.timer.period);
+    out.put((char)q.timer.vector);
+    out.put(q.timer.one_shot ? 1 : 0);
+    put_field(out, q.timer.expiry);
+    uint32_t event_count = (uint32_t)q.events.size();
+    put_field(out, event_count);
+    for(const event_t& e : q.events){
+        int32_t source = e.source;
+        put_field(out, source);
+        put_field(out, e.delta);
+    }
+}
+
+void load_irq(ifstream& in, irq_t& q){
+    get_field(in, q.idt_base);
+    get_field(in, q.idt_limit);
+    get_field(in, q.pending);
+    get_field(in, q.shadow_end);
+    q.idle = in.get() != 0;
+    get_field(in, q.timer.period);
+    q.timer.vector = (uint8_t)in.get();
+    q.timer.one_shot = in.get() != 0;
+    get_field(in, q.timer.expiry);
+    uint32_t event_count = 0;
+    get_field(in, event_count);
+    for(uint32_t i = 0; i < event_count && in; i++){
+        int32_t source = 0;
+        uint64_t delta = 0;
+        get_field(in, source);
+        get_field(in, delta);
+        q.events.push_back({source, delta});
+    }
+}
+
+void islx86_save_checkpoint(const checkpoint_t* cp, const string& path){
+    ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) throw runtime_error("Could not open " + path);
+    const state_t& s = cp->state;
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    out.write((const char*)&cp->cycles, sizeof(cp->cycles));
+    out.write((const char*)&s.EIP, sizeof(s.EIP));
+    out.write((const char*)s.GPR, sizeof(s.GPR));
+    out.write((const char*)s.MMX, sizeof(s.MMX));
+    out.write((const char*)s.SEGR, sizeof(s.SEGR));
+    for(int i = 0; i < 7; i++) out.put(s.FLAGS[i] ? 1 : 0);
+    out.put(s.IF ? 1 : 0);
+    save_irq(out, cp->irq);
+    uint32_t page_count = (uint32_t)cp->pages.size();
+    out.write((const char*)&page_count, sizeof(page_count));
+    for(const page_t* page : cp->pages){
+        out.write((const char*)&page->page_num, sizeof(page->page_num));
+        out.write((const char*)page->present, sizeof(page->present));
+        out.write((const char*)page->bytes, PAGE_SIZE);
+    }
+}
+
+checkpoint_t* islx86_load_checkpoint(const string& path){
+    ifstream in(path, std::ios::in | std::ios::binary);
+    char magic[8];
+    if(!in.is_open() || !in.read(magic, sizeof(magic)) ||
+       (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 && memcmp(magic, CHECKPOINT_MAGIC_V1, sizeof(magic)) != 0)){
+        throw runtime_error("Not a checkpoint file: " + path);
+    }
+    bool v1 = memcmp(magic, CHECKPOINT_MAGIC_V1, sizeof(magic)) == 0;
+    checkpoint_t* cp = new checkpoint_t();
+    state_t& s = cp->state;
+    in.read((char*)&cp->cycles, sizeof(cp->cycles));
+    in.read((char*)&s.EIP, sizeof(s.EIP));
+    in.read((char*)s.GPR, sizeof(s.GPR));
+    in.read((char*)s.MMX, sizeof(s.MMX));
+    in.read((char*)s.SEGR, sizeof(s.SEGR));
+    for(int i = 0; i < 7; i++) s.FLAGS[i] = in.get() != 0;
+    s.IF = false;
+    cp->irq = initial_irq(); //what version 1 files ran with
+    if(!v1){
+        s.IF = in.get() != 0;
+        load_irq(in, cp->irq);
+    }
+    uint32_t page_count = 0;
+    in.read((char*)&page_count, sizeof(page_count));
+    for(uint32_t i = 0; i < page_count && in; i++){
+        page_t* page = new page_t();
+        in.read((char*)&page->page_num, sizeof(page->page_num));
+        in.read((char*)page->present, sizeof(page->present));
+        in.read((char*)page->bytes, PAGE_SIZE);
+        cp->pages.push_back(page);
+    }
+    if(!in){
+        islx86_free_checkpoint(cp);
+        throw runtime_error("Truncated checkpoint file: " + path);
+    }
+    return cp;
+}
+
+void append_file(ofstream& out, const string& part_path){
+    ifstream in(part_path, std::ios::in | std::ios::binary);
+    out << in.rdbuf();
+    in.close();
+    remove(part_path.c_str());
+}
+
+// Two phase run producing the same run.dump/mem.dump as a serial run:
+//   1. m runs functionally at full speed (islx86_run_until, no dumps) and stops every `interval`
+//      instructions for a checkpoint of the pages it dirtied. A running page set keeps the latest copy
+//      of every page, so each stop also gets a complete starting point: the registers plus pointers to
+//      those copies, shared between all starting points a page did not change in between
+//   2. `threads` workers each build a machine from one starting point (one copy per page it lists)
+//      and dump its interval to a part file
+// The part files are then stitched in order. m must be loaded and not started; its callbacks fire in phase 1.
+int islx86_parallel_dumps(machine_t* m, uint64_t interval, int threads, const string& run_path, const string& mem_path, bool compress){
+    if(interval == 0) throw runtime_error("Checkpoint interval must be at least 1");
+    if(threads < 1) threads = 1;
+
+    m->dumps_enabled = false;
+    vector<checkpoint_t*> checkpoints; //own the page copies
+    vector<checkpoint_t> starts; //the same registers, pages point into checkpoints
+    map<uint32_t, page_t*> latest; //page number -> newest copy
+    auto add_start = [&](){
+        checkpoint_t* cp = islx86_checkpoint(m);
+        checkpoints.push_back(cp);
+        for(page_t* page : cp->pages) latest[page->page_num] = page;
+        starts.push_back({cp->cycles, cp->state, cp->irq, {}});
+        starts.back().pages.reserve(latest.size());
+        for(const auto& p : latest) starts.back().pages.push_back(p.second);
+    };
+    uint64_t next_checkpoint = m->cycles;
+    while(m->run){
+        if(m->cycles >= next_checkpoint){ //an idle HLT may skip cycles past a multiple of interval
+            add_start();
+            next_checkpoint = (m->cycles / interval + 1) * interval;
+        }
+        islx86_run_until(m, NO_STOP_EIP, next_checkpoint);
+    }
+    if(starts.empty()) add_start();
+    uint64_t end_cycles = m->cycles;
+
+    atomic<size_t> next_interval(0);
+    auto worker = [&](){
+        for(size_t i = next_interval++; i < starts.size(); i = next_interval++){
+            machine_t* w = islx86_create();
+            w->image = m->image;
+            if(m->program) islx86_map_program(w, m->program); //starting points then only hold what the run changed
+            w->mem_dump_format = m->mem_dump_format;
+            islx86_apply_checkpoint(w, &starts[i]);
+            islx86_set_dumps(w, run_path + ".part" + to_string(i), mem_path + ".part" + to_string(i), compress);
+            uint64_t stop = i + 1 < starts.size() ? starts[i + 1].cycles : end_cycles;
+            while(w->run && w->cycles < stop) islx86_step(w);
+            islx86_destroy(w);
+        }
+    };
+    vector<thread> pool;
+    for(int t = 0; t < threads; t++) pool.emplace_back(worker);
+    for(thread& t : pool) t.join();
+
+    //a compressed part starts a fresh delta chain, so the stitched file is a sequence of complete traces
+    ofstream run_out(run_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    ofstream mem_out(mem_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    for(size_t i = 0; i < starts.size(); i++){
+        append_file(run_out, run_path + ".part" + to_string(i));
+        append_file(mem_out, mem_path + ".part" + to_string(i));
+        islx86_free_checkpoint(checkpoints[i]);
+    }
+    return m->halt_reason;
+}
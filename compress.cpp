@@ -0,0 +1,243 @@
+#include "islx86.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Compressed trace files (run.dump.lz / mem.dump.lz)
+//   header : "ISLXLZ01"
+//   blocks : { uint32 raw_len, uint32 comp_len, comp_len bytes of LZ data }
+// Raw block data is a sequence of records, each a varint length followed by the record XORed
+// with the previous record (bytes past the previous record's end are stored as is). Dump records
+// barely change between cycles, so the XOR leaves long zero runs the LZ stage folds away.
+// Traces may be concatenated (parallel runs stitch their parts); a header mid file restarts the delta chain.
+static const char TRACE_MAGIC[8] = {'I','S','L','X','L','Z','0','1'};
+const size_t TRACE_BLOCK_SIZE = 256 * 1024;
+
+// LZ codec: LZ4 style sequences of
+//   token (literal count << 4 | match length - 4), extra literal count bytes, literals,
+//   uint16 offset, extra match length bytes
+// counts of 15 continue in following bytes (255 means keep adding). The last sequence has no match.
+const int LZ_MIN_MATCH = 4;
+const int LZ_HASH_BITS = 14;
+const size_t LZ_MAX_OFFSET = 65535;
+const size_t LZ_LAST_LITERALS = 5; //matches never run into the final bytes, keeps the decoder simple
+
+inline uint32_t read32(const uint8_t* p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint32_t lz_hash(uint32_t v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void lz_put_count(vector<uint8_t>& dst, size_t count){
+    while(count >= 255){
+        dst.push_back(255);
+        count -= 255;
+    }
+    dst.push_back((uint8_t)count);
+}
+
+void lz_put_sequence(vector<uint8_t>& dst, const uint8_t* literals, size_t lit_len, size_t offset, size_t match_len){
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4) | (uint8_t)(match_code < 15 ? match_code : 15);
+    dst.push_back(token);
+    if(lit_len >= 15) lz_put_count(dst, lit_len - 15);
+    dst.insert(dst.end(), literals, literals + lit_len);
+    if(!match_len) return;
+    dst.push_back((uint8_t)(offset & 0xFF));
+    dst.push_back((uint8_t)(offset >> 8));
+    if(match_code >= 15) lz_put_count(dst, match_code - 15);
+}
+
+//greedy single pass compressor, appends to dst
+void lz_compress(const uint8_t* src, size_t n, vector<uint8_t>& dst){
+    vector<uint32_t> table(1u << LZ_HASH_BITS, 0);
+    size_t ip = 0, anchor = 0;
+    size_t limit = n > LZ_LAST_LITERALS + LZ_MIN_MATCH ? n - LZ_LAST_LITERALS - LZ_MIN_MATCH : 0;
+
+    while(ip < limit){
+        uint32_t seq = read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip;
+        if(ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq){
+            ip++;
+            continue;
+        }
+        size_t len = LZ_MIN_MATCH;
+        size_t match_end = n - LZ_LAST_LITERALS;
+        while(ip + len < match_end && src[ref + len] == src[ip + len]) len++;
+
+        lz_put_sequence(dst, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+        if(ip - 2 < limit) table[lz_hash(read32(src + ip - 2))] = (uint32_t)(ip - 2);
+    }
+    lz_put_sequence(dst, src + anchor, n - anchor, 0, 0);
+}
+
+size_t lz_get_count(const uint8_t*& p, const uint8_t* end, size_t count){
+    if(count != 15) return count;
+    uint8_t b;
+    do{
+        if(p >= end) throw runtime_error("Corrupt compressed block");
+        b = *p++;
+        count += b;
+    }while(b == 255);
+    return count;
+}
+
+//decompresses exactly raw_len bytes into dst
+void lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t raw_len){
+    const uint8_t* p = src;
+    const uint8_t* end = src + n;
+    size_t op = 0;
+    while(p < end){
+        uint8_t token = *p++;
+        size_t lit_len = lz_get_count(p, end, token >> 4);
+        if(lit_len > (size_t)(end - p) || op + lit_len > raw_len) throw runtime_error("Corrupt compressed block");
+        memcpy(dst + op, p, lit_len);
+        p += lit_len;
+        op += lit_len;
+        if(p >= end) break; //last sequence
+
+        if(end - p < 2) throw runtime_error("Corrupt compressed block");
+        size_t offset = p[0] | ((size_t)p[1] << 8);
+        p += 2;
+        size_t match_len = lz_get_count(p, end, token & 0x0F) + LZ_MIN_MATCH;
+        if(offset == 0 || offset > op || op + match_len > raw_len) throw runtime_error("Corrupt compressed block");
+        for(size_t i = 0; i < match_len; i++, op++) dst[op] = dst[op - offset]; //may overlap
+    }
+    if(op != raw_len) throw runtime_error("Corrupt compressed block");
+}
+
+void trace_flush_block(trace_writer_t* w){
+    if(w->block.empty()) return;
+    w->packed.clear();
+    lz_compress(w->block.data(), w->block.size(), w->packed);
+    uint32_t lens[2] = {(uint32_t)w->block.size(), (uint32_t)w->packed.size()};
+    w->out.write((const char*)lens, sizeof(lens));
+    w->out.write((const char*)w->packed.data(), w->packed.size());
+    w->out_bytes += sizeof(lens) + w->packed.size();
+    w->block.clear();
+}
+
+trace_writer_t* trace_open_writer(const string& path){
+    trace_writer_t* w = new trace_writer_t();
+    w->out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!w->out.is_open()){
+        delete w;
+        throw runtime_error("Could not open " + path);
+    }
+    w->out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    w->raw_bytes = 0;
+    w->out_bytes = sizeof(TRACE_MAGIC);
+    w->block.reserve(TRACE_BLOCK_SIZE + 64);
+    return w;
+}
+
+void trace_put(trace_writer_t* w, const char* data, size_t len){
+    size_t v = len;
+    while(v >= 0x80){
+        w->block.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    w->block.push_back((uint8_t)v);
+
+    size_t common = len < w->prev.size() ? len : w->prev.size();
+    size_t at = w->block.size();
+    w->block.resize(at + len);
+    uint8_t* out = w->block.data() + at;
+    const uint8_t* in = (const uint8_t*)data;
+    const uint8_t* prev = (const uint8_t*)w->prev.data();
+    for(size_t i = 0; i < common; i++) out[i] = in[i] ^ prev[i];
+    memcpy(out + common, in + common, len - common);
+
+    w->prev.assign(data, len);
+    w->raw_bytes += len;
+    if(w->block.size() >= TRACE_BLOCK_SIZE) trace_flush_block(w);
+}
+
+void trace_close_writer(trace_writer_t* w){
+    if(!w) return;
+    trace_flush_block(w);
+    delete w;
+}
+
+trace_reader_t* islx86_open_trace(const string& path){
+    trace_reader_t* r = new trace_reader_t();
+    r->in.open(path, std::ios::in | std::ios::binary);
+    char magic[8];
+    if(!r->in.is_open() || !r->in.read(magic, sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0){
+        delete r;
+        throw runtime_error("Not a compressed trace: " + path);
+    }
+    r->pos = 0;
+    return r;
+}
+
+//next record in write order, false at the end of the trace
+bool islx86_next_record(trace_reader_t* r, string& record){
+    while(r->pos >= r->block.size()){
+        uint32_t lens[2];
+        if(!r->in.read((char*)lens, sizeof(lens))) return false;
+        if(memcmp(lens, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0){ //concatenated trace, new delta chain
+            r->prev.clear();
+            continue;
+        }
+        r->packed.resize(lens[1]);
+        if(!r->in.read((char*)r->packed.data(), lens[1])) throw runtime_error("Truncated compressed trace");
+        r->block.resize(lens[0]);
+        lz_decompress(r->packed.data(), lens[1], r->block.data(), lens[0]);
+        r->pos = 0;
+    }
+
+    size_t len = 0;
+    for(int shift = 0; ; shift += 7){
+        if(r->pos >= r->block.size()) throw runtime_error("Corrupt compressed trace");
+        uint8_t b = r->block[r->pos++];
+        len |= (size_t)(b & 0x7F) << shift;
+        if(!(b & 0x80)) break;
+    }
+    if(len > r->block.size() - r->pos) throw runtime_error("Corrupt compressed trace");
+
+    const uint8_t* in = r->block.data() + r->pos;
+    size_t common = len < r->prev.size() ? len : r->prev.size();
+    record.resize(len);
+    for(size_t i = 0; i < common; i++) record[i] = (char)(in[i] ^ (uint8_t)r->prev[i]);
+    memcpy(&record[0] + common, in + common, len - common);
+    r->pos += len;
+    r->prev = record;
+    return true;
+}
+
+void islx86_close_trace(trace_reader_t* r){
+    delete r;
+}
+
+//expands a .lz trace back into the plain text dump it was written from
+void islx86_decompress_trace(const string& in_path, const string& out_path){
+    trace_reader_t* r = islx86_open_trace(in_path);
+    ofstream out(out_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open()){
+        islx86_close_trace(r);
+        throw runtime_error("Could not open " + out_path);
+    }
+    string record;
+    try{
+        while(islx86_next_record(r, record)) out.write(record.data(), record.size());
+    }
+    catch(...){
+        islx86_close_trace(r);
+        throw;
+    }
+    islx86_close_trace(r);
+}
@@ -0,0 +1,185 @@
+#include "islx86.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Coverage files:
+//   "ISLXCOV1", uint32 page_count,
+//   page_count x { uint32 page_num, uint64 exec[64], uint64 taken[64], uint64 not_taken[64] }
+// bit n of a page's arrays is linear address page_num * 4096 + n. The annotated summary goes next
+// to it as <path>.txt.
+static const char COVERAGE_MAGIC[8] = {'I','S','L','X','C','O','V','1'};
+
+inline bool bit_test(const uint64_t* bits, uint32_t addr){
+    uint32_t off = addr & PAGE_MASK;
+    return (bits[off >> 6] >> (off & 63)) & 1;
+}
+
+//sets the bit, returns 1 if it was new
+inline uint64_t bit_set(uint64_t* bits, uint32_t addr){
+    uint32_t off = addr & PAGE_MASK;
+    uint64_t bit = (uint64_t)1 << (off & 63);
+    uint64_t was_new = (bits[off >> 6] & bit) ? 0 : 1;
+    bits[off >> 6] |= bit;
+    return was_new;
+}
+
+cov_page_t* cov_page(coverage_t* c, uint32_t addr){
+    uint32_t page_num = addr >> PAGE_BITS;
+    if(c->last_page && c->last_page_num == page_num) return c->last_page;
+    cov_page_t*& page = c->pages[page_num];
+    if(!page) page = new cov_page_t();
+    c->last_page = page;
+    c->last_page_num = page_num;
+    return page;
+}
+
+const cov_page_t* find_cov_page(const coverage_t* c, uint32_t addr){
+    auto it = c->pages.find(addr >> PAGE_BITS);
+    return it == c->pages.end() ? nullptr : it->second;
+}
+
+void islx86_start_coverage(machine_t* m, const string& path, const string& source_path){
+    islx86_stop_coverage(m);
+    coverage_t* c = new coverage_t();
+    c->last_page = nullptr;
+    c->at_block_start = true;
+    c->skip_block = false;
+    c->new_bits = 0;
+    c->path = path;
+    c->source_path = source_path;
+    m->coverage = c;
+}
+
+//called after every step with the linear address the instruction was fetched from
+void coverage_step(machine_t* m, uint32_t pc){
+    coverage_t* c = m->coverage;
+    if(c->at_block_start){
+        c->block_start = pc;
+        c->skip_block = bit_test(cov_page(c, pc)->block_done, pc);
+        c->at_block_start = false;
+    }
+    if(!c->skip_block) c->new_bits += bit_set(cov_page(c, pc)->exec, pc);
+    if(!is_block_end(m->last_instr)) return;
+
+    if(is_cond_branch(m->last_instr)){ //edges are recorded even in covered blocks
+        uint32_t fall_through = pc + (uint32_t)m->last_instr.size();
+        if(fetch_address(m->curr_state) != fall_through) c->new_bits += bit_set(cov_page(c, pc)->taken, pc);
+        else c->new_bits += bit_set(cov_page(c, pc)->not_taken, pc);
+    }
+    if(!c->skip_block) bit_set(cov_page(c, c->block_start)->block_done, c->block_start);
+    c->at_block_start = true;
+}
+
+//control left the current block without finishing it (an interrupt came in): the next step starts a
+//block, the interrupted one stays unfinished
+void coverage_redirect(machine_t* m){
+    m->coverage->at_block_start = true;
+}
+
+//mem.txt with every line prefixed by whether it ran and, for conditional branches, which way it went
+void write_coverage_report(const coverage_t* c, ofstream& out){
+    uint64_t lines = 0, ran = 0, branches = 0, edges = 0;
+    vector<string> report;
+
+    ifstream source(c->source_path);
+    string line;
+    vector<uint8_t> bytes;
+    char magic[8] = {0};
+    source.read(magic, sizeof(magic));
+    if(memcmp(magic, "ISLXIMG1", sizeof(magic)) == 0) source.close(); //binary sidecar, nothing to annotate
+    source.clear();
+    source.seekg(0);
+    while(source.is_open() && getline(source, line)){
+        uint32_t base_addr = 0;
+        bool data_line = false;
+        try{
+            data_line = parse_mem_line(line, base_addr, bytes) && !bytes.empty();
+        }
+        catch(const exception&){ //not a mem.txt after all
+            report.clear();
+            break;
+        }
+        if(!data_line){
+            report.push_back("             " + line);
+            continue;
+        }
+        bool executed = false;
+        for(uint32_t a = base_addr; a < base_addr + bytes.size(); a++){
+            const cov_page_t* page = find_cov_page(c, a);
+            if(page && bit_test(page->exec, a)) executed = true;
+        }
+        const cov_page_t* page = find_cov_page(c, base_addr);
+        bool is_branch = is_cond_branch(bytes);
+        bool taken = page && bit_test(page->taken, base_addr);
+        bool not_taken = page && bit_test(page->not_taken, base_addr);
+
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "%5s %4s   ", executed ? "X" : "-",
+                 is_branch ? (taken ? (not_taken ? "T N" : "T -") : (not_taken ? "- N" : "- -")) : "");
+        report.push_back(prefix + line);
+        lines++;
+        if(executed) ran++;
+        if(is_branch){
+            branches++;
+            edges += (taken ? 1 : 0) + (not_taken ? 1 : 0);
+        }
+    }
+
+    uint64_t instructions = 0;
+    for(const auto& p : c->pages){
+        for(int w = 0; w < (int)(PAGE_SIZE / 64); w++) instructions += __builtin_popcountll(p.second->exec[w]);
+    }
+    out << "==================== x86 GUEST CODE COVERAGE ====================\n\n";
+    out << "Instruction addresses executed: " << instructions << "\n";
+    if(!report.empty()){
+        out << "Source lines executed: " << ran << " of " << lines << " (" << c->source_path << ")\n";
+        out << "Conditional branch edges covered: " << edges << " of " << 2 * branches << "\n\n";
+        out << " exec  T/N   line\n";
+        for(const string& r : report) out << r << '\n';
+        return;
+    }
+    //no text source to annotate: list the executed instruction addresses
+    out << "\n";
+    for(const auto& p : c->pages){
+        for(uint32_t off = 0; off < PAGE_SIZE; off++){
+            uint32_t addr = (p.first << PAGE_BITS) | off;
+            if(!bit_test(p.second->exec, addr)) continue;
+            char buf[48];
+            snprintf(buf, sizeof(buf), "0x%08x%s%s\n", addr, bit_test(p.second->taken, addr) ? " T" : "",
+                     bit_test(p.second->not_taken, addr) ? " N" : "");
+            out << buf;
+        }
+    }
+}
+
+//writes the coverage file and its annotated summary, then stops collecting
+void islx86_stop_coverage(machine_t* m){
+    coverage_t* c = m->coverage;
+    if(!c) return;
+    m->coverage = nullptr;
+
+    ofstream out(c->path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC));
+    uint32_t page_count = (uint32_t)c->pages.size();
+    out.write((const char*)&page_count, sizeof(page_count));
+    for(const auto& p : c->pages){
+        out.write((const char*)&p.first, sizeof(p.first));
+        out.write((const char*)p.second->exec, sizeof(p.second->exec));
+        out.write((const char*)p.second->taken, sizeof(p.second->taken));
+        out.write((const char*)p.second->not_taken, sizeof(p.second->not_taken));
+    }
+    out.close();
+
+    ofstream report(c->path + ".txt", std::ios::out | std::ios::trunc);
+    write_coverage_report(c, report);
+
+    for(auto& p : c->pages) delete p.second;
+    delete c;
+}
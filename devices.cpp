@@ -0,0 +1,232 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Memory mapped devices. islx86_map_device claims the pages of a range (map_device_pages turns them
+// into MMIO pages again after every load, which drops the page table), mmio_read / mmio_write find
+// the device an access belongs to. Device accesses count as memory changes for spin detection, so a
+// loop polling a register is never taken for one that cannot exit.
+// The built in devices:
+//   UART            +0 transmit (reads 0, nothing to receive), +5 line status (0x60: always ready to send)
+//   cycle counter   +0..+7 cycles so far, little endian, read only
+//   block device    +0 sector (32 bit), +4 command (1 read the sector into the buffer, 2 write the buffer
+//                   to it), +5 status (0 ok, 1 sector past the end or host I/O error), +8 sectors (32 bit,
+//                   read only), +0x200..+0x3FF the sector buffer
+// Output is batched: the UART hands DEVICE_BATCH bytes at a time to the host and block writes go through
+// stdio buffering; islx86_flush_devices (called when islx86_run_until returns and by islx86_destroy)
+// pushes out the rest.
+const size_t DEVICE_BATCH = 4096;
+const uint32_t UART_SIZE = 8;
+const uint8_t UART_LSR_READY = 0x60; //transmit holding register and transmitter empty
+const uint32_t COUNTER_SIZE = 8;
+const uint32_t SECTOR_SIZE = 512;
+const uint32_t DISK_BUFFER = 0x200;
+const uint32_t DISK_SIZE = DISK_BUFFER + SECTOR_SIZE;
+
+typedef struct{
+    FILE* out;
+    bool owns_out; //opened for the device, not stdout
+    string pending;
+}uart_t;
+
+typedef struct{
+    FILE* file;
+    uint32_t sector, sectors;
+    uint8_t status;
+    uint8_t buffer[SECTOR_SIZE];
+}disk_t;
+
+//makes every page of each device an MMIO page; an existing page is cleared in place, so pointers the
+//machine holds to it (last_page, dirty_pages) stay valid
+void map_device_pages(machine_t* m){
+    for(const device_t& d : m->devices){
+        uint32_t last = (uint32_t)(((uint64_t)d.base + d.size - 1) >> PAGE_BITS);
+        for(uint32_t p = d.base >> PAGE_BITS; p <= last; p++){
+            page_t* page = mem_page_slow(m, p, false);
+            if(page && page->mmio) continue;
+            if(!page){
+                page_t**& table = m->page_dir[p >> PT_BITS];
+                if(!table) table = new page_t*[PT_ENTRIES]();
+                page = new page_t(); //never dirty: checkpoints and snapshots have nothing to keep of it
+                page->page_num = p;
+                table[p & (PT_ENTRIES - 1)] = page;
+                m->pages_allocated++;
+            }
+            else{
+                if(page->shared) page = unshare_page(m, page);
+                if(m->fingerprint) fingerprint_range(m, page, 0, PAGE_SIZE, false);
+                memset(page->bytes, 0, PAGE_SIZE);
+                memset(page->present, 0, sizeof(page->present));
+                revalidate_code_page(m, page);
+                if(page->dirty){ //nothing of it for checkpoints or fuzzer resets to put back
+                    page->dirty = false;
+                    m->dirty_pages.erase(find(m->dirty_pages.begin(), m->dirty_pages.end(), page));
+                }
+                m->mem_version++;
+            }
+            page->mmio = true;
+        }
+    }
+}
+
+void islx86_map_device(machine_t* m, const device_t& device){
+    if(device.size == 0 || (uint64_t)device.base + device.size > ((uint64_t)1 << 32)) throw runtime_error("Bad device range");
+    for(const device_t& d : m->devices){
+        if(device.base < (uint64_t)d.base + d.size && d.base < (uint64_t)device.base + device.size) throw runtime_error("Device ranges overlap");
+    }
+    m->devices.push_back(device);
+    map_device_pages(m);
+}
+
+//the device holding addr, null for the unclaimed rest of an MMIO page
+inline const device_t* find_device(const machine_t* m, uint32_t addr){
+    for(const device_t& d : m->devices){
+        if(addr - d.base < d.size) return &d;
+    }
+    return nullptr;
+}
+
+uint8_t mmio_read(machine_t* m, uint32_t addr){
+    m->mem_version++;
+    const device_t* d = find_device(m, addr);
+    if(!d || !d->read) return 0xFF;
+    return d->read(m, addr - d->base, d->user);
+}
+
+void mmio_write(machine_t* m, uint32_t addr, uint8_t value){
+    m->mem_version++;
+    const device_t* d = find_device(m, addr);
+    if(d && d->write) d->write(m, addr - d->base, value, d->user);
+}
+
+void islx86_flush_devices(machine_t* m){
+    for(const device_t& d : m->devices){
+        if(d.flush) d.flush(m, d.user);
+    }
+}
+
+//flushes and frees every device, from islx86_destroy
+void destroy_devices(machine_t* m){
+    islx86_flush_devices(m);
+    for(const device_t& d : m->devices){
+        if(d.destroy) d.destroy(d.user);
+    }
+    m->devices.clear();
+}
+
+uint8_t uart_read(machine_t* m, uint32_t offset, void* user){
+    (void)m; (void)user;
+    return offset == 5 ? UART_LSR_READY : 0;
+}
+
+void uart_flush(machine_t* m, void* user){
+    (void)m;
+    uart_t* u = (uart_t*)user;
+    if(u->pending.empty()) return;
+    fwrite(u->pending.data(), 1, u->pending.size(), u->out);
+    fflush(u->out);
+    u->pending.clear();
+}
+
+void uart_write(machine_t* m, uint32_t offset, uint8_t value, void* user){
+    uart_t* u = (uart_t*)user;
+    if(offset != 0) return;
+    u->pending += (char)value;
+    if(u->pending.size() >= DEVICE_BATCH) uart_flush(m, u);
+}
+
+void uart_destroy(void* user){
+    uart_t* u = (uart_t*)user;
+    if(u->owns_out) fclose(u->out);
+    delete u;
+}
+
+//console at base; path "" sends it to stdout
+void islx86_add_uart(machine_t* m, uint32_t base, const string& path){
+    uart_t* u = new uart_t();
+    u->out = stdout;
+    if(!path.empty()){
+        u->out = fopen(path.c_str(), "wb");
+        if(!u->out){
+            delete u;
+            throw runtime_error("Could not open " + path);
+        }
+        u->owns_out = true;
+    }
+    try{
+        islx86_map_device(m, {base, UART_SIZE, uart_read, uart_write, uart_flush, uart_destroy, u});
+    }
+    catch(...){
+        uart_destroy(u);
+        throw;
+    }
+}
+
+uint8_t counter_read(machine_t* m, uint32_t offset, void* user){
+    (void)user;
+    return (uint8_t)(m->cycles >> (8 * offset)); //cycles only move between instructions, the bytes of one read agree
+}
+
+void islx86_add_cycle_counter(machine_t* m, uint32_t base){
+    islx86_map_device(m, {base, COUNTER_SIZE, counter_read, nullptr, nullptr, nullptr, nullptr});
+}
+
+uint8_t disk_read(machine_t* m, uint32_t offset, void* user){
+    (void)m;
+    const disk_t* d = (const disk_t*)user;
+    if(offset >= DISK_BUFFER) return d->buffer[offset - DISK_BUFFER];
+    if(offset < 4) return (uint8_t)(d->sector >> (8 * offset));
+    if(offset == 5) return d->status;
+    if(offset >= 8 && offset < 12) return (uint8_t)(d->sectors >> (8 * (offset - 8)));
+    return 0;
+}
+
+void disk_write(machine_t* m, uint32_t offset, uint8_t value, void* user){
+    (void)m;
+    disk_t* d = (disk_t*)user;
+    if(offset >= DISK_BUFFER){ d->buffer[offset - DISK_BUFFER] = value; return; }
+    if(offset < 4){
+        d->sector = (d->sector & ~((uint32_t)0xFF << (8 * offset))) | ((uint32_t)value << (8 * offset));
+        return;
+    }
+    if(offset != 4 || (value != 1 && value != 2)) return;
+    bool ok = d->sector < d->sectors && fseek(d->file, (long)d->sector * SECTOR_SIZE, SEEK_SET) == 0;
+    if(ok && value == 1) ok = fread(d->buffer, 1, SECTOR_SIZE, d->file) == SECTOR_SIZE;
+    if(ok && value == 2) ok = fwrite(d->buffer, 1, SECTOR_SIZE, d->file) == SECTOR_SIZE;
+    d->status = ok ? 0 : 1;
+}
+
+void disk_flush(machine_t* m, void* user){
+    (void)m;
+    fflush(((disk_t*)user)->file);
+}
+
+void disk_destroy(void* user){
+    disk_t* d = (disk_t*)user;
+    fclose(d->file);
+    delete d;
+}
+
+//block device on a host file, read and written in place; a trailing partial sector is not reachable
+void islx86_add_block_device(machine_t* m, uint32_t base, const string& path){
+    FILE* f = fopen(path.c_str(), "r+b");
+    if(!f) throw runtime_error("Could not open " + path);
+    disk_t* d = new disk_t();
+    d->file = f;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    d->sectors = size > 0 ? (uint32_t)(size / SECTOR_SIZE) : 0;
+    try{
+        islx86_map_device(m, {base, DISK_SIZE, disk_read, disk_write, disk_flush, disk_destroy, d});
+    }
+    catch(...){
+        disk_destroy(d);
+        throw;
+    }
+}
@@ -0,0 +1,199 @@
+#include "islx86.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Fingerprint files are text, one line per `interval` instructions plus one when they stop:
+//   # islx86 fingerprints every N instructions
+//   <cycles> <EIP> <hash>          (EIP and hash in hex)
+// A line is the state after <cycles> instructions, EIP being the next one to run. Two runs agree
+// up to the first line they differ on, so comparing files of a few KB finds the interval where two
+// runs, engines or simulator versions part; re-fingerprinting just that interval at a finer step
+// (--fingerprint-from, main's --bisect suggests the next round) ends at the instruction itself.
+// When both runs can be repeated in one process (the interpreter against translated code, say),
+// islx86_narrow_divergence does the rounds itself by bisecting the interval with re-runs. Runs from
+// two simulator versions can only be narrowed by the suggested rounds.
+
+inline uint64_t mix64(uint64_t h, uint64_t v){
+    h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 31);
+}
+
+//adds (or takes out) the terms of the present bytes in [off, off + len) of a page
+void fingerprint_range(machine_t* m, const page_t* page, uint32_t off, uint32_t len, bool add){
+    uint64_t sum = 0;
+    uint32_t base = page->page_num << PAGE_BITS;
+    for(uint32_t o = off; o < off + len; o++){
+        if((page->present[o >> 6] >> (o & 63)) & 1) sum += fingerprint_term(base + o, page->bytes[o]);
+    }
+    if(add) m->fingerprint->mem_hash += sum;
+    else m->fingerprint->mem_hash -= sum;
+}
+
+//recomputes the memory part from scratch, after pages were replaced wholesale (loads, checkpoints, resets)
+void fingerprint_rehash(machine_t* m){
+    m->fingerprint->mem_hash = 0;
+    for(const mem_span_t& span : islx86_mapped_pages(m)){
+        fingerprint_range(m, mem_page_slow(m, span.base >> PAGE_BITS, false), 0, PAGE_SIZE, true);
+    }
+}
+
+//fingerprint of the current state, needs fingerprinting to be on (the memory part is kept up to date incrementally)
+uint64_t islx86_fingerprint(machine_t* m){
+    if(!m->fingerprint) throw runtime_error("Fingerprinting is not started");
+    const state_t& s = m->curr_state;
+    uint64_t h = mix64(0, (uint32_t)s.EIP);
+    for(int i = 0; i < 8; i++) h = mix64(h, (uint32_t)s.GPR[i]);
+    for(int i = 0; i < 6; i++) h = mix64(h, (uint16_t)s.SEGR[i]);
+    for(int i = 0; i < 8; i++) h = mix64(h, (uint64_t)s.MMX[i]);
+    uint64_t flags = 0;
+    for(int i = 0; i < 7; i++) flags |= (uint64_t)s.FLAGS[i] << i;
+    flags |= (uint64_t)s.IF << 7;
+    h = mix64(h, flags);
+    return mix64(h, m->fingerprint->mem_hash);
+}
+
+void write_fingerprint(machine_t* m){
+    fingerprint_t* f = m->fingerprint;
+    char line[64];
+    int n = snprintf(line, sizeof(line), "%" PRIu64 " %08x %016" PRIx64 "\n", m->cycles, (uint32_t)m->curr_state.EIP,
+                     islx86_fingerprint(m));
+    if(f->out.is_open()) f->out.write(line, n);
+    f->lines++;
+    f->last_cycle = m->cycles;
+    m->fingerprint_next_cycle = (m->cycles / f->interval + 1) * f->interval;
+}
+
+//writes a fingerprint now and then whenever cycles reaches a multiple of interval; fused branches,
+//translated code and spin skipping stay off meanwhile (they would step over those points).
+//An empty path writes no file, islx86_fingerprint still works
+void islx86_start_fingerprints(machine_t* m, const string& path, uint64_t interval){
+    if(interval == 0) throw runtime_error("Fingerprint interval must be at least 1");
+    islx86_stop_fingerprints(m);
+    fingerprint_t* f = new fingerprint_t();
+    if(!path.empty()){
+        f->out.open(path, std::ios::out | std::ios::trunc);
+        if(!f->out.is_open()){
+            delete f;
+            throw runtime_error("Could not open " + path);
+        }
+        f->out << "# islx86 fingerprints every " << interval << " instructions\n";
+    }
+    f->interval = interval;
+    m->fingerprint = f;
+    fingerprint_rehash(m);
+    write_fingerprint(m);
+}
+
+//writes the final state's line (unless it was just written) and closes the file, returns the lines written
+uint64_t islx86_stop_fingerprints(machine_t* m){
+    fingerprint_t* f = m->fingerprint;
+    if(!f) return 0;
+    if(m->cycles != f->last_cycle) write_fingerprint(m);
+    uint64_t lines = f->lines;
+    delete f;
+    m->fingerprint = nullptr;
+    m->fingerprint_next_cycle = UINT64_MAX;
+    return lines;
+}
+
+bool read_fingerprint_line(ifstream& in, uint64_t& cycles, uint64_t& eip, string& hash){
+    string line;
+    while(getline(in, line)){
+        if(line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        string eip_hex;
+        if(!(fields >> cycles >> eip_hex >> hash)) throw runtime_error("Bad fingerprint line: " + line);
+        eip = stoull(eip_hex, nullptr, 16);
+        return true;
+    }
+    return false;
+}
+
+//walks both files in step; lines are matched by cycle count, so the intervals must agree where they overlap
+fingerprint_diff_t islx86_compare_fingerprints(const string& path_a, const string& path_b){
+    ifstream a(path_a), b(path_b);
+    if(!a.is_open()) throw runtime_error("Could not open " + path_a);
+    if(!b.is_open()) throw runtime_error("Could not open " + path_b);
+    string header;
+    getline(a, header);
+    fingerprint_diff_t d = {false, false, 0, 0, 0, 1};
+    size_t at = header.find("every ");
+    if(at != string::npos) d.interval = stoull(header.substr(at + 6));
+    a.seekg(0);
+
+    uint64_t ca = 0, cb = 0, ea = 0, eb = 0;
+    string ha, hb;
+    bool more_a = read_fingerprint_line(a, ca, ea, ha), more_b = read_fingerprint_line(b, cb, eb, hb);
+    while(more_a && more_b){
+        if(ca < cb){ more_a = read_fingerprint_line(a, ca, ea, ha); continue; }
+        if(cb < ca){ more_b = read_fingerprint_line(b, cb, eb, hb); continue; }
+        if(ha != hb || ea != eb){
+            d.diverged = true;
+            d.bad_cycle = ca;
+            return d;
+        }
+        d.agreed = true;
+        d.good_cycle = ca;
+        d.good_eip = ea;
+        more_a = read_fingerprint_line(a, ca, ea, ha);
+        more_b = read_fingerprint_line(b, cb, eb, hb);
+    }
+    return d; //one file may go on further, runs cut short with --cycles are no divergence
+}
+
+//fresh machines of both sides run at full speed to cycle; true when they got there in the same state
+bool sides_agree(machine_t* (*create)(int side, void* user), void* user, uint64_t cycle, uint64_t& eip){
+    uint64_t hash[2], cycles[2];
+    for(int side = 0; side < 2; side++){
+        machine_t* m = create(side, user);
+        islx86_run_until(m, NO_STOP_EIP, cycle);
+        islx86_start_fingerprints(m, "", UINT64_MAX); //only now: fingerprinting would keep translated code off
+        hash[side] = islx86_fingerprint(m);
+        cycles[side] = m->cycles;
+        eip = (uint32_t)m->curr_state.EIP;
+        islx86_destroy(m);
+    }
+    return hash[0] == hash[1] && cycles[0] == cycles[1];
+}
+
+//narrows [good_cycle, bad_cycle] down to one instruction by bisecting it with re-runs: create(side, user)
+//returns a new machine for side 0 or 1 set up the way that run was (program, translation, ...), each
+//probe runs both sides from the start at full speed. Translated blocks only run when they end before
+//the probe's cycle, so a fault inside one is pinned on the block's last instruction. diverged is false
+//when the machines do not reproduce the difference at bad_cycle; agreed false when they already
+//differ at cycle 0
+fingerprint_diff_t islx86_narrow_divergence(machine_t* (*create)(int side, void* user), void* user,
+                                            uint64_t good_cycle, uint64_t bad_cycle){
+    fingerprint_diff_t d = {false, false, 0, 0, bad_cycle, 1};
+    uint64_t eip = 0;
+    if(sides_agree(create, user, bad_cycle, eip)){
+        d.good_cycle = bad_cycle;
+        d.good_eip = eip;
+        return d;
+    }
+    d.diverged = true;
+    if(good_cycle >= bad_cycle || !sides_agree(create, user, good_cycle, eip)) good_cycle = 0;
+    if(good_cycle == 0 && !sides_agree(create, user, 0, eip)){
+        d.bad_cycle = 0;
+        return d;
+    }
+    d.agreed = true;
+    while(bad_cycle - good_cycle > 1){
+        uint64_t mid = good_cycle + (bad_cycle - good_cycle) / 2;
+        if(sides_agree(create, user, mid, eip)) good_cycle = mid;
+        else bad_cycle = mid;
+    }
+    sides_agree(create, user, good_cycle, eip);
+    d.good_cycle = good_cycle;
+    d.good_eip = eip;
+    d.bad_cycle = bad_cycle;
+    return d;
+}
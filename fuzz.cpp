@@ -0,0 +1,204 @@
+#include "islx86.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+//copies every allocated page and starts a new dirty epoch, so a reset only has to touch what ran since
+snapshot_t* islx86_snapshot(machine_t* m){
+    snapshot_t* snap = new snapshot_t();
+    snap->state = m->curr_state;
+    snap->state.INSTR.clear();
+    snap->cycles = m->cycles;
+    snap->irq = m->irq;
+    for(const mem_span_t& span : islx86_mapped_pages(m)){
+        page_t* page = mem_page_slow(m, span.base >> PAGE_BITS, false);
+        snap->pages[page->page_num] = new page_t(*page);
+        snap->pages[page->page_num]->shared = false;
+        if(!page->shared) page->dirty = false;
+    }
+    m->dirty_pages.clear();
+    return snap;
+}
+
+//puts back only the pages dirtied since the snapshot (or the last reset); a harness writing its input
+//through islx86_page_view dirties them with islx86_page_written
+void islx86_reset(machine_t* m, const snapshot_t* snap){
+    for(page_t* page : m->dirty_pages){
+        auto saved = snap->pages.find(page->page_num);
+        if(saved != snap->pages.end()){
+            memcpy(page->bytes, saved->second->bytes, PAGE_SIZE);
+            memcpy(page->present, saved->second->present, sizeof(page->present));
+        }
+        else{ //first touched after the snapshot: back to how a fresh page would look
+            memset(page->bytes, 0, PAGE_SIZE);
+            memset(page->present, 0, sizeof(page->present));
+            if(m->image && image_has_page(m->image, page->page_num)) image_fill_page(m->image, page->page_num, page);
+        }
+        page->dirty = false;
+        revalidate_code_page(m, page);
+    }
+    m->dirty_pages.clear();
+    if(m->fingerprint) fingerprint_rehash(m);
+    m->curr_state = snap->state;
+    m->next_state = snap->state;
+    m->cycles = snap->cycles;
+    m->irq = snap->irq;
+    refresh_next_event(m);
+    m->halt_reason = HALT_NONE;
+    m->run = true;
+}
+
+void islx86_free_snapshot(snapshot_t* snap){
+    if(!snap) return;
+    for(auto& p : snap->pages) delete p.second;
+    delete snap;
+}
+
+static const uint8_t INTERESTING_8[] = {0x00, 0x01, 0x10, 0x20, 0x40, 0x64, 0x7F, 0x80, 0x81, 0xFF};
+static const uint16_t INTERESTING_16[] = {0x0000, 0x0080, 0x00FF, 0x0100, 0x0200, 0x03E8, 0x1000, 0x7FFF, 0x8000, 0xFFFF};
+static const uint32_t INTERESTING_32[] = {0x00000000, 0x00000001, 0x0000FFFF, 0x00010000, 0x05F5E100,
+                                          0x7FFFFFFF, 0x80000000, 0xFFFFFF80, 0xFFFFFFFF};
+
+//AFL "havoc" style: 2..16 stacked random mutations
+void mutate(vector<uint8_t>& input, const vector<vector<uint8_t>>& corpus, mt19937_64& rng){
+    size_t len = input.size();
+    if(len == 0) return;
+    auto pick = [&](size_t n){ return (size_t)(rng() % n); };
+    int rounds = 1 << (1 + pick(4));
+    for(int r = 0; r < rounds; r++){
+        switch(pick(8)){
+            case 0: //flip a bit
+                input[pick(len)] ^= (uint8_t)(1 << pick(8));
+                break;
+            case 1: //random byte
+                input[pick(len)] = (uint8_t)rng();
+                break;
+            case 2: //small add / subtract
+                input[pick(len)] += (uint8_t)(pick(2) ? 1 + pick(35) : -(int)(1 + pick(35)));
+                break;
+            case 3: //interesting byte
+                input[pick(len)] = INTERESTING_8[pick(sizeof(INTERESTING_8))];
+                break;
+            case 4: //interesting word
+                if(len >= 2){
+                    uint16_t v = INTERESTING_16[pick(sizeof(INTERESTING_16) / sizeof(uint16_t))];
+                    memcpy(&input[pick(len - 1)], &v, 2);
+                }
+                break;
+            case 5: //interesting dword
+                if(len >= 4){
+                    uint32_t v = INTERESTING_32[pick(sizeof(INTERESTING_32) / sizeof(uint32_t))];
+                    memcpy(&input[pick(len - 3)], &v, 4);
+                }
+                break;
+            case 6: //copy a chunk inside the input
+                {
+                    size_t n = 1 + pick(len);
+                    size_t from = pick(len - n + 1), to = pick(len - n + 1);
+                    memmove(&input[to], &input[from], n);
+                }
+                break;
+            case 7: //splice in the tail of another corpus entry
+                {
+                    const vector<uint8_t>& other = corpus[pick(corpus.size())];
+                    size_t at = pick(len);
+                    memcpy(&input[at], &other[at], len - at);
+                }
+                break;
+        }
+    }
+}
+
+void save_input(const string& path, const vector<uint8_t>& input){
+    ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write((const char*)input.data(), input.size());
+}
+
+// Persistent fuzzing of the guest: run to cfg.snapshot_eip once and snapshot, then repeatedly write a
+// mutated input into [input_addr, input_addr + input_len), run to HLT or max_cycles and reset.
+// Inputs that reach new coverage join the corpus (out_dir/queue-N.bin); unimplemented opcode halts
+// are saved as crashes (one per halting EIP), cycle limit runs as hangs.
+fuzz_stats_t islx86_fuzz(machine_t* m, const fuzz_config_t& cfg){
+    if(cfg.input_len == 0) throw runtime_error("Fuzz input buffer is empty");
+    mkdir(cfg.out_dir.c_str(), 0755);
+    string dir = cfg.out_dir + "/";
+
+    m->dumps_enabled = false;
+    if(cfg.snapshot_eip != NO_STOP_EIP){
+        if(islx86_run_until(m, cfg.snapshot_eip, UINT64_MAX) != HALT_BREAKPOINT){
+            throw runtime_error("Program never reaches the snapshot EIP");
+        }
+    }
+    if(!m->coverage) islx86_start_coverage(m, dir + "coverage.bin", cfg.source_path);
+    coverage_t* cov = m->coverage;
+    callbacks_t callbacks = m->callbacks; //no per execution halt messages
+    m->callbacks.on_halt = nullptr;
+    m->callbacks.on_unimplemented = nullptr;
+    snapshot_t* snap = islx86_snapshot(m);
+
+    vector<vector<uint8_t>> corpus(1, vector<uint8_t>(cfg.input_len));
+    for(uint32_t i = 0; i < cfg.input_len; i++) corpus[0][i] = mem_peek(m, cfg.input_addr + i);
+    save_input(dir + "queue-0.bin", corpus[0]);
+
+    mt19937_64 rng(cfg.seed);
+    set<uint32_t> crash_eips;
+    fuzz_stats_t stats = {0, 0, 0, 0, 0.0};
+    auto start = chrono::steady_clock::now();
+    vector<uint8_t> input;
+
+    for(uint64_t iter = 0; iter <= cfg.iterations; iter++){
+        if(iter == 0) input = corpus[0]; //baseline coverage of the seed
+        else{
+            input = corpus[rng() % corpus.size()];
+            mutate(input, corpus, rng);
+        }
+        for(uint32_t i = 0; i < cfg.input_len; i++) mem_write(m, cfg.input_addr + i, input[i]);
+
+        cov->new_bits = 0;
+        cov->at_block_start = true;
+        int reason = islx86_run_until(m, NO_STOP_EIP, snap->cycles + cfg.max_cycles);
+        stats.execs++;
+
+        if(reason == HALT_UNIMPLEMENTED || reason == HALT_FAULT){
+            uint32_t eip = fetch_address(m->curr_state); //halts leave EIP on the faulting opcode
+            if(crash_eips.insert(eip).second){
+                char name[64];
+                snprintf(name, sizeof(name), "crash-%08x.bin", eip);
+                save_input(dir + name, input);
+            }
+            stats.crashes++;
+        }
+        else if(reason == HALT_CYCLE_LIMIT){
+            if(stats.hangs == 0 || cov->new_bits) save_input(dir + "hang-" + to_string(iter) + ".bin", input);
+            stats.hangs++;
+        }
+        if(cov->new_bits && iter > 0){
+            save_input(dir + "queue-" + to_string(corpus.size()) + ".bin", input);
+            corpus.push_back(input);
+        }
+        islx86_reset(m, snap);
+
+        if(cfg.on_progress && (stats.execs & 0xFFFF) == 0){
+            stats.corpus = corpus.size();
+            stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cfg.on_progress(stats);
+        }
+    }
+
+    stats.corpus = corpus.size();
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    islx86_free_snapshot(snap);
+    m->callbacks = callbacks;
+    return stats;
+}
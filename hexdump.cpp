@@ -0,0 +1,154 @@
+#include "islx86.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Hexdump layout of mem.dump (MEM_DUMP_HEX). Same header as the per-byte layout, then the present
+// bytes in address order as 16 byte rows:
+//   0x00000400: 7f 00 00 00 68 56 34 12  .. .. .. .. .. .. .. ..  |....hV4.        |
+// ".." marks bytes inside a row that were never touched (not in the per-byte layout). Two or more
+// whole rows of one repeated byte collapse into a run line holding the inclusive range:
+//   0x00001000-0x00001fff: all 00
+// Lines are formatted by hand straight from page storage, no iostream manipulators per byte.
+const uint32_t HEX_ROW = 16;
+const uint32_t HEX_MIN_RUN_ROWS = 2;
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+inline char* put_hex(char* p, uint32_t v, int digits){
+    for(int i = digits - 1; i >= 0; i--) p[i] = HEX_DIGITS[v & 0xF], v >>= 4;
+    return p + digits;
+}
+
+//rows of one repeated byte waiting to be written as a run line (or rows if too short)
+typedef struct{
+    uint32_t start, rows;
+    uint8_t value;
+}hex_run_t;
+
+void put_hex_row(ostream& out, uint32_t addr, const uint8_t* bytes, uint32_t present){
+    char line[96];
+    char* p = line;
+    *p++ = '0'; *p++ = 'x';
+    p = put_hex(p, addr, 8);
+    *p++ = ':';
+    for(uint32_t i = 0; i < HEX_ROW; i++){
+        *p++ = ' ';
+        if(i == 8) *p++ = ' ';
+        if((present >> i) & 1) p = put_hex(p, bytes[i], 2);
+        else{ *p++ = '.'; *p++ = '.'; }
+    }
+    *p++ = ' '; *p++ = ' '; *p++ = '|';
+    for(uint32_t i = 0; i < HEX_ROW; i++){
+        uint8_t c = bytes[i];
+        *p++ = !((present >> i) & 1) ? ' ' : (c >= 0x20 && c < 0x7F ? (char)c : '.');
+    }
+    *p++ = '|'; *p++ = '\n';
+    out.write(line, p - line);
+}
+
+void flush_hex_run(ostream& out, hex_run_t& run){
+    if(!run.rows) return;
+    if(run.rows >= HEX_MIN_RUN_ROWS){
+        char line[48];
+        char* p = line;
+        *p++ = '0'; *p++ = 'x';
+        p = put_hex(p, run.start, 8);
+        *p++ = '-'; *p++ = '0'; *p++ = 'x';
+        p = put_hex(p, run.start + run.rows * HEX_ROW - 1, 8);
+        memcpy(p, ": all ", 6);
+        p = put_hex(p + 6, run.value, 2);
+        *p++ = '\n';
+        out.write(line, p - line);
+    }
+    else{
+        uint8_t bytes[HEX_ROW];
+        memset(bytes, run.value, sizeof(bytes));
+        put_hex_row(out, run.start, bytes, 0xFFFF);
+    }
+    run.rows = 0;
+}
+
+void mem_dump_hex(machine_t* m, ostream& out){
+    out << "====================== x86 MACHINE MEMORY DUMP ======================\n\n";
+    out << "CYCLE COUNT: " << std::hex << m->cycles << std::dec << "\n\n"; //hex, as the per-byte layout always printed it
+    hex_run_t run = {0, 0, 0};
+    for(uint32_t d = 0; d < PT_ENTRIES; ++d){
+        if(!m->page_dir[d]) continue;
+        for(uint32_t t = 0; t < PT_ENTRIES; ++t){
+            const page_t* page = m->page_dir[d][t];
+            if(!page) continue;
+            uint32_t base = ((d << PT_BITS) | t) << PAGE_BITS;
+            for(uint32_t off = 0; off < PAGE_SIZE; off += HEX_ROW){
+                uint32_t present = (uint32_t)(page->present[off >> 6] >> (off & 63)) & 0xFFFF;
+                if(!present) continue;
+                const uint8_t* bytes = page->bytes + off;
+                bool uniform = present == 0xFFFF && !memcmp(bytes, bytes + 1, HEX_ROW - 1);
+                uint32_t addr = base + off;
+                if(uniform && run.rows && run.value == bytes[0] && run.start + run.rows * HEX_ROW == addr){
+                    run.rows++;
+                    continue;
+                }
+                flush_hex_run(out, run);
+                if(uniform) run = {addr, 1, bytes[0]};
+                else put_hex_row(out, addr, bytes, present);
+            }
+        }
+    }
+    flush_hex_run(out, run);
+}
+
+inline int hex_value(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline void put_legacy_byte(ofstream& out, uint32_t addr, uint8_t value){
+    char line[20] = {'0', 'x'};
+    char* p = put_hex(line + 2, addr, 8);
+    memcpy(p, ": 0x", 4);
+    p = put_hex(p + 4, value, 2);
+    *p++ = '\n';
+    out.write(line, p - line);
+}
+
+//rewrites a hexdump layout mem.dump in the per-byte layout, line for line what the old mem_dump wrote
+void islx86_mem_dump_to_legacy(const string& in_path, const string& out_path){
+    ifstream in(in_path);
+    if(!in.is_open()) throw runtime_error("Could not open " + in_path);
+    ofstream out(out_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) throw runtime_error("Could not open " + out_path);
+    string line;
+    while(getline(in, line)){
+        if(line.compare(0, 2, "0x") != 0 || line.size() < 11){ //headers and blank lines are the same in both layouts
+            out << line << '\n';
+            continue;
+        }
+        uint32_t addr = (uint32_t)stoul(line.substr(2, 8), nullptr, 16);
+        if(line[10] == '-'){
+            uint32_t last = (uint32_t)stoul(line.substr(13, 8), nullptr, 16);
+            size_t all = line.find(": all ");
+            if(all == string::npos) throw runtime_error("Bad run line in " + in_path + ": " + line);
+            uint8_t value = (uint8_t)stoul(line.substr(all + 6, 2), nullptr, 16);
+            for(uint32_t a = addr; ; a++){
+                put_legacy_byte(out, a, value);
+                if(a == last) break;
+            }
+            continue;
+        }
+        size_t p = 11;
+        for(uint32_t i = 0; i < HEX_ROW; i++){
+            p += i == 8 ? 2 : 1;
+            if(p + 2 > line.size()) throw runtime_error("Bad row in " + in_path + ": " + line);
+            int hi = hex_value(line[p]), lo = hex_value(line[p + 1]);
+            if(hi >= 0 && lo >= 0) put_legacy_byte(out, addr + i, (uint8_t)(hi << 4 | lo));
+            p += 2;
+        }
+    }
+}
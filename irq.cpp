@@ -0,0 +1,272 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Interrupts and the programmable interval timer.
+//   INT n, INT3, IRET       CD ib, CC, CF (IRETW with 0x66)
+//   CLI STI                 FA FB; STI holds interrupts off for one more instruction, so STI; HLT cannot miss one
+//   IN OUT                  E4-E7 (port imm8), EC-EF (port DX)
+//   LIDT SIDT               0F 01 /3, 0F 01 /1 (m16&32: limit, linear base)
+// Gates are the 8 byte x86 ones: offset 15:0, selector, 0, type (bit 7 present, 0x8E interrupt gate
+// clears IF, 0x8F trap gate keeps it), offset 31:16. Delivery pushes EFLAGS, CS and EIP (4 bytes
+// each) at SS:ESP. A vector without a present gate inside the IDT limit halts with HALT_FAULT.
+// The timer counts cycles: port 0x40 sets the period and (re)starts it (0 stops it, reads return
+// the cycles left), 0x41 the vector (0x20), 0x42 the mode (bit 0: one shot). Other ports read all
+// ones and ignore writes.
+// Device events wait in a delta queue (irq_t::events), so between events the hot loop only compares
+// cycles with machine_t::next_event_cycle. HLT with IF set and something left to wake it idles
+// instead of halting: cycles skip straight to the next event.
+const uint16_t TIMER_PORT_COUNT = 0x40;
+const uint16_t TIMER_PORT_VECTOR = 0x41;
+const uint16_t TIMER_PORT_MODE = 0x42;
+const uint8_t TIMER_DEFAULT_VECTOR = 0x20;
+const uint8_t GATE_PRESENT = 0x80;
+
+//after loading: a full IDT at linear 0 (like the real mode vector table), nothing pending, timer stopped
+irq_t initial_irq(){
+    irq_t q = irq_t();
+    q.idt_limit = 256 * 8 - 1;
+    q.timer.vector = TIMER_DEFAULT_VECTOR;
+    return q;
+}
+
+void reset_irq(machine_t* m){
+    m->irq = initial_irq();
+    m->next_event_cycle = UINT64_MAX;
+}
+
+bool irq_pending(const irq_t& q){
+    return (q.pending[0] | q.pending[1] | q.pending[2] | q.pending[3]) != 0;
+}
+
+//recomputes the one value the hot loop compares against, after anything that could move it
+void refresh_next_event(machine_t* m){
+    const irq_t& q = m->irq;
+    uint64_t next = q.events.empty() ? UINT64_MAX : q.events[0].delta;
+    if(m->next_state.IF && irq_pending(q)) next = min(next, max(m->cycles, q.shadow_end));
+    m->next_event_cycle = next;
+}
+
+//the delta queue: events[0].delta is its absolute cycle, every later delta counts from the event before
+void schedule_event(machine_t* m, int source, uint64_t at){
+    vector<event_t>& events = m->irq.events;
+    uint64_t when = 0;
+    size_t i = 0;
+    for(; i < events.size() && when + events[i].delta <= at; i++) when += events[i].delta;
+    if(i < events.size()) events[i].delta -= at - when;
+    events.insert(events.begin() + i, {source, at - when});
+    refresh_next_event(m);
+}
+
+void cancel_event(machine_t* m, int source){
+    vector<event_t>& events = m->irq.events;
+    for(size_t i = 0; i < events.size(); i++){
+        if(events[i].source != source) continue;
+        if(i + 1 < events.size()) events[i + 1].delta += events[i].delta;
+        events.erase(events.begin() + i);
+        break;
+    }
+    refresh_next_event(m);
+}
+
+//requests vector, delivered as soon as IF allows
+void islx86_raise_irq(machine_t* m, int vector){
+    if(vector < 0 || vector > 0xFF) throw runtime_error("Interrupt vectors are 0-255");
+    m->irq.pending[vector >> 6] |= (uint64_t)1 << (vector & 63);
+    refresh_next_event(m);
+}
+
+void timer_start(machine_t* m, uint32_t period){
+    irq_timer_t& t = m->irq.timer;
+    cancel_event(m, EVENT_TIMER);
+    t.period = period;
+    if(!period) return;
+    t.expiry = m->cycles + period;
+    schedule_event(m, EVENT_TIMER, t.expiry);
+}
+
+void fire_event(machine_t* m, int source){
+    switch(source){
+        case EVENT_TIMER: {
+            irq_timer_t& t = m->irq.timer;
+            islx86_raise_irq(m, t.vector);
+            if(t.one_shot) t.period = 0;
+            else{
+                t.expiry += t.period; //keeps the phase, also when the event was serviced late
+                schedule_event(m, EVENT_TIMER, t.expiry);
+            }
+            break;
+        }
+    }
+}
+
+uint32_t pack_eflags(const state_t& s){
+    return (uint32_t)s.FLAGS[CF] | 0x2 | (uint32_t)s.FLAGS[PF] << 2 | (uint32_t)s.FLAGS[AF] << 4 | (uint32_t)s.FLAGS[ZF] << 6 |
+           (uint32_t)s.FLAGS[SF] << 7 | (uint32_t)s.IF << 9 | (uint32_t)s.FLAGS[DF] << 10 | (uint32_t)s.FLAGS[OF] << 11;
+}
+
+void unpack_eflags(state_t& s, uint32_t eflags){
+    static const int BITS[7] = {0, 2, 4, 6, 7, 10, 11}; //CF PF AF ZF SF DF OF
+    for(int f = 0; f < 7; f++) s.FLAGS[f] = (eflags >> BITS[f]) & 1;
+    s.IF = (eflags >> 9) & 1;
+}
+
+//enters the handler of vector from state s, returning to return_eip; false (and halted) if there is none
+bool enter_interrupt(machine_t* m, state_t& s, int vector, uint32_t return_eip){
+    irq_t& q = m->irq;
+    uint32_t gate = q.idt_base + (uint32_t)vector * 8;
+    uint8_t type = (uint32_t)vector * 8 + 7 <= q.idt_limit ? mem_read(m, gate + 5) : 0;
+    if(!(type & GATE_PRESENT) || ((type & 0x0F) != 0x0E && (type & 0x0F) != 0x0F)){
+        q.fault_vector = vector;
+        q.idle = false;
+        m->run = false;
+        m->halt_reason = HALT_FAULT;
+        return false;
+    }
+    uint32_t offset = 0;
+    uint16_t selector = 0;
+    for(int i = 0; i < 2; i++){
+        offset |= (uint32_t)mem_read(m, gate + i) << (8*i);
+        offset |= (uint32_t)mem_read(m, gate + 6 + i) << (16 + 8*i);
+        selector |= (uint16_t)(mem_read(m, gate + 2 + i) << (8*i));
+    }
+    push_value(m, s, pack_eflags(s), 4);
+    push_value(m, s, (uint16_t)s.SEGR[CS], 4);
+    push_value(m, s, return_eip, 4);
+    if((type & 0x0F) == 0x0E) s.IF = false;
+    s.SEGR[CS] = (int16_t)selector;
+    s.EIP = (int32_t)offset;
+    return true;
+}
+
+//between two steps: fires the events that are due, then delivers the lowest pending vector if IF allows
+void service_events(machine_t* m){
+    irq_t& q = m->irq;
+    while(!q.events.empty() && q.events[0].delta <= m->cycles){
+        event_t e = q.events[0];
+        q.events.erase(q.events.begin());
+        if(!q.events.empty()) q.events[0].delta += e.delta;
+        fire_event(m, e.source);
+    }
+    if(m->curr_state.IF && irq_pending(q) && m->cycles >= q.shadow_end){
+        int vector = 0;
+        while(!((q.pending[vector >> 6] >> (vector & 63)) & 1)) vector++;
+        q.pending[vector >> 6] &= ~((uint64_t)1 << (vector & 63));
+        q.idle = false;
+        if(enter_interrupt(m, m->next_state, vector, (uint32_t)m->curr_state.EIP)){
+            m->curr_state = m->next_state;
+            if(m->coverage) coverage_redirect(m);
+        }
+    }
+    refresh_next_event(m);
+}
+
+//a machine idling in HLT skips from event to event until an interrupt wakes it or cycles reach limit;
+//halts (HALT_HLT) when nothing is left that could wake it
+void idle_until(machine_t* m, uint64_t limit){
+    while(m->irq.idle && m->run){
+        if(m->next_event_cycle == UINT64_MAX){
+            m->irq.idle = false;
+            m->run = false;
+            m->halt_reason = HALT_HLT;
+            if(m->callbacks.on_halt) m->callbacks.on_halt(m, m->callbacks.user);
+            return;
+        }
+        if(m->next_event_cycle > limit){
+            if(limit > m->cycles) m->cycles = limit;
+            return;
+        }
+        if(m->next_event_cycle > m->cycles) m->cycles = m->next_event_cycle;
+        service_events(m);
+    }
+}
+
+//HLT: idles while IF is set and an event or interrupt could still wake the machine, otherwise it stops
+void execute_hlt(machine_t* m, int instr_len){
+    if(m->curr_state.IF && m->next_event_cycle != UINT64_MAX){
+        m->irq.idle = true;
+        m->next_state.EIP = m->curr_state.EIP + instr_len;
+        return;
+    }
+    m->run = false;
+    m->halt_reason = HALT_HLT;
+    if(m->callbacks.on_halt) m->callbacks.on_halt(m, m->callbacks.user);
+}
+
+uint32_t port_in(machine_t* m, uint16_t port){
+    const irq_timer_t& t = m->irq.timer;
+    switch(port){
+        case TIMER_PORT_COUNT: return t.period ? (uint32_t)(t.expiry - m->cycles) : 0;
+        case TIMER_PORT_VECTOR: return t.vector;
+        case TIMER_PORT_MODE: return t.one_shot ? 1 : 0;
+    }
+    return 0xFFFFFFFF;
+}
+
+void port_out(machine_t* m, uint16_t port, uint32_t value){
+    irq_timer_t& t = m->irq.timer;
+    switch(port){
+        case TIMER_PORT_COUNT: timer_start(m, value); break;
+        case TIMER_PORT_VECTOR: t.vector = (uint8_t)value; break;
+        case TIMER_PORT_MODE: t.one_shot = value & 1; break;
+    }
+}
+
+//INT n, INT3, IRET, CLI, STI, IN, OUT, and LIDT / SIDT (opcode 0x0F, instr_len past the 01)
+void execute_system_op(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len){
+    const state_t& curr_state = m->curr_state;
+    state_t& next_state = m->next_state;
+    int len = instr_len;
+    int size = has_prefix_x66 ? 2 : 4;
+
+    if(opcode == 0xCC || opcode == 0xCD){
+        int vector = opcode == 0xCC ? 3 : fetch_byte(m, len);
+        enter_interrupt(m, next_state, vector, (uint32_t)curr_state.EIP + len); //a fault leaves EIP on the INT, like other halts
+    }
+    else if(opcode == 0xCF){
+        next_state.EIP = (int32_t)pop_value(m, next_state, size);
+        next_state.SEGR[CS] = (int16_t)pop_value(m, next_state, size);
+        unpack_eflags(next_state, pop_value(m, next_state, size)); //every flag kept is in the low 16 bits
+    }
+    else if(opcode == 0xFA || opcode == 0xFB){
+        if(opcode == 0xFB && !curr_state.IF) m->irq.shadow_end = m->cycles + 2; //the instruction after STI runs first
+        next_state.IF = opcode == 0xFB;
+        next_state.EIP = curr_state.EIP + len;
+    }
+    else if(opcode == 0x0F){
+        int reg_field = 0;
+        operand_t mem = decode_rm(m, len, 6, reg_field);
+        irq_t& q = m->irq;
+        if(reg_field == 3){ //LIDT
+            uint32_t limit = 0, base = 0;
+            for(int i = 0; i < 2; i++) limit |= (uint32_t)mem_read(m, mem.addr + i) << (8*i);
+            for(int i = 0; i < 4; i++) base |= (uint32_t)mem_read(m, mem.addr + 2 + i) << (8*i);
+            q.idt_limit = (uint16_t)limit;
+            q.idt_base = has_prefix_x66 ? base & 0x00FFFFFF : base;
+        }
+        else{ //SIDT
+            for(int i = 0; i < 2; i++) mem_write(m, mem.addr + i, (uint8_t)(q.idt_limit >> (8*i)));
+            for(int i = 0; i < 4; i++) mem_write(m, mem.addr + 2 + i, (uint8_t)(q.idt_base >> (8*i)));
+        }
+        next_state.EIP = curr_state.EIP + len;
+    }
+    else{ //IN / OUT: bit 1 selects OUT, bit 3 the DX port, bit 0 the AL / eAX width
+        uint16_t port = (opcode & 0x08) ? (uint16_t)curr_state.GPR[EDX] : fetch_byte(m, len);
+        int width = (opcode & 0x01) ? size : 1;
+        uint32_t mask = width == 4 ? 0xFFFFFFFF : ((1u << (8*width)) - 1);
+        if(opcode & 0x02) port_out(m, port, (uint32_t)curr_state.GPR[EAX] & mask);
+        else next_state.GPR[EAX] = (int32_t)(((uint32_t)curr_state.GPR[EAX] & ~mask) | (port_in(m, port) & mask));
+        next_state.EIP = curr_state.EIP + len;
+    }
+    refresh_next_event(m);
+}
+
+//opcodes execute_system_op handles; for 0x0F modrm is the byte after 0F 01
+bool is_system_op(uint8_t opcode, uint8_t modrm){
+    if(opcode == 0x0F) return (modrm >> 6) != 3 && (((modrm >> 3) & 7) == 1 || ((modrm >> 3) & 7) == 3);
+    return opcode == 0xCC || opcode == 0xCD || opcode == 0xCF || opcode == 0xFA || opcode == 0xFB ||
+           (opcode >= 0xE4 && opcode <= 0xE7) || (opcode >= 0xEC && opcode <= 0xEF);
+}
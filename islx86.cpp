@@ -0,0 +1,1174 @@
+#include "islx86.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+void init_state(machine_t* m){
+    state_t& curr_state = m->curr_state;
+    curr_state.EIP = 0x00000000;
+    for(int i = 0; i < 8; i++){ curr_state.GPR[i] = 0x00000000; curr_state.MMX[i] = 0x00000000;}
+    for(int i = 0; i < 7; i++){curr_state.FLAGS[i] = false;}
+    for(int i = 0; i < 6; i++){curr_state.SEGR[i] = 0x0000;}
+    curr_state.IF = false;
+    curr_state.INSTR.clear();
+    m->next_state = curr_state;
+    m->cycles = 0;
+    m->halt_reason = HALT_NONE;
+    m->run = true;
+    reset_irq(m);
+}
+
+page_t* mem_page_slow(machine_t* m, uint32_t page_num, bool create){
+    page_t** table = m->page_dir[page_num >> PT_BITS];
+    if(!table){
+        if(!create && !(m->image && image_has_page(m->image, page_num))) return nullptr;
+        table = new page_t*[PT_ENTRIES]();
+        m->page_dir[page_num >> PT_BITS] = table;
+    }
+    page_t* page = table[page_num & (PT_ENTRIES - 1)];
+    if(!page){
+        //first touch of a page the attached image holds: fault its bytes in now
+        bool backed = m->image && image_has_page(m->image, page_num);
+        if(!create && !backed) return nullptr;
+        page = new page_t(); //zero filled, nothing present
+        page->page_num = page_num;
+        if(backed) image_fill_page(m->image, page_num, page);
+        if(backed && m->fingerprint) fingerprint_range(m, page, 0, PAGE_SIZE, true);
+        table[page_num & (PT_ENTRIES - 1)] = page;
+        mark_dirty(m, page);
+        m->pages_allocated++;
+    }
+    m->last_page = page;
+    m->last_page_num = page_num;
+    return page;
+}
+
+void free_pages(machine_t* m){
+    for(uint32_t d = 0; d < PT_ENTRIES; d++){
+        if(!m->page_dir[d]) continue;
+        for(uint32_t t = 0; t < PT_ENTRIES; t++){
+            page_t* page = m->page_dir[d][t];
+            if(page && !page->shared) delete page;
+        }
+        delete[] m->page_dir[d];
+        m->page_dir[d] = nullptr;
+    }
+    m->last_page = nullptr;
+    m->stack_page = nullptr;
+    m->dirty_pages.clear();
+    m->pages_allocated = 0;
+    islx86_release_program(m->program);
+    m->program = nullptr;
+}
+
+//splits one mem.txt line into its base address and data bytes, false for lines that hold no data
+bool parse_mem_line(const string& line, uint32_t& base_addr, vector<uint8_t>& bytes){
+    bytes.clear();
+    if(line.empty() || line.substr(0,2) != "0x") return false;
+
+    size_t colon_index = line.find(':');
+    base_addr = (uint32_t)stoul(line.substr(0, colon_index), nullptr, 16);
+
+    string raw_bytes = line.substr(colon_index + 1);
+    string processed_bytes;
+    for(size_t i = 0; i < raw_bytes.size(); i++){
+        if(raw_bytes[i] == '/') break;
+        if(raw_bytes[i] == ' ' || raw_bytes[i] == '\t' || raw_bytes[i] == '\r') continue;
+        processed_bytes += raw_bytes[i];
+    }
+    if (processed_bytes.size() % 2 != 0){
+        throw runtime_error("Odd Number of Hex Chars"); //if ever occurs, always incorrect
+    }
+    for(size_t i = 0; i < processed_bytes.size(); i += 2){
+        string byte_str = processed_bytes.substr(i, 2);
+        bytes.push_back((uint8_t)stoul(byte_str, nullptr, 16));
+    }
+    return true;
+}
+
+void init_mem(machine_t* m, string file_name){   
+    ifstream inputFile(file_name);
+    if(!inputFile.is_open()) throw runtime_error("Could not open " + file_name);
+    string line;
+    vector<uint8_t> bytes;
+
+    while (getline(inputFile, line)){
+        uint32_t base_addr = 0;
+        if(!parse_mem_line(line, base_addr, bytes)) continue;
+        uint32_t addr = base_addr;
+        for(size_t i = 0; i < bytes.size(); i++, addr++){
+            mem_write(m, addr, bytes[i]); //each byte gets own mem loc
+        }
+    }
+    inputFile.close();
+}
+
+bool w_bit_set(uint8_t opcode){
+    if(opcode & 0x01) return true;
+    return false;
+}
+
+bool sext_bit_set(uint8_t opcode){
+    if(opcode & 0x02) return true;
+    return false;
+}
+
+modrm_t get_modrm_byte(uint8_t modrm_byte){
+    modrm_t modrm;
+    modrm.mod = (modrm_byte & 0xC0) >> 6;
+    modrm.reg = (modrm_byte & 0x38) >> 3;
+    modrm.r_m = (modrm_byte & 0x07);
+    return modrm;
+}
+
+bool parity(int num, int num_bits){
+    num &= 0x0FF;
+    while(num_bits > 1){
+        num ^= num >> (num_bits/2);
+        num_bits /= 2;
+    }
+    if(num & 0x00000001) return false;
+    else return true;
+}
+
+bool adjust(int op1, int op2){
+    int bcd1 = op1 & 0x0000000F;
+    int bcd2 = op2 & 0x0000000F;
+    int result = bcd1 + bcd2;
+    if(result & 0x000010) return true;
+    return false;
+}
+
+void update_flags_add(state_t& next_state, int operand1, int operand2, int num_bits){
+    int64_t sum = (operand1 & 0x0FFFFFFFF) + (operand1 & 0x0FFFFFFFF);
+    int sign_mask = 1 << (num_bits - 1);
+
+    if((sum >> num_bits) & 0x01) next_state.FLAGS[CF] = true;
+    else next_state.FLAGS[CF] = false;
+
+    next_state.FLAGS[PF] = parity(sum, 8);
+    next_state.FLAGS[AF] = adjust(operand1, operand2);
+
+    if(sum == 0) next_state.FLAGS[ZF] = true;
+    else next_state.FLAGS[ZF] = false;
+
+    if(sum & sign_mask) next_state.FLAGS[SF] = true;
+    else next_state.FLAGS[SF] = false;
+
+    if((((operand1 ^ operand2) & sign_mask) == 0) && (((operand1 ^ sum) & sign_mask) != 0)) next_state.FLAGS[OF] = true;
+    else next_state.FLAGS[OF] = false;
+} 
+
+//flags of operand1 - operand2 (CMP, SUB, CMPS, SCAS)
+void update_flags_sub(state_t& next_state, uint32_t operand1, uint32_t operand2, int num_bits){
+    uint64_t mask = num_bits == 32 ? 0xFFFFFFFFull : ((1ull << num_bits) - 1);
+    uint64_t a = operand1 & mask, b = operand2 & mask;
+    uint64_t diff = (a - b) & mask;
+    uint64_t sign_mask = 1ull << (num_bits - 1);
+
+    next_state.FLAGS[CF] = a < b;
+    next_state.FLAGS[PF] = parity((int)diff, 8);
+    next_state.FLAGS[AF] = ((a ^ b ^ diff) & 0x10) != 0;
+    next_state.FLAGS[ZF] = diff == 0;
+    next_state.FLAGS[SF] = (diff & sign_mask) != 0;
+    next_state.FLAGS[OF] = ((a ^ b) & (a ^ diff) & sign_mask) != 0;
+}
+
+int eval_reg(int reg_rm){
+    switch (reg_rm){
+        case 0:
+            reg_rm = EAX;
+            break;
+        case 1:
+            reg_rm = ECX;
+            break;
+        case 2:
+            reg_rm = EDX;
+            break;
+        case 3:
+            reg_rm = EBX;
+            break;
+        case 4:
+            reg_rm = ESP;
+            break;
+        case 5:
+            reg_rm = EBP;
+            break;
+        case 6:
+            reg_rm = ESI;
+            break;
+        case 7:
+            reg_rm = EDI;
+            break;
+    }
+    return reg_rm;
+}
+
+void fetch_and_execute(machine_t* m){
+    state_t& curr_state = m->curr_state;
+    state_t& next_state = m->next_state;
+    int bytes_fetched = 0;
+    curr_state.INSTR.clear();
+    // set segemnt registers for correct access (CS for fetch and DS for any other acess)
+    uint32_t CS_BASE = (uint32_t)((uint16_t)curr_state.SEGR[CS]) << 16;
+    uint32_t DS_BASE = (uint32_t)((uint16_t)curr_state.SEGR[DS]) << 16;
+
+    //helpers 
+    auto fetch8 = [&](uint32_t off){
+        return mem_fetch(m, CS_BASE + off);
+    };
+
+    auto read8_data = [&](uint32_t off){
+        return mem_read(m, DS_BASE + off);
+    };
+
+    auto write8_data = [&](uint32_t off, uint8_t value){
+        mem_write(m, DS_BASE + off, value);
+    };
+
+    auto readN_data = [&](uint32_t off, int nbytes){
+        uint64_t value = 0;
+        for(int i = 0; i < nbytes; i++){
+            uint64_t byte = (uint64_t)read8_data(off + i);
+            value = value + (byte << (8*i));
+        }
+        return value;
+    };
+
+    auto writeN_data = [&](uint32_t off, int nbytes, uint64_t value){
+        for(int i = 0; i < nbytes; i++){
+            uint8_t byte = (uint8_t)((value >> (8*i)) & 0xFF);
+            write8_data(off + i, byte);
+        }
+    };
+
+    //fetch first byte
+    curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+    bytes_fetched++;
+
+    //cout << "Initial Byte Fetched: " << hex << (int)curr_state.INSTR[0] << '\n';
+
+    //check for x66, x67 and REP prefixes
+    bool has_prefix_x66 = false;
+    uint8_t rep_prefix = 0;
+    m->addr16 = false;
+    while(is_prefix(curr_state.INSTR[bytes_fetched - 1]) && bytes_fetched < 15) {
+        if(curr_state.INSTR[bytes_fetched - 1] == 0x66) has_prefix_x66 = true;
+        else if(curr_state.INSTR[bytes_fetched - 1] == 0x67) m->addr16 = true;
+        else rep_prefix = curr_state.INSTR[bytes_fetched - 1];
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        bytes_fetched++;
+    }
+
+    uint8_t opcode_B1 = curr_state.INSTR[bytes_fetched - 1];
+    bool w_bit = w_bit_set(opcode_B1);
+    bool s_bit = sext_bit_set(opcode_B1);
+
+    if(is_alu_opcode(opcode_B1, mem_peek(m, CS_BASE + curr_state.EIP + bytes_fetched))){ //OR AND SUB XOR CMP TEST INC DEC
+        execute_alu(m, opcode_B1, has_prefix_x66, bytes_fetched);
+    }
+    else if((opcode_B1 >= 0x70 && opcode_B1 <= 0x7F) || (opcode_B1 >= 0xE0 && opcode_B1 <= 0xE3) ||
+            opcode_B1 == 0xE9 || opcode_B1 == 0xEB){ //Jcc rel8, LOOPcc, JECXZ, JMP rel
+        execute_branch(m, opcode_B1, has_prefix_x66, bytes_fetched);
+    }
+    else if(opcode_B1 == 0x04 || opcode_B1 == 0x05){//add to EAX, AX, AL
+        if(has_prefix_x66){ //16 bit add to AX
+            int imm_length = 2;
+            uint16_t imm = 0;
+            for(int i = 0; i < imm_length; i++){
+                int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                curr_state.INSTR.push_back(new_byte);
+                bytes_fetched++;
+                imm |= (new_byte << (8*i));
+            }
+            int result = (((next_state.GPR[EAX] & 0x0000FFFF) + imm) & 0x0FFFF);
+            update_flags_add(next_state, imm, next_state.GPR[EAX] & 0x0000FFFF, 16);
+            next_state.GPR[EAX] = (next_state.GPR[EAX] & 0xFFFF0000) + result;
+        }
+        else if(opcode_B1 & 0x01){ //32 bit add to EAX
+            int imm_length = 4;
+            uint32_t imm = 0;
+            for(int i = 0; i < imm_length; i++){
+                int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                curr_state.INSTR.push_back(new_byte);
+                bytes_fetched++;
+                imm |= (new_byte << (8*i));
+            }
+            int result = (next_state.GPR[EAX]) + (int32_t)imm;
+            update_flags_add(next_state, imm, next_state.GPR[EAX], 32);
+            next_state.GPR[EAX] = result;
+        }
+        else{ //8 bit add to AL
+            int imm_length = 1;
+            uint32_t imm = 0;
+            for(int i = 0; i < imm_length; i++){
+                int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                curr_state.INSTR.push_back(new_byte);
+                bytes_fetched++;
+                imm |= (new_byte << (8*i));
+            }
+            int result = (((next_state.GPR[EAX] & 0x000000FF) + imm) & 0x0FF);
+            update_flags_add(next_state, imm, next_state.GPR[EAX] & 0x000000FF, 8);
+            next_state.GPR[EAX] = (next_state.GPR[EAX] & 0xFFFFFF00) + result;
+        }
+        next_state.EIP = curr_state.EIP + bytes_fetched;
+    }
+    else if(opcode_B1 == 0x80 || opcode_B1 == 0x81 || opcode_B1 == 0x83){ // r/m adds with immediate
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+        bytes_fetched++;
+
+        if(modrm_byte.mod == 3){ //reg mode
+            int dest_reg = 0;
+            switch (modrm_byte.r_m){
+                case 0: 
+                    dest_reg = EAX; 
+                    break;
+                case 1: 
+                    dest_reg = ECX; 
+                    break;
+                case 2: 
+                    dest_reg = EDX; 
+                    break;
+                case 3: 
+                    dest_reg = EBX; 
+                    break;
+                case 4: 
+                    dest_reg = ESP; 
+                    break;
+                case 5: 
+                    dest_reg = EBP; 
+                    break;
+                case 6: 
+                    dest_reg = ESI; 
+                    break;
+                case 7: 
+                    dest_reg = EDI; 
+                    break;
+            }
+
+            if(has_prefix_x66){ // 16-bit
+                int imm_length = 0;
+                if (s_bit) imm_length = 1;
+                else imm_length = 2;
+
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+                if(s_bit){
+                    if(imm & 0x80) imm |= 0xFFFFFF00; 
+                }
+
+                int result = ((curr_state.GPR[dest_reg] & 0x0000FFFF) + imm) & 0x0FFFF;
+                update_flags_add(next_state, curr_state.GPR[dest_reg] & 0x0000FFFF, imm, 16);
+                next_state.GPR[dest_reg] = (curr_state.GPR[dest_reg] & 0xFFFF0000) + result;
+            }
+            else if(w_bit){ // 32 bit
+                int imm_length = 0;
+                if (s_bit) imm_length = 1;
+                else imm_length = 4;
+
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+                if(s_bit){
+                    if(imm & 0x80) imm |= 0xFFFFFF00;
+                }
+
+                int result = (curr_state.GPR[dest_reg] + imm);
+                update_flags_add(next_state, curr_state.GPR[dest_reg], imm, 32);
+                next_state.GPR[dest_reg] = result;
+            }
+            else{ // 8 bit
+                int imm_length = 1;
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+
+                if(dest_reg < 4){
+                    int result = ((curr_state.GPR[dest_reg] & 0x000000FF) + imm) & 0x0FF;
+                    update_flags_add(next_state, curr_state.GPR[dest_reg] & 0x000000FF, imm, 8);
+                    next_state.GPR[dest_reg] = (curr_state.GPR[dest_reg] & 0xFFFFFF00) + result;
+                }
+                else{
+                    int result = (((curr_state.GPR[dest_reg % 4] & 0x0000FF00)>>8) + imm) & 0x0FF;
+                    update_flags_add(next_state, ((curr_state.GPR[dest_reg % 4] & 0x0000FF00)>>8), imm, 8);
+                    next_state.GPR[dest_reg % 4] = (curr_state.GPR[dest_reg % 4] & 0xFFFF00FF) + (result<<8);
+                }
+            }
+        }
+        else{
+            ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+            uint32_t EA = ea.kernel(curr_state, ea.disp);
+
+            int mem_loc_value = 0;
+
+            if(has_prefix_x66){ //16 bit r/m
+                int imm_length = (s_bit ? 1 : 2);
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+                if(s_bit){
+                    if(imm & 0x80) imm |= 0xFFFFFF00;
+                }
+
+                mem_loc_value = (int)readN_data(EA, 2);
+                uint16_t result = (uint16_t)((mem_loc_value + imm) & 0xFFFF);
+                update_flags_add(next_state, imm, mem_loc_value, 16);
+                writeN_data(EA, 2, result);
+            }
+            else if(w_bit){ //32 bit r/m
+                int imm_length = (s_bit ? 1 : 4);
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+                if(s_bit){
+                    if(imm & 0x80) imm |= 0xFFFFFF00;
+                }
+
+                mem_loc_value = (int32_t)readN_data(EA, 4);
+                int32_t result = (int32_t)(mem_loc_value + imm);
+                update_flags_add(next_state, imm, mem_loc_value, 32);
+                writeN_data(EA, 4, (uint32_t)result);
+            }
+            else{ //8 bit r/m
+                int imm_length = 1;
+                int imm = 0;
+                for(int i = 0; i < imm_length; i++){
+                    int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                    curr_state.INSTR.push_back(new_byte);
+                    bytes_fetched++;
+                    imm |= (new_byte << (8*i));
+                }
+
+                mem_loc_value = (int)readN_data(EA, 1);
+                uint8_t result = (uint8_t)((mem_loc_value + imm) & 0xFF);
+                update_flags_add(next_state, imm, mem_loc_value, 8);
+                writeN_data(EA, 1, result);
+            }
+        }
+
+        next_state.EIP = curr_state.EIP + bytes_fetched;
+    }
+    else if(opcode_B1 == 0x00 || opcode_B1 == 0x01 || opcode_B1 == 0x02 || opcode_B1 == 0x03){ //r/m adds no immediate 
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+        bytes_fetched++;
+
+        if(modrm_byte.mod == 3){ //reg to reg
+            int reg_REG = eval_reg(modrm_byte.reg);
+            int reg_rm  = eval_reg(modrm_byte.r_m);
+
+            if(has_prefix_x66){ //16-bit add
+                int value_reg = curr_state.GPR[reg_REG] & 0x0000FFFF;
+                int value_rm  = curr_state.GPR[reg_rm]  & 0x0000FFFF;
+                int dest_reg = 0;
+                if(opcode_B1 & 0x02) dest_reg = reg_rm;   
+                else dest_reg = reg_rm;                   
+                if(!(opcode_B1 & 0x02)) dest_reg = reg_rm; else dest_reg = reg_REG;
+
+                int result = (value_reg + value_rm) & 0x0FFFF;
+                update_flags_add(next_state, value_reg, value_rm, 16);
+                next_state.GPR[dest_reg] = (curr_state.GPR[dest_reg] & 0xFFFF0000) + result;
+            }
+            else if(w_bit){ // 32 bit add
+                int value_reg = curr_state.GPR[reg_REG];
+                int value_rm  = curr_state.GPR[reg_rm];
+                int dest_reg = 0;
+                if(opcode_B1 & 0x02) dest_reg = reg_REG; else dest_reg = reg_rm;
+                int result = (value_reg + value_rm);
+                update_flags_add(next_state, value_reg, value_rm, 32);
+                next_state.GPR[dest_reg] = result;
+            }
+            else { //8 bit add
+                int value_reg = curr_state.GPR[reg_REG] & 0x000000FF;
+                int value_rm  = curr_state.GPR[reg_rm]  & 0x000000FF;
+                int dest_reg = 0;
+                if(opcode_B1 & 0x02) dest_reg = reg_REG; else dest_reg = reg_rm;
+                int result = (value_reg + value_rm) & 0x0FF;
+                update_flags_add(next_state, value_reg, value_rm, 8);
+                next_state.GPR[dest_reg] = (curr_state.GPR[dest_reg] & 0xFFFFFF00) + result;
+            }
+        }
+        else{
+            ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+            uint32_t EA = ea.kernel(curr_state, ea.disp);
+
+            int source_reg_name = eval_reg(modrm_byte.reg);
+
+            bool store_to_mem_op = false;
+            if(opcode_B1 & 0x02) store_to_mem_op = false; // 02/03 write to REG
+            else store_to_mem_op = true;                  // 00/01 write to r/m
+
+            if(has_prefix_x66){ //16 bit add
+                int mem_loc_value = (int)readN_data(EA, 2);
+                int reg_val = curr_state.GPR[source_reg_name] & 0x0000FFFF;
+
+                int result = (mem_loc_value + reg_val) & 0x0FFFF;
+                update_flags_add(next_state, reg_val, mem_loc_value, 16);
+
+                if(store_to_mem_op) writeN_data(EA, 2, (uint16_t)result);
+                else next_state.GPR[source_reg_name] = (curr_state.GPR[source_reg_name] & 0xFFFF0000) + (result & 0xFFFF);
+            }
+            else if(w_bit){ // 32 bit add
+                int32_t mem_loc_value = (int32_t)readN_data(EA, 4);
+                int32_t reg_val = curr_state.GPR[source_reg_name];
+
+                int32_t result = mem_loc_value + reg_val;
+                update_flags_add(next_state, reg_val, mem_loc_value, 32);
+
+                if(store_to_mem_op) writeN_data(EA, 4, (uint32_t)result);
+                else next_state.GPR[source_reg_name] = result;
+            }
+            else{ //8 bit add
+                int mem_loc_value = (int)readN_data(EA, 1);
+                int reg_index = source_reg_name;
+                if(reg_index < 4){
+                    int reg_val = curr_state.GPR[reg_index] & 0xFF;
+
+                    if(store_to_mem_op){
+                        int result = (mem_loc_value + reg_val) & 0xFF;
+                        update_flags_add(next_state, reg_val, mem_loc_value, 8);
+                        writeN_data(EA, 1, (uint8_t)result);
+                    }
+                    else{
+                        int result = (reg_val + mem_loc_value) & 0xFF;
+                        update_flags_add(next_state, reg_val, mem_loc_value, 8);
+                        next_state.GPR[reg_index] = (curr_state.GPR[reg_index] & 0xFFFFFF00) + result;
+                    }
+                }
+                else{
+                    int lo_reg = reg_index % 4;
+                    int reg_val = (curr_state.GPR[lo_reg] & 0x0000FF00) >> 8;
+
+                    if(store_to_mem_op){
+                        int result = (mem_loc_value + reg_val) & 0xFF;
+                        update_flags_add(next_state, reg_val, mem_loc_value, 8);
+                        writeN_data(EA, 1, (uint8_t)result);
+                    }
+                    else{
+                        int result = (reg_val + mem_loc_value) & 0xFF;
+                        update_flags_add(next_state, reg_val, mem_loc_value, 8);
+                        next_state.GPR[lo_reg] = (curr_state.GPR[lo_reg] & 0xFFFF00FF) + (result << 8);
+                    }
+                }
+            }
+        }
+        next_state.EIP = curr_state.EIP + bytes_fetched;
+    }
+    else if(opcode_B1 == 0x0F){ // multi-byte opcode instrs
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        bytes_fetched++;
+        int opcode_B2 = curr_state.INSTR[bytes_fetched - 1];
+        if((opcode_B2 & 0xF0) == 0x80){ //Jcc rel32 (rel16 with 0x66)
+            int disp_bytes = has_prefix_x66 ? 2 : 4;
+            int32_t disp32 = 0;
+            for(int i = 0; i < disp_bytes; i++){
+                int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+                curr_state.INSTR.push_back(new_byte);
+                bytes_fetched++;
+                disp32 |= (new_byte << (8*i));
+            }
+            if(disp_bytes == 2) disp32 = (int16_t)disp32;
+
+            uint32_t EIP_NT = curr_state.EIP + bytes_fetched;
+            if(cond_holds(curr_state.FLAGS, opcode_B2 & 0x0F)){
+                uint32_t target = EIP_NT + disp32;
+                if(has_prefix_x66) target &= 0xFFFF;
+                next_state.EIP = (int32_t)target;
+            }
+            else{
+                next_state.EIP = (int32_t)EIP_NT;
+            }
+        }
+
+        else if(opcode_B2 == 0xB1){ //CMPXCHG (16 bit operands)
+            curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+            modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+            bytes_fetched++;
+            int reg_r16 = eval_reg(modrm_byte.reg);
+
+            if(modrm_byte.mod == 3){
+                int rm_reg = eval_reg(modrm_byte.r_m);
+
+                uint16_t AX_val = (uint16_t)(curr_state.GPR[EAX] & 0xFFFF);
+                uint16_t rm_reg_val = (uint16_t)(curr_state.GPR[rm_reg] & 0xFFFF);
+                uint16_t reg_REG_val = (uint16_t)(curr_state.GPR[reg_r16] & 0xFFFF);
+
+                if(AX_val == rm_reg_val){
+                    next_state.FLAGS[ZF] = true;
+                    next_state.GPR[rm_reg] = (curr_state.GPR[rm_reg] & 0xFFFF0000) + (uint16_t)reg_REG_val;
+                }
+                else{
+                    next_state.FLAGS[ZF] = false;
+                    next_state.GPR[EAX] = (curr_state.GPR[EAX] & 0xFFFF0000) + (uint16_t)rm_reg_val;
+                }
+            }
+            else{
+                ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+                uint32_t EA = ea.kernel(curr_state, ea.disp);
+
+                uint16_t AX_val = (uint16_t)(curr_state.GPR[EAX] & 0xFFFF);
+                uint16_t rm_reg_val = (uint16_t)readN_data(EA, 2);
+                uint16_t reg_REG_val = (uint16_t)(curr_state.GPR[reg_r16] & 0xFFFF);
+
+                if(AX_val == rm_reg_val){
+                    next_state.FLAGS[ZF] = true;
+                    writeN_data(EA, 2, reg_REG_val);
+                }else{
+                    next_state.FLAGS[ZF] = false;
+                    next_state.GPR[EAX] = (curr_state.GPR[EAX] & 0xFFFF0000) + rm_reg_val;
+                }
+            }
+            next_state.EIP = curr_state.EIP + bytes_fetched;
+        }
+        else if(opcode_B2 == 0x01 && is_system_op(0x0F, mem_peek(m, CS_BASE + curr_state.EIP + bytes_fetched))){ //LIDT, SIDT
+            execute_system_op(m, 0x0F, has_prefix_x66, bytes_fetched);
+        }
+        else{ //MOVQ (MMX)
+            curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+            modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+            bytes_fetched++;
+
+            if(modrm_byte.mod == 3){
+                int source_reg, dest_reg;
+                if(opcode_B2 == 0xD6){source_reg = modrm_byte.reg; dest_reg = modrm_byte.r_m;}
+                else {dest_reg = modrm_byte.reg; source_reg = modrm_byte.r_m;}
+                next_state.MMX[dest_reg] = curr_state.MMX[source_reg];
+            }
+            else{
+                int dest_reg = modrm_byte.reg;
+
+                ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+                uint32_t EA = ea.kernel(curr_state, ea.disp);
+
+                int64_t mem_loc_value = (int64_t)readN_data(EA, 8);
+                next_state.MMX[dest_reg] = mem_loc_value;
+            }
+
+            next_state.EIP = curr_state.EIP + bytes_fetched;
+        }
+    }
+    else if(opcode_B1 == 0x8E){ //MOV to SREG
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+        bytes_fetched++;
+
+        if(modrm_byte.mod == 3){
+            int source_reg_value = curr_state.GPR[modrm_byte.r_m] & 0x0000FFFF;
+            int dest_sreg = modrm_byte.reg;
+            switch (dest_sreg){
+                case 0: 
+                    dest_sreg = ES; 
+                    break;
+                case 1: 
+                    dest_sreg = CS; 
+                    break;
+                case 2: 
+                    dest_sreg = SS; 
+                    break;
+                case 3: 
+                    dest_sreg = DS; 
+                    break;
+                case 4: 
+                    dest_sreg = FS; 
+                    break;
+                case 5: 
+                    dest_sreg = GS; 
+                    break;
+            }
+            next_state.SEGR[dest_sreg] = (int16_t)source_reg_value;
+        }
+        else{
+            int dest_reg = modrm_byte.reg;
+
+            ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+            uint32_t EA = ea.kernel(curr_state, ea.disp);
+            int16_t mem_loc_value = (int16_t)readN_data(EA, 2);
+            next_state.SEGR[dest_reg] = mem_loc_value;
+        }
+        next_state.EIP = curr_state.EIP + bytes_fetched;
+    }
+
+    else if(opcode_B1 == 0x86){ //XCHG (8 bits)
+        curr_state.INSTR.push_back(fetch8(curr_state.EIP + bytes_fetched));
+        modrm_t modrm_byte = get_modrm_byte(curr_state.INSTR[bytes_fetched]);
+        bytes_fetched++;
+
+        if(modrm_byte.mod == 3){
+            int reg1_name = eval_reg(modrm_byte.reg);
+            int reg2_name = eval_reg(modrm_byte.r_m);
+
+            if(reg1_name < 4 && reg2_name < 4){
+                int reg1_val = curr_state.GPR[reg1_name] & 0x000000FF;
+                int reg2_val = curr_state.GPR[reg2_name] & 0x000000FF;
+                next_state.GPR[reg2_name] = (curr_state.GPR[reg2_name] & 0xFFFFFF00) + reg1_val;
+                next_state.GPR[reg1_name] = (curr_state.GPR[reg1_name] & 0xFFFFFF00) + reg2_val;
+            }
+            else if(reg1_name >= 4 && reg2_name < 4){
+                int reg1_val = (curr_state.GPR[reg1_name % 4] & 0x0000FF00) >> 8;
+                int reg2_val = curr_state.GPR[reg2_name] & 0x000000FF;
+                next_state.GPR[reg2_name] = (curr_state.GPR[reg2_name] & 0xFFFFFF00) + reg1_val;
+                next_state.GPR[reg1_name % 4] = (curr_state.GPR[reg1_name% 4] & 0xFFFF00FF) + (reg2_val << 8);
+            }
+            else if(reg1_name < 4 && reg2_name >= 4){
+                int reg2_val = (curr_state.GPR[reg2_name % 4] & 0x0000FF00) >> 8;
+                int reg1_val = curr_state.GPR[reg1_name] & 0x000000FF;
+                next_state.GPR[reg1_name] = (curr_state.GPR[reg1_name] & 0xFFFFFF00) + reg2_val;
+                next_state.GPR[reg2_name % 4] = (curr_state.GPR[reg2_name % 4] & 0xFFFF00FF) + (reg1_val << 8);
+            }
+            else{
+                int reg1_val = (curr_state.GPR[reg1_name % 4] & 0x0000FF00) >> 8;
+                int reg2_val = (curr_state.GPR[reg2_name % 4] & 0x0000FF00) >> 8;
+                next_state.GPR[reg2_name % 4] = (curr_state.GPR[reg2_name % 4] & 0xFFFF00FF) + (reg1_val << 8);
+                next_state.GPR[reg1_name % 4] = (curr_state.GPR[reg1_name % 4] & 0xFFFF00FF) + (reg2_val << 8);
+            }
+        }
+        else{
+            int dest_reg = modrm_byte.reg;
+
+            ea_t ea = decode_ea(m, bytes_fetched, modrm_byte, m->addr16);
+            uint32_t EA = ea.kernel(curr_state, ea.disp);
+
+            uint8_t mem_val = (uint8_t)readN_data(EA, 1);
+
+            if(dest_reg < 4){
+                uint8_t reg_val = (uint8_t)(curr_state.GPR[dest_reg] & 0xFF);
+                next_state.GPR[dest_reg] = (curr_state.GPR[dest_reg] & 0xFFFFFF00) + mem_val;
+                writeN_data(EA, 1, reg_val);
+            }
+            else{
+                uint8_t reg_val = (uint8_t)((curr_state.GPR[dest_reg % 4] & 0x0000FF00) >> 8);
+                next_state.GPR[dest_reg % 4] = (curr_state.GPR[dest_reg % 4] & 0xFFFF00FF) + ((uint32_t)mem_val << 8);
+                writeN_data(EA, 1, reg_val);
+            }
+        }
+
+        next_state.EIP = curr_state.EIP + bytes_fetched;
+    }
+    else if(opcode_B1 == 0xEA){
+        uint32_t off32 = 0;
+        for(int i = 0; i < 4; i++){
+            int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+            curr_state.INSTR.push_back(new_byte);
+            bytes_fetched++;
+            off32 |= ((uint32_t)new_byte << (8*i));
+        }
+
+        uint16_t sel16 = 0;
+        for(int i = 0; i < 2; i++){
+            int new_byte = fetch8(curr_state.EIP + bytes_fetched);
+            curr_state.INSTR.push_back(new_byte);
+            bytes_fetched++;
+            sel16 |= ((uint16_t)new_byte << (8*i));
+        }
+
+        next_state.SEGR[CS] = (int16_t)sel16;
+        next_state.EIP = (int32_t)off32;
+    }
+
+    else if(opcode_B1 >= 0xA4 && opcode_B1 <= 0xAF && opcode_B1 != 0xA8 && opcode_B1 != 0xA9){ //MOVS CMPS STOS LODS SCAS
+        execute_string_op(m, opcode_B1, rep_prefix, has_prefix_x66, bytes_fetched);
+    }
+
+    else if(is_stack_op(opcode_B1, mem_peek(m, CS_BASE + curr_state.EIP + bytes_fetched))){ //PUSH POP CALL RET ENTER LEAVE
+        execute_stack_op(m, opcode_B1, has_prefix_x66, bytes_fetched);
+    }
+
+    else if(is_system_op(opcode_B1, 0)){ //INT, IRET, CLI, STI, IN, OUT
+        execute_system_op(m, opcode_B1, has_prefix_x66, bytes_fetched);
+    }
+
+    else if(opcode_B1 == 0xF4){
+        execute_hlt(m, bytes_fetched);
+    }
+
+    else{
+        // Unknown opcode exception: halt machine
+        m->run = false;
+        m->halt_reason = HALT_UNIMPLEMENTED;
+        if(m->callbacks.on_unimplemented) m->callbacks.on_unimplemented(m, opcode_B1, m->callbacks.user);
+    }
+}
+
+//The Formatting Framework Functions for Dump Files Below were Generated by an LLM and editted by Me
+//For the visual pleasure of the TA grading this work
+uint32_t u32(int32_t x) { return static_cast<uint32_t>(x); }
+uint16_t lo16(uint32_t x) { return static_cast<uint16_t>(x & 0xFFFFu); }
+uint8_t lo8(uint32_t x) { return static_cast<uint8_t >(x & 0xFFu); }
+uint8_t hi8(uint32_t x) { return static_cast<uint8_t >((x >> 8) & 0xFFu); }
+int flag01(bool b) { return b ? 1 : 0; }
+
+void printBytes(std::ostream& os, const std::vector<uint8_t>& bytes, size_t perLine = 16) {
+    if (bytes.empty()) { os << "(empty)\n"; return; }
+    os << std::hex << std::setfill('0');
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        if (i % perLine == 0) os << "  ";
+        os << std::setw(2) << static_cast<unsigned>(bytes[i]) << ' ';
+        if ((i + 1) % perLine == 0) os << '\n';
+    }
+    if (bytes.size() % perLine != 0) os << '\n';
+    os << std::dec << std::setfill(' ');
+}
+
+//dump streams stay open for the whole run, so put them back to a fresh stream's format each call
+void reset_format(std::ostream& out) {
+    out.flags(std::ios::skipws | std::ios::dec);
+    out.fill(' ');
+}
+
+void dump_state(machine_t* m, std::ostream& out){
+    const state_t& curr_state = m->curr_state;
+    reset_format(out);
+    static const char* GPR32[8] = {"EAX","ECX","EDX","EBX","ESP","EBP","ESI","EDI"};
+    static const char* GPR16[8] = {"AX","CX","DX","BX","SP","BP","SI","DI"};
+    static const char* SEGRN[6] = {"ES","CS","SS","DS","FS","GS"};
+    static const char* FLGN[7]  = {"CF","PF","AF","ZF","SF","DF","OF"};
+
+    auto printRegLine = [&](int idx) {
+        uint32_t v = u32(curr_state.GPR[idx]);
+        uint16_t r16 = lo16(v);
+        uint8_t  r8l = lo8(v);
+
+        out << std::left
+            << std::setw(3) << GPR32[idx] << " = 0x" << std::right << std::hex << std::setw(8) << std::setfill('0') << v
+            << "   "
+            << std::left << std::setw(2) << GPR16[idx] << " = 0x" << std::right << std::setw(4) << r16
+            << "   "
+            << std::left << std::setw(2) << (std::string(1, GPR16[idx][0]) + "L") << " = 0x" << std::right << std::setw(2) << static_cast<unsigned>(r8l);
+        if (idx <= 3) {
+            uint8_t r8h = hi8(v);
+            out << "   "
+                << std::left << std::setw(2) << (std::string(1, GPR16[idx][0]) + "H") << " = 0x"
+                << std::right << std::setw(2) << static_cast<unsigned>(r8h);
+        } else {
+            out << "   " << "  " << "    " << "   " << "  " << "    "; // spacing to keep columns aligned
+        }
+
+        out << std::dec << std::setfill(' ') << '\n';
+    };
+
+    out << "\n\n";
+    out << "====================== x86 MACHINE STATE DUMP ======================\n\n";
+    out << "EIP = 0x" << std::hex << std::setw(8) << std::setfill('0')
+        << u32(curr_state.EIP) << std::dec << std::setfill(' ') << "\n\n";
+    out << "------------------------------ GPRs --------------------------------\n";
+    out << "REG      32-bit              16-bit              8-bit low   8-bit high\n";
+    out << "---------------------------------------------------------------------\n";
+    for (int i = 0; i < 8; ++i) printRegLine(i);
+    out << "\n";
+    out << "--------------------------- SEGMENTS -------------------------------\n";
+    out << std::hex << std::setfill('0');
+    for (int i = 0; i < 6; ++i) {
+        out << std::left << std::setw(2) << SEGRN[i]
+            << " = 0x" << std::right << std::setw(4) << (static_cast<uint16_t>(curr_state.SEGR[i]) & 0xFFFFu)
+            << ((i % 3 == 2) ? "\n" : "   ");
+    }
+    if (6 % 3 != 0) out << "\n";
+    out << std::dec << std::setfill(' ') << "\n";
+    out << "------------------------------ MMX ---------------------------------\n";
+    out << std::hex << std::setfill('0');
+    for (int i = 0; i < 8; ++i) {
+        uint64_t v = static_cast<uint64_t>(curr_state.MMX[i]);
+        out << "MMX" << i << " = 0x" << std::setw(16) << v << "\n";
+    }
+    out << std::dec << std::setfill(' ') << "\n";
+    out << "----------------------------- FLAGS -------------------------------\n";
+    for (int i = 0; i < 7; ++i) {
+        out << FLGN[i] << '=' << flag01(curr_state.FLAGS[i]) << ((i == 6) ? '\n' : ' ');
+    }
+    out << "\n";
+}
+
+void mem_dump(machine_t* m, std::ostream& out) {
+    reset_format(out);
+    if (m->mem_dump_format == MEM_DUMP_HEX) return mem_dump_hex(m, out);
+    out << std::hex << std::setfill('0');
+    out << "====================== x86 MACHINE MEMORY DUMP ======================\n\n";
+    out << "CYCLE COUNT: " << m->cycles << "\n\n";
+    for (uint32_t d = 0; d < PT_ENTRIES; ++d) {
+        if (!m->page_dir[d]) continue;
+        for (uint32_t t = 0; t < PT_ENTRIES; ++t) {
+            const page_t* page = m->page_dir[d][t];
+            if (!page) continue;
+            uint32_t base = ((d << PT_BITS) | t) << PAGE_BITS;
+            for (uint32_t off = 0; off < PAGE_SIZE; ++off) {
+                if (!((page->present[off >> 6] >> (off & 63)) & 1)) continue;
+                out << "0x"
+                    << std::setw(8) << (base + off)
+                    << ": 0x"
+                    << std::setw(2) << static_cast<unsigned>(page->bytes[off])
+                    << '\n';
+            }
+        }
+    }
+    out << std::dec << std::setfill(' ');
+}
+
+void cycle(machine_t* m){
+    while(m->run){
+        islx86_step(m);
+    }
+}
+
+machine_t* islx86_create(){
+    machine_t* m = new machine_t();
+    init_state(m);
+    m->sample_countdown = UINT64_MAX;
+    m->live_next_cycle = UINT64_MAX;
+    m->fingerprint_next_cycle = UINT64_MAX;
+    return m;
+}
+
+void islx86_destroy(machine_t* m){
+    islx86_stop_sampling(m);
+    islx86_stop_coverage(m);
+    islx86_stop_live(m);
+    islx86_stop_access_trace(m);
+    islx86_stop_fingerprints(m);
+    islx86_stop_call_graph(m);
+    trace_close_writer(m->run_trace);
+    trace_close_writer(m->mem_trace);
+    islx86_unload_translation(m);
+    destroy_devices(m);
+    free_pages(m);
+    delete m;
+}
+
+void islx86_load(machine_t* m, const string& file_name){
+    islx86_unload_translation(m);
+    init_state(m);
+    free_pages(m);
+    m->image = nullptr;
+    init_mem(m, file_name);
+    map_device_pages(m);
+    if(m->fingerprint) fingerprint_rehash(m);
+}
+
+//demand paged load: nothing is copied until the guest touches a page, the image must outlive the machine
+void islx86_load_image(machine_t* m, const image_t* image){
+    islx86_unload_translation(m);
+    init_state(m);
+    free_pages(m);
+    m->image = image;
+    map_device_pages(m);
+    if(m->fingerprint) fingerprint_rehash(m);
+}
+
+void islx86_load_bytes(machine_t* m, uint32_t addr, const uint8_t* data, size_t len){
+    for(size_t i = 0; i < len; i++) mem_write(m, addr + (uint32_t)i, data[i]);
+}
+
+void islx86_set_callbacks(machine_t* m, const callbacks_t& callbacks){
+    m->callbacks = callbacks;
+}
+
+//opens (and truncates) the dump files; after this every step appends to them
+void islx86_set_dumps(machine_t* m, const string& run_path, const string& mem_path, bool compress){
+    m->run_dump.close();
+    m->mem_dump.close();
+    trace_close_writer(m->run_trace);
+    trace_close_writer(m->mem_trace);
+    m->run_trace = m->mem_trace = nullptr;
+    if(compress){
+        m->run_trace = trace_open_writer(run_path);
+        m->mem_trace = trace_open_writer(mem_path);
+    }
+    else{
+        m->run_dump.open(run_path, std::ios::out | std::ios::trunc);
+        m->mem_dump.open(mem_path, std::ios::out | std::ios::trunc);
+    }
+    m->dumps_enabled = true;
+}
+
+//layout of the mem.dump records written from the next step on (MEM_DUMP_BYTES by default)
+void islx86_set_mem_dump_format(machine_t* m, int format){
+    if(format != MEM_DUMP_BYTES && format != MEM_DUMP_HEX) throw runtime_error("Unknown mem.dump format");
+    m->mem_dump_format = format;
+}
+
+//branches whose outcome depends on the flags
+bool is_cond_branch(const vector<uint8_t>& instr){
+    size_t i = 0;
+    while(i < instr.size() && is_prefix(instr[i])) i++;
+    if(i >= instr.size()) return false;
+    if((instr[i] >= 0x70 && instr[i] <= 0x7F) || (instr[i] >= 0xE0 && instr[i] <= 0xE3)) return true; //Jcc rel8, LOOPcc, JECXZ
+    return i + 1 < instr.size() && instr[i] == 0x0F && (instr[i + 1] & 0xF0) == 0x80; //Jcc rel32
+}
+
+//control transfers end a basic block (taken or not)
+bool is_block_end(const vector<uint8_t>& instr){
+    size_t i = 0;
+    while(i < instr.size() && is_prefix(instr[i])) i++;
+    if(i >= instr.size()) return false;
+    uint8_t op = instr[i];
+    if(op == 0xEA || op == 0xE9 || op == 0xEB || op == 0xF4) return true; //JMP ptr16:32, JMP rel, HLT
+    if(op == 0xCC || op == 0xCD || op == 0xCF) return true; //INT3, INT n, IRET
+    if(op == 0xE8 || op == 0xC2 || op == 0xC3) return true; //CALL rel, RET
+    if(op == 0xFF && i + 1 < instr.size() && ((instr[i + 1] >> 3) & 7) == 2) return true; //CALL r/m
+    return is_cond_branch(instr);
+}
+
+//one run.dump and one mem.dump record per cycle, compressed dumps take each record whole
+void write_dumps(machine_t* m){
+    if(!m->run_trace){
+        dump_state(m, m->run_dump);
+        mem_dump(m, m->mem_dump);
+        return;
+    }
+    m->record_buf.clear();
+    dump_state(m, m->record);
+    trace_put(m->run_trace, m->record_buf.data(), m->record_buf.size());
+    m->record_buf.clear();
+    mem_dump(m, m->record);
+    trace_put(m->mem_trace, m->record_buf.data(), m->record_buf.size());
+}
+
+bool islx86_step(machine_t* m){
+    if(!m->run) return false;
+    if(m->irq.idle) idle_until(m, UINT64_MAX);
+    else if(m->cycles >= m->next_event_cycle) service_events(m);
+    if(!m->run) return false;
+    uint32_t pc = fetch_address(m->curr_state);
+    fetch_and_execute(m);
+    m->cycles++;
+    m->last_instr.swap(m->curr_state.INSTR);
+    m->curr_state = m->next_state;
+    if(--m->sample_countdown == 0) take_sample(m);
+    if(m->coverage) coverage_step(m, pc);
+    if(m->dumps_enabled) write_dumps(m);
+    if(m->cycles >= m->live_next_cycle) publish_live(m);
+    if(m->cycles >= m->fingerprint_next_cycle) write_fingerprint(m);
+    return m->run;
+}
+
+//runs until EIP reaches stop_eip (before executing it), the machine halts or max_cycles total cycles ran
+int islx86_run_until(machine_t* m, uint64_t stop_eip, uint64_t max_cycles){
+    m->fuse_branches = !m->dumps_enabled && !m->coverage && !m->sampler && !m->access_trace && !m->fingerprint;
+    m->fuse_stop_eip = stop_eip;
+    m->fuse_max_cycles = max_cycles;
+    bool spin_watch = !m->dumps_enabled && !m->sampler && !m->access_trace && !m->fingerprint && !m->call_graph; //skipped iterations would be missing from those
+    spin_reset(m);
+    int reason = HALT_NONE;
+    while(m->run){
+        if((uint32_t)m->curr_state.EIP == stop_eip){ reason = HALT_BREAKPOINT; break; }
+        if(m->cycles >= max_cycles){ reason = HALT_CYCLE_LIMIT; break; }
+        if(m->irq.idle){ idle_until(m, max_cycles); continue; }
+        uint32_t pc = fetch_address(m->curr_state);
+        if(m->aot && m->fuse_branches && run_translated(m, stop_eip, max_cycles)){
+            if(m->cycles >= m->live_next_cycle) publish_live(m);
+        }
+        else islx86_step(m);
+        bool backward = fetch_address(m->curr_state) <= pc; //only backward jumps can close a loop iteration
+        if(spin_watch && backward && m->run && spin_check(m, max_cycles)){ reason = HALT_SPIN; break; }
+    }
+    m->fuse_branches = false;
+    if(!m->devices.empty()) islx86_flush_devices(m);
+    return m->run ? reason : m->halt_reason;
+}
+
+//HALT_* reason as sweep tables print it, "?" for a number that is none
+const char* islx86_halt_name(int reason){
+    static const char* const names[] = {"NONE", "HLT", "UNIMPLEMENTED", "LIMIT", "BREAKPOINT", "SPIN", "FAULT"};
+    static_assert(sizeof(names) / sizeof(names[0]) == HALT_REASON_COUNT, "every HALT_* reason needs a name");
+    return reason >= 0 && reason < HALT_REASON_COUNT ? names[reason] : "?";
+}
+
+uint64_t islx86_read_reg(const machine_t* m, int kind, int idx){
+    const state_t& s = m->curr_state;
+    switch(kind){
+        case REG_EIP:  return (uint32_t)s.EIP;
+        case REG_GPR:  return (uint32_t)s.GPR[idx];
+        case REG_SEGR: return (uint16_t)s.SEGR[idx];
+        case REG_MMX:  return (uint64_t)s.MMX[idx];
+        case REG_FLAG: return s.FLAGS[idx] ? 1 : 0;
+    }
+    throw runtime_error("Unknown register kind");
+}
+
+//between steps curr_state and next_state are identical, so writes go to both
+void islx86_write_reg(machine_t* m, int kind, int idx, uint64_t value){
+    for(state_t* s : {&m->curr_state, &m->next_state}){
+        switch(kind){
+            case REG_EIP:  s->EIP = (int32_t)value; break;
+            case REG_GPR:  s->GPR[idx] = (int32_t)value; break;
+            case REG_SEGR: s->SEGR[idx] = (int16_t)value; break;
+            case REG_MMX:  s->MMX[idx] = (int64_t)value; break;
+            case REG_FLAG: s->FLAGS[idx] = value != 0; break;
+            default: throw runtime_error("Unknown register kind");
+        }
+    }
+}
+
+//view from addr to the end of its page; data is null if the page was never touched.
+//Bytes written through it count once islx86_page_written is called for them
+mem_span_t islx86_page_view(machine_t* m, uint32_t addr){
+    mem_span_t view = {addr, nullptr, 0};
+    page_t* page = mem_page_slow(m, addr >> PAGE_BITS, false);
+    if(page && page->shared) page = unshare_page(m, page); //the view may be written through
+    if(page && !page->mmio){
+        view.data = page->bytes + (addr & PAGE_MASK);
+        view.size = PAGE_SIZE - (addr & PAGE_MASK);
+    }
+    return view;
+}
+
+//after writing [addr, addr + len) through islx86_page_view: the bytes become present and their pages
+//dirty (so checkpoints and resets see them), translated code on them is re-checked, spin detection
+//notices the change and the fingerprint is rebuilt, as if the guest had stored them
+void islx86_page_written(machine_t* m, uint32_t addr, uint32_t len){
+    while(len){
+        uint32_t off = addr & PAGE_MASK;
+        uint32_t n = min(len, PAGE_SIZE - off);
+        page_t* page = mem_page_slow(m, addr >> PAGE_BITS, false);
+        if(!page || page->mmio || page->shared) throw runtime_error("islx86_page_written: no view was handed out for that page");
+        for(uint32_t o = off; o < off + n; o++) page->present[o >> 6] |= (uint64_t)1 << (o & 63);
+        mark_dirty(m, page);
+        revalidate_code_page(m, page);
+        addr += n;
+        len -= n;
+    }
+    m->mem_version++;
+    if(m->fingerprint) fingerprint_rehash(m);
+}
+
+vector<mem_span_t> islx86_mapped_pages(machine_t* m){
+    vector<mem_span_t> pages;
+    for(uint32_t d = 0; d < PT_ENTRIES; d++){
+        if(!m->page_dir[d]) continue;
+        for(uint32_t t = 0; t < PT_ENTRIES; t++){
+            page_t* page = m->page_dir[d][t];
+            if(page && !page->mmio) pages.push_back({((d << PT_BITS) | t) << PAGE_BITS, page->bytes, PAGE_SIZE});
+        }
+    }
+    return pages;
+}
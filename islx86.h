@@ -0,0 +1,864 @@
+#ifndef ISLX86_H
+#define ISLX86_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+enum GPR_NAMES {
+    EAX,
+    ECX,
+    EDX,
+    EBX,
+    ESP,
+    EBP,
+    ESI,
+    EDI
+};
+
+enum SEGR_NAMES {
+    ES,
+    CS,
+    SS,
+    DS,
+    FS,
+    GS
+};
+
+enum FLAG_NAMES {
+    CF,
+    PF,
+    AF,
+    ZF,
+    SF,
+    DF,
+    OF
+};
+
+//register classes for islx86_read_reg / islx86_write_reg
+enum REG_KINDS {
+    REG_EIP,
+    REG_GPR,
+    REG_SEGR,
+    REG_MMX,
+    REG_FLAG
+};
+
+//why the machine stopped (machine_t::halt_reason)
+enum HALT_REASONS {
+    HALT_NONE,
+    HALT_HLT,
+    HALT_UNIMPLEMENTED,
+    HALT_CYCLE_LIMIT,
+    HALT_BREAKPOINT,
+    HALT_SPIN, //islx86_run_until without a cycle limit found the guest in a loop it can never leave
+    HALT_FAULT, //an interrupt had no handler in the IDT (irq.cpp)
+    HALT_REASON_COUNT //not a reason: new ones go above, with a name in islx86_halt_name
+};
+
+typedef struct{
+    int32_t EIP;
+    int32_t GPR[8]; //EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI
+    int64_t MMX[8]; //MMX0 - MMX7
+    int16_t SEGR[6]; //ES, CS, SS, DS, FS, GS
+    bool FLAGS[7]; //CF, PF, AF, ZF, SF, DF, OF
+    bool IF; //interrupt enable (irq.cpp), kept out of FLAGS so the dump layouts stay as they are
+    std::vector<uint8_t> INSTR;
+}state_t;
+
+typedef struct{
+    uint8_t mod, reg, r_m;
+}modrm_t;
+
+//a decoded ModRM operand (decode_rm, alu.cpp)
+typedef struct{
+    bool is_reg;
+    int reg; //GPR, or for byte operands AL CL DL BL AH CH DH BH
+    uint32_t addr; //linear address of a memory operand
+    int size; //bytes
+}operand_t;
+
+//a decoded ModRM memory operand (decode_ea, address.cpp): the kernel of its addressing form adds the
+//registers the form names to disp and returns the offset
+typedef uint32_t (*ea_kernel_t)(const state_t& s, int32_t disp);
+typedef struct{
+    ea_kernel_t kernel;
+    int32_t disp;
+}ea_t;
+
+// Guest memory is a two level page table of 4 KiB pages (10 bit directory, 10 bit table, 12 bit offset).
+// Pages are allocated on first touch; the present bits remember which bytes the guest or loader
+// touched so mem.dump only lists those, exactly like the old map<uint32_t, uint8_t> did.
+// A page is dirty once its bytes or present bits change; dirty pages are listed in machine_t::dirty_pages
+// until someone (checkpoints) collects them.
+const uint32_t PAGE_BITS = 12;
+const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+const uint32_t PT_BITS = 10;
+const uint32_t PT_ENTRIES = 1u << PT_BITS;
+
+typedef struct{
+    uint8_t bytes[PAGE_SIZE];
+    uint64_t present[PAGE_SIZE / 64];
+    uint32_t page_num;
+    bool dirty;
+    bool code; //holds translated code or code a lockstep engine decoded, writes check it (translate.cpp)
+    bool shared; //belongs to a program_t mapped by many machines, copied before any change (program.cpp)
+    bool mmio; //claimed by a device: no byte is ever present, accesses go to the device (devices.cpp)
+}page_t;
+
+// A program parsed once into immutable pages (program.cpp). Machines map its pages copy-on-write:
+// the page table points straight at them until the machine first changes a page (bytes or present
+// bits), which then gets a private copy. Freed when the last machine and the loader let go of it.
+typedef struct{
+    std::atomic<int> refs;
+    std::vector<page_t*> pages;
+}program_t;
+
+//span-style view straight into page storage, no copy
+typedef struct{
+    uint32_t base; //guest address of data[0]
+    uint8_t* data;
+    size_t size;
+}mem_span_t;
+
+// A program image opened for demand paged loading. The file is mmapped and indexed once: mem.txt
+// gets a page -> line offsets table, a converted binary sidecar a page -> record offset table.
+// A page is only parsed/copied into a machine the first time the guest touches it.
+enum IMAGE_KINDS {
+    IMAGE_TEXT,
+    IMAGE_BINARY
+};
+
+typedef struct{
+    int kind;
+    int fd;
+    const char* base; //mmap of the whole file
+    size_t size;
+    std::unordered_map<uint32_t, std::vector<uint64_t>> text_lines;
+    std::unordered_map<uint32_t, uint64_t> bin_pages;
+}image_t;
+
+// Periodic sampling: every `interval` instructions (or a seeded random gap with that mean) one
+// compact line with the registers and any watched memory goes to the sample file. The EIP and
+// opcode of each sample build the hot EIP table and the instruction mix written on stop.
+typedef struct{
+    uint64_t interval;
+    bool random;
+    std::mt19937_64 rng;
+    std::vector<std::pair<uint32_t, uint32_t>> watch; //addr, len
+    std::ofstream out;
+    std::map<uint32_t, uint64_t> eip_hits;
+    std::map<uint32_t, uint64_t> opcode_mix; //primary opcode, 0x0Fxx for two byte opcodes
+    uint64_t samples;
+}sampler_t;
+
+// Streaming writer/reader for compressed dump files (format in compress.cpp): records are XOR
+// delta coded against the previous record, then packed in blocks with the in-tree LZ codec.
+typedef struct{
+    std::ofstream out;
+    std::vector<uint8_t> block; //delta coded records waiting to be compressed
+    std::vector<uint8_t> packed;
+    std::string prev;
+    uint64_t raw_bytes, out_bytes;
+}trace_writer_t;
+
+typedef struct{
+    std::ifstream in;
+    std::vector<uint8_t> block, packed;
+    size_t pos;
+    std::string prev;
+}trace_reader_t;
+
+//growable in-memory streambuf, lets a dump record be formatted and handed to a writer without copies
+class record_buf_t : public std::streambuf{
+public:
+    record_buf_t(){ buf.resize(4096); clear(); }
+    const char* data() const { return pbase(); }
+    size_t size() const { return (size_t)(pptr() - pbase()); }
+    void clear(){ setp(buf.data(), buf.data() + buf.size()); }
+protected:
+    int_type overflow(int_type c) override {
+        size_t used = size();
+        buf.resize(buf.size() * 2);
+        setp(buf.data(), buf.data() + buf.size());
+        pbump((int)used);
+        if(c != traits_type::eof()){
+            *pptr() = (char)c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+private:
+    std::vector<char> buf;
+};
+
+//mem.dump layouts: one "0xADDRESS: 0xBB" line per present byte, or 16 byte hexdump rows (hexdump.cpp)
+enum MEM_DUMP_FORMATS {
+    MEM_DUMP_BYTES,
+    MEM_DUMP_HEX
+};
+
+// Interrupts and the interval timer (irq.cpp). Device events wait in a delta queue ordered by the
+// cycle they fire at: the first holds its absolute cycle, each later one the cycles after the one
+// in front of it, so the hot loop only compares cycles with machine_t::next_event_cycle.
+enum EVENT_SOURCES {
+    EVENT_TIMER
+};
+
+typedef struct{
+    int source;
+    uint64_t delta;
+}event_t;
+
+typedef struct{
+    uint32_t period; //cycles between expiries, 0 while stopped
+    uint8_t vector;
+    bool one_shot;
+    uint64_t expiry; //cycle of the next expiry
+}irq_timer_t;
+
+typedef struct{
+    uint32_t idt_base; //linear
+    uint16_t idt_limit;
+    uint64_t pending[4]; //raised vectors waiting for IF
+    uint64_t shadow_end; //no delivery before this cycle (the instruction after STI)
+    bool idle; //in HLT, waiting for an interrupt
+    int fault_vector; //the vector without a handler behind HALT_FAULT
+    irq_timer_t timer;
+    std::vector<event_t> events; //events[0] fires first
+}irq_t;
+
+//registers plus the pages dirtied since the previous checkpoint (checkpoints form a chain from cycle 0)
+typedef struct{
+    uint64_t cycles;
+    state_t state;
+    irq_t irq;
+    std::vector<page_t*> pages;
+}checkpoint_t;
+
+//a representative interval chosen by islx86_simpoints
+typedef struct{
+    size_t interval;
+    uint64_t start_cycle;
+    double weight; //share of all executed instructions this point stands for
+    int cluster;
+}simpoint_t;
+
+// Guest code coverage, kept per 4 KiB page of linear (CS:EIP) addresses: which instruction
+// starts ran, which conditional branches went each way, and which basic blocks already ran to
+// their end (those are not re-marked instruction by instruction).
+typedef struct{
+    uint64_t exec[PAGE_SIZE / 64];
+    uint64_t taken[PAGE_SIZE / 64];
+    uint64_t not_taken[PAGE_SIZE / 64];
+    uint64_t block_done[PAGE_SIZE / 64];
+}cov_page_t;
+
+typedef struct{
+    std::map<uint32_t, cov_page_t*> pages;
+    cov_page_t* last_page;
+    uint32_t last_page_num;
+    uint32_t block_start;
+    bool at_block_start;
+    bool skip_block; //current block already covered end to end
+    uint64_t new_bits; //exec/edge bits that went from 0 to 1, the fuzzer's feedback
+    std::string path, source_path;
+}coverage_t;
+
+// Call graph profile (callgraph.cpp): CALL pushes a frame on a shadow stack of return addresses,
+// RET pops back to the frame it returns to. Keyed by linear address; edges by (caller << 32) | callee.
+typedef struct{
+    uint32_t ret, callee; //linear addresses
+    uint64_t start, child_cycles; //cycles at the CALL, cycles spent in calls made from this frame
+}call_frame_t;
+
+typedef struct{
+    uint64_t calls, self_cycles, total_cycles;
+}call_stats_t;
+
+typedef struct{
+    std::vector<call_frame_t> shadow;
+    std::unordered_map<uint32_t, call_stats_t> functions;
+    std::unordered_map<uint64_t, call_stats_t> edges;
+    uint32_t root; //caller of the outermost calls
+    uint64_t calls, unmatched; //unmatched: returns to no open frame
+    std::string path;
+}call_graph_t;
+
+// Fuzzing snapshot: registers plus a copy of every page allocated when it was taken. Taking one
+// starts a new dirty page epoch (so it does not mix with incremental checkpoints); a reset copies
+// back only the pages dirtied since.
+typedef struct{
+    uint64_t cycles;
+    state_t state;
+    irq_t irq;
+    std::unordered_map<uint32_t, page_t*> pages;
+}snapshot_t;
+
+typedef struct{
+    uint64_t execs, crashes, hangs, corpus;
+    double seconds;
+}fuzz_stats_t;
+
+typedef struct{
+    uint64_t snapshot_eip; //run here once and snapshot, NO_STOP_EIP snapshots straight after loading
+    uint32_t input_addr, input_len; //linear address and size of the guest input buffer
+    uint64_t max_cycles; //per execution, longer runs count as hangs
+    uint64_t iterations;
+    uint64_t seed;
+    std::string out_dir, source_path;
+    void (*on_progress)(const fuzz_stats_t& stats); //every 65536 executions, may be null
+}fuzz_config_t;
+
+// Instructions as decode_insn (translate.cpp) sees them, shared by the translator and the lockstep engine.
+enum INSN_KINDS {
+    INSN_ADD, //the original ADD forms: 00-05, 80/81/83 /0 /2 /3
+    INSN_ALU, //the alu.cpp set
+    INSN_XCHG,
+    INSN_JCC, //70-7F, 0F 80-8F
+    INSN_JMP, //EB, E9
+    INSN_LOOP, //E0-E3
+    INSN_JMPFAR, //EA
+    INSN_INTERP //left to the interpreter, ends the block in front of it
+};
+
+typedef struct{
+    int kind;
+    uint32_t eip;
+    int len;
+    bool o16;
+    bool a16; //0x67: 16 bit ModRM addressing
+    uint8_t op; //primary opcode, the second byte for 0F xx
+    modrm_t modrm, sib;
+    int32_t disp;
+    uint32_t imm; //extended the way the instruction's interpreter path does it
+    uint32_t target; //taken branch target, CALL rel target, JMP ptr16:32 offset
+    uint16_t sel; //JMP ptr16:32 selector
+    bool falls_through; //false for JMP, IRET, RET, unknown opcodes and MOV CS
+}insn_t;
+
+// Ahead of time translation (translate.cpp). The generated shared object only sees the machine
+// through aot_ctx_t and exports a table of aot_block_t, one per translated basic block.
+typedef struct{
+    int32_t* GPR;
+    bool* FLAGS;
+    int16_t* SEGR;
+    int32_t* EIP;
+    void* m;
+    uint8_t (*read8)(void* m, uint32_t addr);
+    void (*write8)(void* m, uint32_t addr, uint8_t value);
+    bool code_written; //a store changed translated code, the block returns after that instruction
+}aot_ctx_t;
+
+typedef struct{
+    uint32_t cs, eip; //where the block starts
+    uint32_t instrs, size; //instructions and code bytes
+    const uint8_t* code; //the bytes it was translated from
+    uint32_t (*fn)(aot_ctx_t* c); //runs the block on the context, returns the instructions retired
+}aot_block_t;
+
+typedef struct{
+    void* handle; //dlopen handle of the shared object
+    aot_ctx_t ctx;
+    std::unordered_map<uint64_t, const aot_block_t*> blocks; //(CS << 32) | EIP -> block, only blocks matching memory
+    std::unordered_map<uint32_t, std::vector<const aot_block_t*>> page_blocks; //every block touching a page
+    uint64_t translated_instrs; //instructions retired by translated blocks
+    uint64_t lookups, hits; //run_translated calls, and those that ran a block
+}aot_t;
+
+//spin-loop detection (spin.cpp): a loop head recorded to compare against one iteration later
+typedef struct{
+    bool armed;
+    uint32_t countdown; //backward jumps until the next head is recorded
+    uint32_t head; //linear address
+    uint64_t cycles, mem_version, next_event;
+    state_t state;
+}spin_t;
+
+// Live counters (live.cpp) published in a POSIX shared memory segment for islx86-top. The
+// simulation thread is the only writer and never waits: it makes seq odd, stores the counters and
+// makes seq even again. Readers copy the counters and retry until seq was the same even value
+// before and after the copy (a seqlock), so watching a run never slows it down.
+const uint32_t LIVE_MAGIC = 0x4C585349; //"ISXL"
+const uint32_t LIVE_VERSION = 1;
+
+typedef struct{
+    uint32_t magic, version;
+    int64_t pid;
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> instrs; //instructions retired
+    std::atomic<uint64_t> eip; //linear address of the next instruction
+    std::atomic<uint64_t> kips; //thousands of instructions per second over the last second
+    std::atomic<uint64_t> lookups, hits; //translated block lookups and hits (0 without --aot)
+    std::atomic<uint64_t> pages; //guest pages allocated
+    std::atomic<uint64_t> dump_bytes; //run/mem dump bytes written so far
+    std::atomic<uint64_t> running; //0 once the machine halted
+    std::atomic<uint64_t> updated_ms; //wall clock of the last update, ms since the epoch
+}live_segment_t;
+
+//a consistent copy of the counters, what islx86_read_live hands out
+typedef struct{
+    int64_t pid;
+    uint64_t instrs, eip, kips, lookups, hits, pages, dump_bytes, running, updated_ms;
+}live_stats_t;
+
+typedef struct{
+    std::string name;
+    live_segment_t* seg;
+    uint64_t interval; //instructions between updates, tuned to about ten a second
+    std::chrono::steady_clock::time_point window_start, last_update;
+    uint64_t window_cycles;
+}live_t;
+
+// Guest memory access trace (memtrace.cpp): every instruction fetch, data read and data write as
+// (type, linear address, size, EIP). Byte accesses of one instruction that follow each other are
+// merged into one record, REP string page runs are one record each. Records are varint/delta
+// coded into a buffer the simulation thread fills while a writer thread saves the other one.
+enum ACCESS_TYPES {
+    ACCESS_FETCH,
+    ACCESS_READ,
+    ACCESS_WRITE
+};
+
+typedef struct{
+    int type;
+    uint32_t addr, size, eip;
+}access_t;
+
+typedef struct{
+    std::ofstream out;
+    std::vector<uint8_t> fill, flush; //filled by the simulation, saved by the writer thread
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool flush_ready, done;
+    bool pending; //rec is still growing
+    access_t rec;
+    uint64_t rec_cycle;
+    uint32_t prev_end[3], prev_eip; //delta bases
+    uint64_t records;
+}access_trace_t;
+
+typedef struct{
+    std::ifstream in;
+    std::vector<uint8_t> buf;
+    size_t pos, len;
+    uint32_t prev_end[3], prev_eip;
+}access_reader_t;
+
+// Rolling fingerprint of the architectural state (fingerprint.cpp). The memory part is a sum over
+// present bytes of a hash of (address, value), so a write only subtracts the old byte's term and adds
+// the new one; registers are hashed when a fingerprint is written, every `interval` instructions.
+typedef struct{
+    std::ofstream out;
+    uint64_t interval;
+    uint64_t mem_hash;
+    uint64_t lines, last_cycle;
+}fingerprint_t;
+
+//where two fingerprint files part (islx86_compare_fingerprints)
+typedef struct{
+    bool diverged;
+    bool agreed; //some line both files hold matched; if not, the runs part at or before the first one
+    uint64_t good_cycle, good_eip; //last line both files agree on
+    uint64_t bad_cycle; //first line they differ on
+    uint64_t interval; //of the first file
+}fingerprint_diff_t;
+
+// Parameter sweeps (sweep.cpp): one program run once per patch set, each patch set changing the
+// state islx86_map_program starts from. Patch tables are text, one set per line:
+//   <name> [REG=value]... [0xADDR=hexbytes]... [cycles=N]
+typedef struct{
+    int kind, idx; //as for islx86_write_reg
+    uint64_t value;
+}reg_patch_t;
+
+typedef struct{
+    std::string name;
+    std::vector<reg_patch_t> regs;
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> mem; //addr, bytes stored there
+    uint64_t max_cycles; //0: the sweep's limit
+}patch_set_t;
+
+typedef struct{
+    int halt_reason; //what islx86_run_until returned
+    uint64_t cycles;
+    state_t state;
+    std::vector<uint8_t> watched; //the watched ranges back to back
+}sweep_result_t;
+
+struct machine_t;
+
+// Lockstep execution (lockstep.cpp): lanes of machines mapping one program, their registers and
+// flags held structure-of-arrays so one AVX2 instruction updates 8 lanes. Lanes at the same CS:EIP
+// run the register forms of ADD / ALU / XCHG and the branches together; a branch they disagree on
+// splits them into groups, other instructions and lanes left on their own run in the interpreter.
+const int LOCKSTEP_CHUNK = 8; //lanes per 256 bit register
+
+typedef struct{
+    insn_t in;
+    uint16_t cs;
+    int op; //LANE_OPS (lockstep.cpp)
+    int a, b; //operand GPRs (byte registers for XCHG), -1 for the immediate; ADD keeps update_flags_add's order
+    int dst; //GPR written, -1 for none
+    int next, taken; //successor indexes in lockstep_t::insns, -1 until first needed
+}lane_insn_t;
+
+typedef struct{
+    program_t* program;
+    machine_t* decoder; //maps the program, instructions are decoded from it
+    int lanes, width; //width: lanes rounded up to LOCKSTEP_CHUNK
+    std::vector<machine_t*> machines; //per lane: its memory, and its state while it runs in the interpreter
+    std::vector<int32_t> gpr, flags; //[reg * width + lane], flags 0 or 1
+    std::vector<int32_t> eip, group; //group: -1 for the lanes running the current instruction
+    std::vector<uint16_t> cs;
+    std::vector<uint64_t> cycles, limit;
+    std::vector<uint8_t> running;
+    std::vector<int> halt_reason;
+    std::vector<uint32_t> solo; //turns in a row a lane was the only one at its CS:EIP
+    std::vector<lane_insn_t> insns;
+    std::unordered_map<uint64_t, int> insn_index; //(CS << 32) | EIP -> insns
+    std::unordered_map<uint32_t, std::vector<uint64_t>> code_bits; //page -> bytes decoded as code
+    uint64_t vector_instrs, scalar_instrs; //instructions retired by lanes together / one lane at a time
+}lockstep_t;
+
+typedef struct{
+    void (*on_halt)(machine_t* m, void* user);
+    void (*on_unimplemented)(machine_t* m, uint8_t opcode, void* user);
+    void* user;
+}callbacks_t;
+
+// Memory mapped devices (devices.cpp). A device claims [base, base + size) and every page it touches
+// becomes an MMIO page: page_t::mmio set and no byte ever present. Reads then leave the RAM path only
+// through the branch mem_touch already takes for a byte not yet present, writes through one flag test
+// next to the shared page one. Devices see single bytes, lowest address first; parts of an MMIO page
+// no device claims read all ones and ignore writes.
+typedef struct{
+    uint32_t base, size;
+    uint8_t (*read)(machine_t* m, uint32_t offset, void* user); //null: reads all ones
+    void (*write)(machine_t* m, uint32_t offset, uint8_t value, void* user); //null: writes are ignored
+    void (*flush)(machine_t* m, void* user); //hands buffered output to the host, may be null
+    void (*destroy)(void* user); //when the machine goes, may be null
+    void* user;
+}device_t;
+
+struct machine_t{
+    state_t curr_state, next_state;
+    page_t** page_dir[PT_ENTRIES];
+    page_t* last_page; //one entry lookup cache in front of page_dir
+    uint32_t last_page_num;
+    uint64_t cycles;
+    std::vector<uint8_t> last_instr; //bytes of the instruction the last step executed
+    bool run;
+    int halt_reason;
+    callbacks_t callbacks;
+    const image_t* image; //demand paged source of pages not yet touched, may be null
+    bool dumps_enabled;
+    int mem_dump_format;
+    std::ofstream run_dump, mem_dump;
+    trace_writer_t* run_trace; //set when the dumps are compressed
+    trace_writer_t* mem_trace;
+    record_buf_t record_buf;
+    std::ostream record{&record_buf};
+    std::vector<page_t*> dirty_pages;
+    uint64_t sample_countdown; //instructions until the next sample, never reaches 0 while sampling is off
+    sampler_t* sampler;
+    coverage_t* coverage;
+    //set by islx86_run_until while nothing looks at single steps: a CMP / TEST may retire the Jcc after it in the same step
+    bool fuse_branches;
+    uint64_t fuse_stop_eip, fuse_max_cycles;
+    aot_t* aot; //loaded translation, may be null
+    uint64_t mem_version; //counts changes to guest memory bytes or present bits
+    spin_t spin;
+    uint64_t pages_allocated;
+    live_t* live; //shared memory counters, may be null
+    uint64_t live_next_cycle; //cycles at the next counter update, UINT64_MAX while not publishing
+    access_trace_t* access_trace; //memory access trace being written, may be null
+    program_t* program; //mapped copy-on-write, may be null
+    fingerprint_t* fingerprint; //state fingerprints being written, may be null
+    uint64_t fingerprint_next_cycle; //UINT64_MAX while not fingerprinting
+    lockstep_t* lockstep; //engine this machine is a lane of, may be null
+    bool lane_code_changed; //a lane's store changed code the engine decoded, it runs in the interpreter from then on
+    irq_t irq;
+    uint64_t next_event_cycle; //first cycle service_events has work (an event due, an interrupt deliverable), UINT64_MAX for none
+    std::vector<device_t> devices; //kept across loads, their pages are mapped again after each
+    page_t* stack_page; //the page the last SS:ESP access went to, the stack's own lookup cache (stack.cpp)
+    call_graph_t* call_graph; //call graph profile being recorded, may be null
+    bool addr16; //the instruction being executed has 0x67: its ModRM operands use 16 bit addressing
+};
+
+//library API
+machine_t* islx86_create();
+void islx86_destroy(machine_t* m);
+void islx86_load(machine_t* m, const std::string& file_name);
+void islx86_load_image(machine_t* m, const image_t* image);
+void islx86_load_bytes(machine_t* m, uint32_t addr, const uint8_t* data, size_t len);
+program_t* islx86_load_program(const std::string& file_name);
+void islx86_map_program(machine_t* m, program_t* program);
+void islx86_release_program(program_t* program);
+void islx86_set_callbacks(machine_t* m, const callbacks_t& callbacks);
+void islx86_set_dumps(machine_t* m, const std::string& run_path, const std::string& mem_path, bool compress = false);
+void islx86_set_mem_dump_format(machine_t* m, int format);
+void islx86_mem_dump_to_legacy(const std::string& in_path, const std::string& out_path);
+bool islx86_step(machine_t* m);
+const uint64_t NO_STOP_EIP = UINT64_MAX; //islx86_run_until without a breakpoint
+int islx86_run_until(machine_t* m, uint64_t stop_eip, uint64_t max_cycles);
+const char* islx86_halt_name(int reason);
+uint64_t islx86_read_reg(const machine_t* m, int kind, int idx);
+void islx86_write_reg(machine_t* m, int kind, int idx, uint64_t value);
+mem_span_t islx86_page_view(machine_t* m, uint32_t addr);
+void islx86_page_written(machine_t* m, uint32_t addr, uint32_t len);
+std::vector<mem_span_t> islx86_mapped_pages(machine_t* m);
+void islx86_start_sampling(machine_t* m, const std::string& path, uint64_t interval, bool random, uint64_t seed);
+void islx86_sample_watch(machine_t* m, uint32_t addr, uint32_t len);
+void islx86_stop_sampling(machine_t* m);
+trace_reader_t* islx86_open_trace(const std::string& path);
+bool islx86_next_record(trace_reader_t* r, std::string& record);
+void islx86_close_trace(trace_reader_t* r);
+void islx86_decompress_trace(const std::string& in_path, const std::string& out_path);
+checkpoint_t* islx86_checkpoint(machine_t* m);
+void islx86_apply_checkpoint(machine_t* m, const checkpoint_t* cp);
+void islx86_free_checkpoint(checkpoint_t* cp);
+checkpoint_t* islx86_full_checkpoint(machine_t* m);
+void islx86_save_checkpoint(const checkpoint_t* cp, const std::string& path);
+checkpoint_t* islx86_load_checkpoint(const std::string& path);
+int islx86_parallel_dumps(machine_t* m, uint64_t interval, int threads, const std::string& run_path, const std::string& mem_path, bool compress = false);
+std::vector<simpoint_t> islx86_simpoints(machine_t* m, uint64_t interval, int max_k, uint64_t seed, const std::string& prefix);
+void islx86_start_coverage(machine_t* m, const std::string& path, const std::string& source_path);
+void islx86_stop_coverage(machine_t* m);
+snapshot_t* islx86_snapshot(machine_t* m);
+void islx86_reset(machine_t* m, const snapshot_t* snap);
+void islx86_free_snapshot(snapshot_t* snap);
+fuzz_stats_t islx86_fuzz(machine_t* m, const fuzz_config_t& cfg);
+image_t* islx86_open_image(const std::string& path);
+void islx86_close_image(image_t* image);
+void islx86_convert_image(const std::string& text_path, const std::string& bin_path);
+size_t islx86_translate(machine_t* m, const std::string& so_path);
+void islx86_load_translation(machine_t* m, const std::string& so_path);
+void islx86_unload_translation(machine_t* m);
+void islx86_start_live(machine_t* m, const std::string& name);
+void islx86_stop_live(machine_t* m);
+live_segment_t* islx86_open_live(const std::string& name);
+bool islx86_read_live(const live_segment_t* seg, live_stats_t& stats);
+void islx86_close_live(live_segment_t* seg);
+void islx86_start_access_trace(machine_t* m, const std::string& path);
+uint64_t islx86_stop_access_trace(machine_t* m);
+access_reader_t* islx86_open_access_trace(const std::string& path);
+bool islx86_next_access(access_reader_t* r, access_t& a);
+void islx86_close_access_trace(access_reader_t* r);
+void islx86_start_fingerprints(machine_t* m, const std::string& path, uint64_t interval);
+uint64_t islx86_stop_fingerprints(machine_t* m);
+uint64_t islx86_fingerprint(machine_t* m);
+fingerprint_diff_t islx86_compare_fingerprints(const std::string& path_a, const std::string& path_b);
+fingerprint_diff_t islx86_narrow_divergence(machine_t* (*create)(int side, void* user), void* user,
+                                            uint64_t good_cycle, uint64_t bad_cycle);
+std::vector<patch_set_t> islx86_load_patch_sets(const std::string& path);
+void islx86_apply_patch_set(machine_t* m, const patch_set_t& patch);
+std::vector<sweep_result_t> islx86_sweep(program_t* program, const std::vector<patch_set_t>& patches,
+                                         const std::vector<std::pair<uint32_t, uint32_t>>& watch, uint64_t max_cycles, int threads,
+                                         int lanes = 1);
+void islx86_write_sweep(const std::string& path, const std::vector<patch_set_t>& patches,
+                        const std::vector<std::pair<uint32_t, uint32_t>>& watch, const std::vector<sweep_result_t>& results);
+bool islx86_lockstep_supported();
+lockstep_t* islx86_create_lockstep(program_t* program, int lanes);
+const std::vector<int>& islx86_run_lockstep(lockstep_t* ls, const std::vector<uint64_t>& max_cycles);
+void islx86_destroy_lockstep(lockstep_t* ls);
+void islx86_raise_irq(machine_t* m, int vector);
+void islx86_map_device(machine_t* m, const device_t& device);
+void islx86_add_uart(machine_t* m, uint32_t base, const std::string& path);
+void islx86_add_cycle_counter(machine_t* m, uint32_t base);
+void islx86_add_block_device(machine_t* m, uint32_t base, const std::string& path);
+void islx86_flush_devices(machine_t* m);
+void islx86_start_call_graph(machine_t* m, const std::string& path);
+uint64_t islx86_stop_call_graph(machine_t* m);
+
+//machine internals shared by the library sources
+void init_state(machine_t* m);
+bool parse_mem_line(const std::string& line, uint32_t& base_addr, std::vector<uint8_t>& bytes);
+void init_mem(machine_t* m, std::string file_name);
+void fetch_and_execute(machine_t* m);
+void dump_state(machine_t* m, std::ostream& out);
+void mem_dump(machine_t* m, std::ostream& out);
+void mem_dump_hex(machine_t* m, std::ostream& out);
+void cycle(machine_t* m);
+void free_pages(machine_t* m);
+page_t* mem_page_slow(machine_t* m, uint32_t page_num, bool create);
+page_t* unshare_page(machine_t* m, page_t* page);
+void take_sample(machine_t* m);
+void write_dumps(machine_t* m);
+bool is_cond_branch(const std::vector<uint8_t>& instr);
+bool is_block_end(const std::vector<uint8_t>& instr);
+void coverage_step(machine_t* m, uint32_t pc);
+void coverage_redirect(machine_t* m);
+modrm_t get_modrm_byte(uint8_t modrm_byte);
+bool parity(int num, int num_bits);
+int ea_disp_bytes(modrm_t modrm, modrm_t sib, bool a16);
+ea_kernel_t ea_kernel(modrm_t modrm, modrm_t sib, bool a16);
+ea_t decode_ea(machine_t* m, int& len, modrm_t modrm, bool a16);
+void update_flags_sub(state_t& next_state, uint32_t operand1, uint32_t operand2, int num_bits);
+bool is_alu_opcode(uint8_t opcode, uint8_t modrm);
+void execute_alu(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len);
+void execute_branch(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len);
+void execute_string_op(machine_t* m, uint8_t opcode, uint8_t rep, bool has_prefix_x66, int instr_len);
+trace_writer_t* trace_open_writer(const std::string& path);
+void trace_put(trace_writer_t* w, const char* data, size_t len);
+void trace_close_writer(trace_writer_t* w);
+void lz_compress(const uint8_t* src, size_t n, std::vector<uint8_t>& dst);
+void lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t raw_len);
+bool image_has_page(const image_t* image, uint32_t page_num);
+void image_fill_page(const image_t* image, uint32_t page_num, page_t* page);
+void code_written(machine_t* m, uint32_t addr, uint8_t value);
+void revalidate_code_page(machine_t* m, page_t* page);
+bool run_translated(machine_t* m, uint64_t stop_eip, uint64_t max_cycles);
+void spin_reset(machine_t* m);
+bool spin_check(machine_t* m, uint64_t max_cycles);
+void publish_live(machine_t* m);
+void trace_access(machine_t* m, int type, uint32_t addr, uint32_t size);
+void write_fingerprint(machine_t* m);
+void fingerprint_rehash(machine_t* m);
+void fingerprint_range(machine_t* m, const page_t* page, uint32_t off, uint32_t len, bool add);
+bool decode_insn(machine_t* m, uint32_t cs_base, uint32_t eip, insn_t& in);
+void lockstep_code_written(machine_t* m, uint32_t addr, uint8_t value);
+void lockstep_code_replaced(machine_t* m, const page_t* page);
+uint8_t fetch_byte(machine_t* m, int& len);
+int32_t fetch_simm(machine_t* m, int& len, int bytes);
+operand_t decode_rm(machine_t* m, int& len, int size, int& reg_field);
+irq_t initial_irq();
+void reset_irq(machine_t* m);
+void refresh_next_event(machine_t* m);
+void service_events(machine_t* m);
+void idle_until(machine_t* m, uint64_t limit);
+void execute_hlt(machine_t* m, int instr_len);
+bool is_system_op(uint8_t opcode, uint8_t modrm);
+void execute_system_op(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len);
+void map_device_pages(machine_t* m);
+void destroy_devices(machine_t* m);
+uint8_t mmio_read(machine_t* m, uint32_t addr);
+void mmio_write(machine_t* m, uint32_t addr, uint8_t value);
+uint32_t get_reg(const state_t& s, int reg, int size);
+void set_reg(state_t& s, int reg, int size, uint32_t value);
+uint32_t read_operand(machine_t* m, const operand_t& op);
+void write_operand(machine_t* m, const operand_t& op, uint32_t value);
+uint32_t stack_address(const state_t& s);
+void push_value(machine_t* m, state_t& s, uint32_t value, int size);
+uint32_t pop_value(machine_t* m, state_t& s, int size);
+bool is_stack_op(uint8_t opcode, uint8_t modrm);
+void execute_stack_op(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len);
+void call_graph_call(machine_t* m, uint32_t ret, uint32_t callee);
+void call_graph_return(machine_t* m, uint32_t target);
+
+//memory term of one present byte
+inline uint64_t fingerprint_term(uint32_t addr, uint8_t value){
+    uint64_t z = (((uint64_t)addr << 8) | value) + 0x9E3779B97F4A7C15ull; //splitmix64
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+//operand size (0x66), address size (0x67) and REP/REPE (0xF3) / REPNE (0xF2) prefixes
+inline bool is_prefix(uint8_t b){
+    return b == 0x66 || b == 0x67 || b == 0xF2 || b == 0xF3;
+}
+
+//Jcc condition codes 0-F (O NO B AE E NE BE A S NS P NP L GE LE G)
+inline bool cond_holds(const bool* FLAGS, int cc){
+    bool result = false;
+    switch(cc >> 1){
+        case 0: result = FLAGS[OF]; break;
+        case 1: result = FLAGS[CF]; break;
+        case 2: result = FLAGS[ZF]; break;
+        case 3: result = FLAGS[CF] || FLAGS[ZF]; break;
+        case 4: result = FLAGS[SF]; break;
+        case 5: result = FLAGS[PF]; break;
+        case 6: result = FLAGS[SF] != FLAGS[OF]; break;
+        case 7: result = FLAGS[ZF] || FLAGS[SF] != FLAGS[OF]; break;
+    }
+    return (cc & 1) ? !result : result;
+}
+
+//linear address of the next instruction fetch
+inline uint32_t fetch_address(const state_t& s){
+    return ((uint32_t)(uint16_t)s.SEGR[CS] << 16) + (uint32_t)s.EIP;
+}
+
+inline page_t* mem_page(machine_t* m, uint32_t addr){
+    uint32_t page_num = addr >> PAGE_BITS;
+    if(m->last_page && m->last_page_num == page_num) return m->last_page;
+    return mem_page_slow(m, page_num, true);
+}
+
+inline void mark_dirty(machine_t* m, page_t* page){
+    if(page->dirty) return;
+    page->dirty = true;
+    m->dirty_pages.push_back(page);
+}
+
+//reads a guest byte and marks it present (same semantics as map::operator[]), not traced
+inline uint8_t mem_touch(machine_t* m, uint32_t addr){
+    page_t* page = mem_page(m, addr);
+    uint32_t off = addr & PAGE_MASK;
+    uint64_t bit = (uint64_t)1 << (off & 63);
+    if(!(page->present[off >> 6] & bit)){
+        if(page->mmio) return mmio_read(m, addr);
+        if(page->shared) page = unshare_page(m, page);
+        page->present[off >> 6] |= bit;
+        mark_dirty(m, page);
+        m->mem_version++;
+        if(m->fingerprint) m->fingerprint->mem_hash += fingerprint_term(addr, page->bytes[off]);
+    }
+    return page->bytes[off];
+}
+
+//data read
+inline uint8_t mem_read(machine_t* m, uint32_t addr){
+    if(m->access_trace) trace_access(m, ACCESS_READ, addr, 1);
+    return mem_touch(m, addr);
+}
+
+//instruction byte fetch
+inline uint8_t mem_fetch(machine_t* m, uint32_t addr){
+    if(m->access_trace) trace_access(m, ACCESS_FETCH, addr, 1);
+    return mem_touch(m, addr);
+}
+
+inline void mem_write(machine_t* m, uint32_t addr, uint8_t value){
+    if(m->access_trace) trace_access(m, ACCESS_WRITE, addr, 1);
+    page_t* page = mem_page(m, addr);
+    if(page->mmio){ mmio_write(m, addr, value); return; }
+    if(page->shared) page = unshare_page(m, page);
+    uint32_t off = addr & PAGE_MASK;
+    uint64_t bit = (uint64_t)1 << (off & 63);
+    bool was_present = page->present[off >> 6] & bit;
+    if(page->bytes[off] != value || !was_present){
+        m->mem_version++;
+        if(m->fingerprint){
+            if(was_present) m->fingerprint->mem_hash -= fingerprint_term(addr, page->bytes[off]);
+            m->fingerprint->mem_hash += fingerprint_term(addr, value);
+        }
+    }
+    page->present[off >> 6] |= bit;
+    page->bytes[off] = value;
+    mark_dirty(m, page);
+    if(page->code) code_written(m, addr, value);
+}
+
+//reads a guest byte without marking it present (0 if never touched)
+inline uint8_t mem_peek(machine_t* m, uint32_t addr){
+    page_t* page = mem_page_slow(m, addr >> PAGE_BITS, false);
+    return page ? page->bytes[addr & PAGE_MASK] : 0;
+}
+
+#endif
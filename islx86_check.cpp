@@ -0,0 +1,207 @@
+#include "islx86.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// islx86-check: differential check of the execution engines on mem.txt programs.
+// Usage: islx86-check [-c max_cycles] prog.txt...
+// Every program runs four ways: islx86_step one instruction at a time, islx86_run_until (fused
+// branches, spin skipping), a translation compiled by islx86_translate and an 8 lane sweep (lockstep
+// lanes with AVX2, worker threads without). Cycles, EIP, the registers, the flags and a hash of
+// memory must come out the same everywhere; the exit status is 1 if they do not for any program.
+// A HLT written over the first instruction through islx86_page_view must stop the translated run
+// just like the interpreted one, and islx86_reset to the snapshot taken before it must undo it.
+const int CHECK_LANES = 8;
+
+typedef struct{
+    string engine;
+    int halt_reason; //-1: not known (islx86_step only tells whether the machine still runs)
+    uint64_t cycles;
+    state_t state;
+    uint64_t mem_hash;
+}outcome_t;
+
+//FNV-1a over the guest address and bytes of every range
+uint64_t hash_ranges(const vector<pair<uint32_t, const uint8_t*>>& ranges, size_t size){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto put = [&](uint8_t b){ h = (h ^ b) * 0x100000001b3ULL; };
+    for(const auto& r : ranges){
+        for(int i = 0; i < 4; i++) put((uint8_t)(r.first >> (8 * i)));
+        for(size_t i = 0; i < size; i++) put(r.second[i]);
+    }
+    return h;
+}
+
+uint64_t hash_memory(machine_t* m){
+    vector<pair<uint32_t, const uint8_t*>> ranges;
+    for(const mem_span_t& span : islx86_mapped_pages(m)) ranges.push_back({span.base, span.data});
+    return hash_ranges(ranges, PAGE_SIZE);
+}
+
+outcome_t outcome_of(const string& engine, machine_t* m, int halt_reason){
+    outcome_t o = {engine, halt_reason, m->cycles, m->curr_state, hash_memory(m)};
+    o.state.INSTR.clear();
+    return o;
+}
+
+machine_t* create_quiet(const string& path){
+    machine_t* m = islx86_create();
+    islx86_set_callbacks(m, {nullptr, nullptr, nullptr});
+    islx86_load(m, path);
+    return m;
+}
+
+//stores one byte through a page view the way an embedding harness would
+void write_through_view(machine_t* m, uint32_t addr, uint8_t value){
+    mem_span_t view = islx86_page_view(m, addr);
+    if(!view.data) throw runtime_error("No page at the program's entry point");
+    view.data[0] = value;
+    islx86_page_written(m, addr, 1);
+}
+
+//first field where b differs from a, empty if none
+string first_difference(const outcome_t& a, const outcome_t& b){
+    char buf[96];
+    auto differ = [&](const char* name, uint64_t x, uint64_t y){
+        snprintf(buf, sizeof(buf), "%s %" PRIx64 " instead of %" PRIx64, name, y, x);
+        return string(buf);
+    };
+    static const char* gpr_names[8] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+    static const char* seg_names[6] = {"es", "cs", "ss", "ds", "fs", "gs"};
+    static const char* flag_names[7] = {"CF", "PF", "AF", "ZF", "SF", "DF", "OF"};
+    if(a.halt_reason >= 0 && b.halt_reason >= 0 && a.halt_reason != b.halt_reason){
+        return string("halt ") + islx86_halt_name(b.halt_reason) + " instead of " + islx86_halt_name(a.halt_reason);
+    }
+    if(a.cycles != b.cycles) return differ("cycles", a.cycles, b.cycles);
+    if(a.state.EIP != b.state.EIP) return differ("eip", (uint32_t)a.state.EIP, (uint32_t)b.state.EIP);
+    for(int i = 0; i < 8; i++){
+        if(a.state.GPR[i] != b.state.GPR[i]) return differ(gpr_names[i], (uint32_t)a.state.GPR[i], (uint32_t)b.state.GPR[i]);
+    }
+    for(int i = 0; i < 6; i++){
+        if(a.state.SEGR[i] != b.state.SEGR[i]) return differ(seg_names[i], (uint16_t)a.state.SEGR[i], (uint16_t)b.state.SEGR[i]);
+    }
+    for(int i = 0; i < 8; i++){
+        if(a.state.MMX[i] != b.state.MMX[i]) return differ(("mm" + to_string(i)).c_str(), (uint64_t)a.state.MMX[i], (uint64_t)b.state.MMX[i]);
+    }
+    for(int i = 0; i < 7; i++){
+        if(a.state.FLAGS[i] != b.state.FLAGS[i]) return differ(flag_names[i], a.state.FLAGS[i], b.state.FLAGS[i]);
+    }
+    if(a.state.IF != b.state.IF) return differ("IF", a.state.IF, b.state.IF);
+    if(a.mem_hash != b.mem_hash) return differ("memory hash", a.mem_hash, b.mem_hash);
+    return "";
+}
+
+//runs one program every way and prints a line for it (and one per disagreeing engine); false on a mismatch
+bool check_program(const string& path, uint64_t max_cycles, const string& work_dir){
+    vector<outcome_t> outcomes;
+
+    machine_t* m = create_quiet(path);
+    while(m->cycles < max_cycles && islx86_step(m)){}
+    outcomes.push_back(outcome_of("islx86_step", m, -1));
+    islx86_destroy(m);
+
+    m = create_quiet(path);
+    int reason = islx86_run_until(m, NO_STOP_EIP, max_cycles);
+    outcomes.push_back(outcome_of("islx86_run_until", m, reason));
+    //the lanes are compared against the pages the reference run ended up with
+    vector<pair<uint32_t, uint32_t>> watch;
+    for(const mem_span_t& span : islx86_mapped_pages(m)) watch.push_back({span.base, (uint32_t)span.size});
+    islx86_destroy(m);
+
+    string so_path = work_dir + "/check.so";
+    m = create_quiet(path);
+    size_t blocks = islx86_translate(m, so_path);
+    islx86_load_translation(m, so_path);
+    reason = islx86_run_until(m, NO_STOP_EIP, max_cycles);
+    outcomes.push_back(outcome_of("translated", m, reason));
+    uint64_t translated = m->aot->translated_instrs;
+    islx86_destroy(m);
+
+    vector<pair<outcome_t, outcome_t>> pairs; //(expected, got) beyond the comparisons with the reference
+    m = create_quiet(path);
+    uint32_t entry = fetch_address(m->curr_state);
+    write_through_view(m, entry, 0xF4);
+    reason = islx86_run_until(m, NO_STOP_EIP, max_cycles);
+    outcome_t halted = outcome_of("interpreted with a HLT written through a view", m, reason);
+    islx86_destroy(m);
+    m = create_quiet(path);
+    islx86_load_translation(m, so_path);
+    snapshot_t* snap = islx86_snapshot(m);
+    write_through_view(m, entry, 0xF4);
+    reason = islx86_run_until(m, NO_STOP_EIP, max_cycles);
+    pairs.push_back({halted, outcome_of("translated with a HLT written through a view", m, reason)});
+    islx86_reset(m, snap);
+    reason = islx86_run_until(m, NO_STOP_EIP, max_cycles);
+    outcomes.push_back(outcome_of("islx86_reset after the view write", m, reason));
+    islx86_free_snapshot(snap);
+    islx86_destroy(m);
+    unlink(so_path.c_str());
+    unlink((so_path + ".cpp").c_str());
+
+    program_t* program = islx86_load_program(path);
+    vector<sweep_result_t> lanes = islx86_sweep(program, vector<patch_set_t>(CHECK_LANES), watch, max_cycles, 1, CHECK_LANES);
+    islx86_release_program(program);
+    for(int i = 0; i < CHECK_LANES; i++){
+        vector<pair<uint32_t, const uint8_t*>> ranges;
+        for(size_t w = 0; w < watch.size(); w++) ranges.push_back({watch[w].first, lanes[i].watched.data() + w * PAGE_SIZE});
+        outcomes.push_back({"sweep lane " + to_string(i), lanes[i].halt_reason, lanes[i].cycles, lanes[i].state,
+                            hash_ranges(ranges, PAGE_SIZE)});
+    }
+
+    const outcome_t& ref = outcomes[1];
+    vector<string> mismatches;
+    for(const outcome_t& o : outcomes){
+        string d = first_difference(ref, o);
+        if(!d.empty()) mismatches.push_back(o.engine + ": " + d);
+    }
+    for(const auto& p : pairs){
+        string d = first_difference(p.first, p.second);
+        if(!d.empty()) mismatches.push_back(p.second.engine + ": " + d);
+    }
+    cout << path << ": " << ref.cycles << " cycles, " << islx86_halt_name(ref.halt_reason) << ", " << blocks << " blocks translated ("
+         << translated << " instructions ran translated), " << CHECK_LANES << " lanes ("
+         << (islx86_lockstep_supported() ? "lockstep" : "threads") << ") - " << (mismatches.empty() ? "OK" : "MISMATCH") << endl;
+    for(const string& s : mismatches) cout << "    " << s << endl;
+    return mismatches.empty();
+}
+
+int main(int argc, char** argv){
+    uint64_t max_cycles = 10000000;
+    vector<string> programs;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "-c" && i + 1 < argc) max_cycles = strtoull(argv[++i], nullptr, 10);
+        else programs.push_back(arg);
+    }
+    if(programs.empty() || max_cycles == 0){
+        cerr << "Usage: islx86-check [-c max_cycles] prog.txt..." << endl;
+        return 2;
+    }
+    char dir_template[] = "/tmp/islx86-check.XXXXXX";
+    if(!mkdtemp(dir_template)){
+        cerr << "Could not create a directory for the translations" << endl;
+        return 2;
+    }
+    int failed = 0;
+    try{
+        for(const string& p : programs){
+            if(!check_program(p, max_cycles, dir_template)) failed++;
+        }
+    }
+    catch(const exception& e){
+        rmdir(dir_template);
+        cerr << e.what() << endl;
+        return 2;
+    }
+    rmdir(dir_template);
+    if(failed) cout << failed << " of " << programs.size() << " programs differ between engines" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+#include "islx86.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <dirent.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// islx86-top: watches running simulators through their live counter segments (live.cpp).
+// Usage: islx86-top [-d seconds] [-n updates] [pid...]
+// Without pids every /dev/shm/islx86.* segment is shown. Reading never blocks the simulators.
+const uint64_t STALL_MS = 5000; //a running machine that has not published for this long is stuck in the host
+
+//segments of all simulators on this host
+vector<string> find_segments(){
+    vector<string> names;
+    DIR* dir = opendir("/dev/shm");
+    if(!dir) return names;
+    while(dirent* e = readdir(dir)){
+        string n = e->d_name;
+        if(n.compare(0, 7, "islx86.") == 0) names.push_back("/" + n);
+    }
+    closedir(dir);
+    return names;
+}
+
+uint64_t now_ms(){
+    return (uint64_t)chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void print_row(const string& name, const live_stats_t& s){
+    string state = "run";
+    if(kill((pid_t)s.pid, 0) != 0 && errno == ESRCH) state = "dead"; //crashed without removing its segment
+    else if(!s.running) state = "halt";
+    else if(now_ms() > s.updated_ms + STALL_MS) state = "stall";
+    string hit = s.lookups ? to_string(s.hits * 100 / s.lookups) + "%" : "-";
+    printf("%-8lld %-5s %16llu %9.2f  0x%08llx %6s %9llu %10.1f  %s\n", (long long)s.pid, state.c_str(),
+           (unsigned long long)s.instrs, s.kips / 1000.0, (unsigned long long)s.eip, hit.c_str(),
+           (unsigned long long)s.pages, s.dump_bytes / 1048576.0, name.c_str());
+}
+
+int main(int argc, char* argv[]){
+    double delay = 1;
+    long updates = -1;
+    vector<string> names;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "-d" && i + 1 < argc) delay = stod(argv[++i]);
+        else if(arg == "-n" && i + 1 < argc) updates = stol(argv[++i]);
+        else names.push_back("/islx86." + arg);
+    }
+    bool all = names.empty();
+    bool tty = isatty(STDOUT_FILENO);
+    for(long n = 0; updates < 0 || n < updates; n++){
+        if(n) this_thread::sleep_for(chrono::duration<double>(delay));
+        if(all) names = find_segments();
+        if(tty) printf("\033[H\033[J");
+        printf("%-8s %-5s %16s %9s  %-10s %6s %9s %10s  %s\n", "PID", "STATE", "INSTRUCTIONS", "MIPS", "EIP", "BLKHIT",
+               "PAGES", "DUMP MB", "SEGMENT");
+        for(const string& name : names){
+            try{
+                live_segment_t* seg = islx86_open_live(name);
+                live_stats_t s;
+                bool ok = islx86_read_live(seg, s);
+                islx86_close_live(seg);
+                if(ok) print_row(name, s);
+                else printf("%-8s busy  %s\n", "?", name.c_str());
+            }
+            catch(const exception&){
+                if(!all) printf("%-8s gone  %s\n", "?", name.c_str()); //the run finished
+            }
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "islx86.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Live counters in shared memory (layout and seqlock protocol in islx86.h). The segment is
+// /dev/shm/<name>; the simulator refreshes it every `interval` instructions from its own thread,
+// the interval being retuned on each refresh so updates arrive about ten times a second whatever
+// the simulation speed. The MIPS figure covers the last full second.
+const uint64_t LIVE_MIN_INTERVAL = 1 << 10;
+const int LIVE_UPDATES_PER_SECOND = 10;
+const int LIVE_READ_TRIES = 1000;
+
+uint64_t wall_ms(){
+    return (uint64_t)chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//bytes the run/mem dumps hold so far (tellp flushes the stream buffer, a few times a second is fine)
+uint64_t dump_bytes_written(machine_t* m){
+    if(!m->dumps_enabled) return 0;
+    if(m->run_trace) return m->run_trace->out_bytes + m->mem_trace->out_bytes;
+    uint64_t n = 0;
+    for(ofstream* f : {&m->run_dump, &m->mem_dump}){
+        streamoff pos = f->tellp();
+        if(pos > 0) n += (uint64_t)pos;
+    }
+    return n;
+}
+
+void publish_live(machine_t* m){
+    live_t* l = m->live;
+    live_segment_t* seg = l->seg;
+    auto now = chrono::steady_clock::now();
+    //aim the next update a tenth of a second out at the rate the last interval ran (updates
+    //closer together than 10 ms, like the first one, say nothing about the rate)
+    double since = chrono::duration<double>(now - l->last_update).count();
+    if(since >= 0.01){
+        double rate = l->interval / since;
+        l->interval = max(LIVE_MIN_INTERVAL, (uint64_t)(rate / LIVE_UPDATES_PER_SECOND));
+        l->last_update = now;
+    }
+    m->live_next_cycle = m->cycles + l->interval;
+
+    uint32_t seq = seg->seq.load(memory_order_relaxed);
+    seg->seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    double window = chrono::duration<double>(now - l->window_start).count();
+    if(window >= 1.0){
+        seg->kips.store((uint64_t)((m->cycles - l->window_cycles) / window / 1000), memory_order_relaxed);
+        l->window_start = now;
+        l->window_cycles = m->cycles;
+    }
+    seg->instrs.store(m->cycles, memory_order_relaxed);
+    seg->eip.store(fetch_address(m->curr_state), memory_order_relaxed);
+    seg->lookups.store(m->aot ? m->aot->lookups : 0, memory_order_relaxed);
+    seg->hits.store(m->aot ? m->aot->hits : 0, memory_order_relaxed);
+    seg->pages.store(m->pages_allocated, memory_order_relaxed);
+    seg->dump_bytes.store(dump_bytes_written(m), memory_order_relaxed);
+    seg->running.store(m->run ? 1 : 0, memory_order_relaxed);
+    seg->updated_ms.store(wall_ms(), memory_order_relaxed);
+    seg->seq.store(seq + 2, memory_order_release);
+}
+
+//creates (or takes over) the segment /dev/shm/<name>, e.g. "/islx86.<pid>"
+void islx86_start_live(machine_t* m, const string& name){
+    islx86_stop_live(m);
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if(fd < 0) throw runtime_error("Cannot create shared memory segment " + name + ": " + strerror(errno));
+    if(ftruncate(fd, sizeof(live_segment_t)) != 0){
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error("Cannot size shared memory segment " + name);
+    }
+    void* p = mmap(nullptr, sizeof(live_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        shm_unlink(name.c_str());
+        throw runtime_error("Cannot map shared memory segment " + name);
+    }
+    live_segment_t* seg = new(p) live_segment_t(); //zero filled by ftruncate, the atomics start at 0
+    seg->magic = LIVE_MAGIC;
+    seg->version = LIVE_VERSION;
+    seg->pid = getpid();
+
+    live_t* l = new live_t();
+    l->name = name;
+    l->seg = seg;
+    l->interval = LIVE_MIN_INTERVAL;
+    l->window_start = l->last_update = chrono::steady_clock::now();
+    l->window_cycles = m->cycles;
+    m->live = l;
+    publish_live(m);
+}
+
+//publishes the final counters and removes the segment
+void islx86_stop_live(machine_t* m){
+    live_t* l = m->live;
+    if(!l) return;
+    publish_live(m);
+    munmap(l->seg, sizeof(live_segment_t));
+    shm_unlink(l->name.c_str());
+    delete l;
+    m->live = nullptr;
+    m->live_next_cycle = UINT64_MAX;
+}
+
+//maps another process's segment read only
+live_segment_t* islx86_open_live(const string& name){
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) throw runtime_error("Cannot open shared memory segment " + name + ": " + strerror(errno));
+    void* p = mmap(nullptr, sizeof(live_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) throw runtime_error("Cannot map shared memory segment " + name);
+    live_segment_t* seg = (live_segment_t*)p;
+    if(seg->magic != LIVE_MAGIC || seg->version != LIVE_VERSION){
+        munmap(p, sizeof(live_segment_t));
+        throw runtime_error(name + " is not an islx86 counter segment");
+    }
+    return seg;
+}
+
+//consistent copy of the counters, false if the writer kept changing them (it never waits for readers)
+bool islx86_read_live(const live_segment_t* seg, live_stats_t& stats){
+    for(int i = 0; i < LIVE_READ_TRIES; i++){
+        uint32_t seq = seg->seq.load(memory_order_acquire);
+        if(seq & 1) continue;
+        stats.pid = seg->pid;
+        stats.instrs = seg->instrs.load(memory_order_relaxed);
+        stats.eip = seg->eip.load(memory_order_relaxed);
+        stats.kips = seg->kips.load(memory_order_relaxed);
+        stats.lookups = seg->lookups.load(memory_order_relaxed);
+        stats.hits = seg->hits.load(memory_order_relaxed);
+        stats.pages = seg->pages.load(memory_order_relaxed);
+        stats.dump_bytes = seg->dump_bytes.load(memory_order_relaxed);
+        stats.running = seg->running.load(memory_order_relaxed);
+        stats.updated_ms = seg->updated_ms.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if(seg->seq.load(memory_order_relaxed) == seq) return true;
+    }
+    return false;
+}
+
+void islx86_close_live(live_segment_t* seg){
+    if(seg) munmap(seg, sizeof(live_segment_t));
+}
@@ -0,0 +1,203 @@
+#include "islx86.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Binary sidecar layout (written by islx86_convert_image):
+//   header  : "ISLXIMG1", uint32 page_count, uint32 pad
+//   records : page_count x { uint32 page_num, uint32 pad, uint64 present[64], uint8 bytes[4096] }
+static const char IMAGE_MAGIC[8] = {'I','S','L','X','I','M','G','1'};
+
+typedef struct{
+    char magic[8];
+    uint32_t page_count;
+    uint32_t pad;
+}image_header_t;
+
+typedef struct{
+    uint32_t page_num;
+    uint32_t pad;
+    uint64_t present[PAGE_SIZE / 64];
+    uint8_t bytes[PAGE_SIZE];
+}image_record_t;
+
+int hex_value(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//one pass over the mmapped text: only addresses and byte counts are read, no bytes are converted
+void index_text_image(image_t* image){
+    const char* p = image->base;
+    const char* end = image->base + image->size;
+    while(p < end){
+        const char* line = p;
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+        p = eol + 1;
+
+        if(eol - line < 2 || line[0] != '0' || line[1] != 'x') continue;
+        const char* c = line + 2;
+        uint32_t base_addr = 0;
+        for(; c < eol && *c != ':'; c++){
+            int v = hex_value(*c);
+            if(v < 0) break;
+            base_addr = (base_addr << 4) | (uint32_t)v;
+        }
+        if(c >= eol || *c != ':') continue;
+
+        uint32_t hex_chars = 0;
+        for(c++; c < eol && *c != '/'; c++){
+            if(*c == ' ' || *c == '\t' || *c == '\r') continue;
+            hex_chars++;
+        }
+        if(hex_chars % 2 != 0) throw runtime_error("Odd Number of Hex Chars");
+        if(hex_chars == 0) continue;
+
+        uint32_t last_addr = base_addr + hex_chars / 2 - 1;
+        for(uint32_t page_num = base_addr >> PAGE_BITS; ; page_num++){
+            image->text_lines[page_num].push_back((uint64_t)(line - image->base));
+            if(page_num == (last_addr >> PAGE_BITS)) break;
+        }
+    }
+}
+
+void index_binary_image(image_t* image){
+    image_header_t header;
+    memcpy(&header, image->base, sizeof(header));
+    if(sizeof(header) + (uint64_t)header.page_count * sizeof(image_record_t) > image->size){
+        throw runtime_error("Truncated image file");
+    }
+    uint64_t offset = sizeof(header);
+    for(uint32_t i = 0; i < header.page_count; i++, offset += sizeof(image_record_t)){
+        uint32_t page_num;
+        memcpy(&page_num, image->base + offset, sizeof(page_num));
+        image->bin_pages[page_num] = offset;
+    }
+}
+
+image_t* islx86_open_image(const string& path){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw runtime_error("Could not open " + path);
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        throw runtime_error("Could not stat " + path);
+    }
+
+    image_t* image = new image_t();
+    image->fd = fd;
+    image->size = (size_t)st.st_size;
+    image->base = nullptr;
+    if(image->size > 0){
+        void* base = mmap(nullptr, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(base == MAP_FAILED){
+            close(fd);
+            delete image;
+            throw runtime_error("Could not mmap " + path);
+        }
+        image->base = (const char*)base;
+    }
+
+    try{
+        if(image->size >= sizeof(image_header_t) && memcmp(image->base, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0){
+            image->kind = IMAGE_BINARY;
+            index_binary_image(image);
+        }
+        else{
+            image->kind = IMAGE_TEXT;
+            index_text_image(image);
+        }
+    }
+    catch(...){
+        islx86_close_image(image);
+        throw;
+    }
+    return image;
+}
+
+void islx86_close_image(image_t* image){
+    if(!image) return;
+    if(image->base) munmap((void*)image->base, image->size);
+    close(image->fd);
+    delete image;
+}
+
+bool image_has_page(const image_t* image, uint32_t page_num){
+    if(image->kind == IMAGE_BINARY) return image->bin_pages.count(page_num) != 0;
+    return image->text_lines.count(page_num) != 0;
+}
+
+void image_fill_page(const image_t* image, uint32_t page_num, page_t* page){
+    if(image->kind == IMAGE_BINARY){
+        const image_record_t* record = (const image_record_t*)(image->base + image->bin_pages.at(page_num));
+        memcpy(page->bytes, record->bytes, PAGE_SIZE);
+        memcpy(page->present, record->present, sizeof(page->present));
+        return;
+    }
+
+    //replay only the lines holding this page, in file order so later lines win like in init_mem
+    vector<uint8_t> bytes;
+    const char* end = image->base + image->size;
+    for(uint64_t offset : image->text_lines.at(page_num)){
+        const char* line = image->base + offset;
+        const char* eol = (const char*)memchr(line, '\n', end - line);
+        if(!eol) eol = end;
+        uint32_t base_addr = 0;
+        if(!parse_mem_line(string(line, eol), base_addr, bytes)) continue;
+        uint32_t addr = base_addr;
+        for(size_t i = 0; i < bytes.size(); i++, addr++){
+            if((addr >> PAGE_BITS) != page_num) continue;
+            uint32_t off = addr & PAGE_MASK;
+            page->bytes[off] = bytes[i];
+            page->present[off >> 6] |= (uint64_t)1 << (off & 63);
+        }
+    }
+}
+
+//parses mem.txt once and writes the binary sidecar that later runs can page straight out of
+void islx86_convert_image(const string& text_path, const string& bin_path){
+    machine_t* m = islx86_create();
+    try{
+        islx86_load(m, text_path);
+    }
+    catch(...){
+        islx86_destroy(m);
+        throw;
+    }
+    vector<mem_span_t> pages = islx86_mapped_pages(m);
+
+    ofstream out(bin_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open()){
+        islx86_destroy(m);
+        throw runtime_error("Could not open " + bin_path);
+    }
+    image_header_t header;
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.page_count = (uint32_t)pages.size();
+    header.pad = 0;
+    out.write((const char*)&header, sizeof(header));
+
+    image_record_t* record = new image_record_t();
+    for(const mem_span_t& span : pages){
+        const page_t* page = mem_page_slow(m, span.base >> PAGE_BITS, false);
+        record->page_num = span.base >> PAGE_BITS;
+        memcpy(record->present, page->present, sizeof(record->present));
+        memcpy(record->bytes, page->bytes, PAGE_SIZE);
+        out.write((const char*)record, sizeof(*record));
+    }
+    delete record;
+    islx86_destroy(m);
+}
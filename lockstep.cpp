@@ -0,0 +1,591 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <immintrin.h>
+
+using namespace std;
+
+// Lockstep execution of many machines on one program. Every lane is a machine mapping the program,
+// but while the engine runs its EIP, GPRs, flags and cycle count live in lockstep_t, one array per
+// register indexed by lane, so the lanes at one CS:EIP execute an instruction as a few AVX2
+// operations per 8 lanes with a mask selecting them. Vectorized are the 32 bit register forms
+//   ADD           01 03 05, 81/83 /0 /2 /3 (update_flags_add quirks included)
+//   OR AND SUB XOR CMP, TEST, INC DEC     the alu.cpp register / EAX / immediate forms
+//   XCHG          86 with two byte registers (the interpreter's write order)
+//   Jcc JMP LOOPcc JECXZ
+// A branch the lanes disagree on splits them: the lanes at the lowest CS:EIP run first, so groups
+// meet again where the paths join. Anything else (memory operands, 8/16 bit forms, strings, MOVQ,
+// far jumps, HLT) runs in the interpreter lane by lane, as does a lane that has been alone at its
+// CS:EIP for LOCKSTEP_SOLO_TURNS turns (it finishes with islx86_run_until), whose stores changed
+// code the engine decoded or that has a timer event or interrupt coming (irq.cpp). Results are exactly those of islx86_run_until with the same limit, except
+// that a lane spinning without a limit may be caught (HALT_SPIN) at another point of the same loop.
+const uint32_t LOCKSTEP_SOLO_TURNS = 64;
+const uint64_t LOCKSTEP_SPIN_EVERY = 1 << 20; //engine turns between spin checks of every lane
+const uint64_t LOCKSTEP_SPIN_CYCLES = 1 << 12; //instructions a lane runs in the interpreter per spin check
+
+enum LANE_OPS {
+    LANE_SCALAR,
+    LANE_ADD,
+    LANE_OR,
+    LANE_AND,
+    LANE_SUB,
+    LANE_XOR,
+    LANE_CMP,
+    LANE_TEST,
+    LANE_INC,
+    LANE_DEC,
+    LANE_XCHG8,
+    LANE_JCC,
+    LANE_JMP,
+    LANE_LOOP
+};
+
+//lane op of the ALU operation in bits 5:3 of the opcode / the reg field of 81/83 (ADC, SBB are not in the ISA)
+static const int ALU_LANE_OPS[8] = {LANE_ADD, LANE_OR, LANE_SCALAR, LANE_SCALAR, LANE_AND, LANE_SUB, LANE_XOR, LANE_CMP};
+
+bool islx86_lockstep_supported(){
+    return __builtin_cpu_supports("avx2");
+}
+
+//how the lanes run a decoded instruction; LANE_SCALAR unless it is one of the register forms above
+lane_insn_t classify_insn(const insn_t& in, uint16_t cs){
+    lane_insn_t li;
+    li.in = in;
+    li.cs = cs;
+    li.op = LANE_SCALAR;
+    li.a = li.b = li.dst = -1;
+    li.next = li.taken = -1;
+    if(in.o16) return li;
+    uint8_t op = in.op;
+    bool reg_form = in.modrm.mod == 3;
+    int reg = in.modrm.reg, r_m = in.modrm.r_m;
+    switch(in.kind){
+        case INSN_ADD:
+            if(op == 0x05){ li.op = LANE_ADD; li.b = EAX; li.dst = EAX; } //update_flags_add(imm, EAX)
+            else if((op == 0x81 || op == 0x83) && reg_form){ li.op = LANE_ADD; li.a = r_m; li.dst = r_m; }
+            else if((op == 0x01 || op == 0x03) && reg_form){ li.op = LANE_ADD; li.a = reg; li.b = r_m; li.dst = (op & 0x02) ? reg : r_m; }
+            break;
+        case INSN_ALU:
+            if(op < 0x40 && (op & 0x07) <= 3){
+                if(!(op & 0x01) || !reg_form) break;
+                li.op = ALU_LANE_OPS[op >> 3];
+                li.a = (op & 0x02) ? reg : r_m;
+                li.b = (op & 0x02) ? r_m : reg;
+                li.dst = li.a;
+            }
+            else if(op < 0x40){
+                if(!(op & 0x01)) break;
+                li.op = ALU_LANE_OPS[op >> 3];
+                li.a = li.dst = EAX;
+            }
+            else if(op <= 0x4F){
+                li.op = op < 0x48 ? LANE_INC : LANE_DEC;
+                li.a = li.dst = op & 0x07;
+            }
+            else if((op == 0x81 || op == 0x83) && reg_form){
+                li.op = ALU_LANE_OPS[reg];
+                li.a = li.dst = r_m;
+            }
+            else if(op == 0x85 && reg_form){ li.op = LANE_TEST; li.a = r_m; li.b = reg; }
+            else if(op == 0xA9){ li.op = LANE_TEST; li.a = EAX; }
+            else if(op == 0xF7 && reg_form){ li.op = LANE_TEST; li.a = r_m; }
+            else if(op == 0xFF && reg_form){
+                li.op = reg == 0 ? LANE_INC : LANE_DEC;
+                li.a = li.dst = r_m;
+            }
+            if(li.op == LANE_CMP || li.op == LANE_TEST) li.dst = -1;
+            break;
+        case INSN_XCHG:
+            if(reg_form){ li.op = LANE_XCHG8; li.a = reg; li.b = r_m; }
+            break;
+        case INSN_JCC: li.op = LANE_JCC; break;
+        case INSN_JMP: li.op = LANE_JMP; break;
+        case INSN_LOOP: if(!in.a16) li.op = LANE_LOOP; break; //the vector step counts in ECX, CX (0x67) stays scalar
+    }
+    return li;
+}
+
+//flags the bytes of an instruction as code on lane i's pages (copying shared ones first, so stores
+//reach lockstep_code_written); false, and the lane marked, if its bytes already differ from the program
+bool claim_lane_code(lockstep_t* ls, int i, uint32_t addr, uint32_t len){
+    machine_t* m = ls->machines[i];
+    bool same = true;
+    for(uint32_t a = addr; a < addr + len; a++){
+        page_t* page = mem_page_slow(m, a >> PAGE_BITS, false);
+        uint32_t off = a & PAGE_MASK;
+        if(!page || !((page->present[off >> 6] >> (off & 63)) & 1)){
+            same = false;
+            continue;
+        }
+        if(!page->code){
+            if(page->shared) page = unshare_page(m, page);
+            page->code = true;
+        }
+        if(page->bytes[off] != mem_peek(ls->decoder, a)) same = false;
+    }
+    if(!same) m->lane_code_changed = true;
+    return same;
+}
+
+//index of the instruction at CS:EIP in ls->insns, decoded from the program the first time
+int lane_insn(lockstep_t* ls, uint16_t cs, uint32_t eip){
+    uint64_t key = ((uint64_t)cs << 32) | eip;
+    auto it = ls->insn_index.find(key);
+    if(it != ls->insn_index.end()) return it->second;
+    uint32_t cs_base = (uint32_t)cs << 16;
+    insn_t in;
+    lane_insn_t li;
+    if(decode_insn(ls->decoder, cs_base, eip, in)) li = classify_insn(in, cs);
+    else{ //not loaded with the program: the lanes' own bytes decide
+        in = insn_t();
+        in.eip = eip;
+        li = classify_insn(in, cs);
+        li.op = LANE_SCALAR;
+    }
+    if(li.op != LANE_SCALAR){
+        uint32_t addr = cs_base + eip;
+        for(uint32_t a = addr; a < addr + (uint32_t)in.len; a++){
+            vector<uint64_t>& bits = ls->code_bits[a >> PAGE_BITS];
+            if(bits.empty()) bits.resize(PAGE_SIZE / 64);
+            bits[(a & PAGE_MASK) >> 6] |= (uint64_t)1 << (a & 63);
+        }
+        bool same = true;
+        for(int i = 0; i < ls->lanes; i++) same = claim_lane_code(ls, i, addr, in.len) && same;
+        if(!same) li.op = LANE_SCALAR; //the lanes that differ leave at the next check, the others take this one step alone
+    }
+    ls->insns.push_back(li);
+    ls->insn_index[key] = (int)ls->insns.size() - 1;
+    return (int)ls->insns.size() - 1;
+}
+
+//mem_write hook on a lane's code pages: a byte the engine decoded now differs from the program
+void lockstep_code_written(machine_t* m, uint32_t addr, uint8_t value){
+    lockstep_t* ls = m->lockstep;
+    auto p = ls->code_bits.find(addr >> PAGE_BITS);
+    if(p == ls->code_bits.end()) return;
+    uint32_t off = addr & PAGE_MASK;
+    if(((p->second[off >> 6] >> (off & 63)) & 1) && value != mem_peek(ls->decoder, addr)) m->lane_code_changed = true;
+}
+
+//a lane's code page was overwritten in bulk
+void lockstep_code_replaced(machine_t* m, const page_t* page){
+    lockstep_t* ls = m->lockstep;
+    auto p = ls->code_bits.find(page->page_num);
+    if(p == ls->code_bits.end()) return;
+    uint32_t base = page->page_num << PAGE_BITS;
+    for(uint32_t off = 0; off < PAGE_SIZE; off++){
+        if(((p->second[off >> 6] >> (off & 63)) & 1) && page->bytes[off] != mem_peek(ls->decoder, base + off)){
+            m->lane_code_changed = true;
+            return;
+        }
+    }
+}
+
+//lane i's registers from the engine into its machine (both states, as between two steps)
+void lane_to_machine(lockstep_t* ls, int i){
+    machine_t* m = ls->machines[i];
+    const int w = ls->width;
+    for(state_t* s : {&m->curr_state, &m->next_state}){
+        s->EIP = ls->eip[i];
+        for(int r = 0; r < 8; r++) s->GPR[r] = ls->gpr[r * w + i];
+        for(int f = 0; f < 7; f++) s->FLAGS[f] = ls->flags[f * w + i] != 0;
+        s->SEGR[CS] = (int16_t)ls->cs[i];
+    }
+    m->cycles = ls->cycles[i];
+}
+
+void machine_to_lane(lockstep_t* ls, int i){
+    machine_t* m = ls->machines[i];
+    const state_t& s = m->curr_state;
+    const int w = ls->width;
+    ls->eip[i] = s.EIP;
+    for(int r = 0; r < 8; r++) ls->gpr[r * w + i] = s.GPR[r];
+    for(int f = 0; f < 7; f++) ls->flags[f * w + i] = s.FLAGS[f];
+    ls->cs[i] = (uint16_t)s.SEGR[CS];
+    ls->cycles[i] = m->cycles;
+}
+
+void stop_lane(lockstep_t* ls, int i, int reason){
+    ls->running[i] = 0;
+    ls->group[i] = 0;
+    ls->halt_reason[i] = reason;
+}
+
+//the rest of lane i's run in the interpreter
+void finish_in_interpreter(lockstep_t* ls, int i){
+    machine_t* m = ls->machines[i];
+    lane_to_machine(ls, i);
+    int reason = islx86_run_until(m, NO_STOP_EIP, ls->limit[i]);
+    ls->scalar_instrs += m->cycles - ls->cycles[i];
+    machine_to_lane(ls, i);
+    stop_lane(ls, i, reason);
+}
+
+//after lane i retired instructions: halted, at its limit, running changed code or waiting for an event
+void settle_lane(lockstep_t* ls, int i){
+    machine_t* m = ls->machines[i];
+    if(!m->run) stop_lane(ls, i, m->halt_reason);
+    else if(ls->cycles[i] >= ls->limit[i]) stop_lane(ls, i, HALT_CYCLE_LIMIT);
+    else if(m->lane_code_changed) finish_in_interpreter(ls, i);
+    else if(m->next_event_cycle != UINT64_MAX) finish_in_interpreter(ls, i); //timer events and interrupts need the step loop
+}
+
+void step_lane(lockstep_t* ls, int i){
+    lane_to_machine(ls, i);
+    islx86_step(ls->machines[i]);
+    machine_to_lane(ls, i);
+    ls->scalar_instrs++;
+    settle_lane(ls, i);
+}
+
+//runs every lane a little in the interpreter with spin_check watching, as islx86_run_until would:
+//lanes spinning without a limit stop with HALT_SPIN, those with one skip ahead to it
+void spin_round(lockstep_t* ls){
+    for(int i = 0; i < ls->lanes; i++){
+        if(!ls->running[i]) continue;
+        machine_t* m = ls->machines[i];
+        lane_to_machine(ls, i);
+        uint64_t start = m->cycles, end = min(ls->limit[i], start + LOCKSTEP_SPIN_CYCLES);
+        bool spinning = false;
+        spin_reset(m);
+        while(m->run && m->cycles < end && !spinning && m->next_event_cycle == UINT64_MAX){
+            uint32_t pc = fetch_address(m->curr_state);
+            islx86_step(m);
+            if(fetch_address(m->curr_state) <= pc && m->run) spinning = spin_check(m, ls->limit[i]);
+        }
+        machine_to_lane(ls, i);
+        ls->scalar_instrs += m->cycles - start;
+        if(spinning) stop_lane(ls, i, HALT_SPIN);
+        else settle_lane(ls, i);
+    }
+}
+
+// The vector kernels. Flags are kept as 0 / 1 per lane, lane masks as all ones / zero.
+#define LOCKSTEP_AVX2 __attribute__((target("avx2")))
+
+LOCKSTEP_AVX2 inline __m256i v_load(const int32_t* p){
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+LOCKSTEP_AVX2 inline void v_put(int32_t* p, __m256i mask, __m256i v){
+    _mm256_maskstore_epi32(p, mask, v);
+}
+
+LOCKSTEP_AVX2 inline __m256i v_one(){
+    return _mm256_set1_epi32(1);
+}
+
+LOCKSTEP_AVX2 inline __m256i v_not(__m256i bit){
+    return _mm256_xor_si256(bit, v_one());
+}
+
+LOCKSTEP_AVX2 inline __m256i v_is_zero(__m256i v){
+    return _mm256_srli_epi32(_mm256_cmpeq_epi32(v, _mm256_setzero_si256()), 31);
+}
+
+//parity(): 1 for an even number of set bits in the low byte
+LOCKSTEP_AVX2 inline __m256i v_parity(__m256i v){
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0xFF));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 4));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 2));
+    v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 1));
+    return v_not(_mm256_and_si256(v, v_one()));
+}
+
+//PF ZF SF of a 32 bit result
+LOCKSTEP_AVX2 inline void put_result_flags(int32_t* F, int w, __m256i mask, __m256i r){
+    v_put(F + PF * w, mask, v_parity(r));
+    v_put(F + ZF * w, mask, v_is_zero(r));
+    v_put(F + SF * w, mask, _mm256_srli_epi32(r, 31));
+}
+
+//update_flags_sub(a, b, 32), CF left alone for DEC
+LOCKSTEP_AVX2 inline void put_sub_flags(int32_t* F, int w, __m256i mask, __m256i a, __m256i b, __m256i d, bool carry){
+    if(carry){
+        __m256i bias = _mm256_set1_epi32((int32_t)0x80000000);
+        __m256i below = _mm256_cmpgt_epi32(_mm256_xor_si256(b, bias), _mm256_xor_si256(a, bias));
+        v_put(F + CF * w, mask, _mm256_srli_epi32(below, 31));
+    }
+    put_result_flags(F, w, mask, d);
+    __m256i x = _mm256_xor_si256(a, b);
+    v_put(F + AF * w, mask, _mm256_and_si256(_mm256_srli_epi32(_mm256_xor_si256(x, d), 4), v_one()));
+    v_put(F + OF * w, mask, _mm256_srli_epi32(_mm256_and_si256(x, _mm256_xor_si256(a, d)), 31));
+}
+
+//update_flags_add(x, y, 32): it sums x with itself in 32 bits, y only reaches AF and OF
+LOCKSTEP_AVX2 inline void put_add_flags(int32_t* F, int w, __m256i mask, __m256i x, __m256i y){
+    __m256i low = _mm256_set1_epi32(0x0F), sum = _mm256_slli_epi32(x, 1);
+    v_put(F + CF * w, mask, _mm256_setzero_si256());
+    v_put(F + PF * w, mask, v_parity(sum));
+    __m256i nibbles = _mm256_add_epi32(_mm256_and_si256(x, low), _mm256_and_si256(y, low));
+    v_put(F + AF * w, mask, _mm256_and_si256(_mm256_srli_epi32(nibbles, 4), v_one()));
+    v_put(F + ZF * w, mask, v_is_zero(sum));
+    v_put(F + SF * w, mask, _mm256_srli_epi32(sum, 31));
+    __m256i same_sign = v_not(_mm256_srli_epi32(_mm256_xor_si256(x, y), 31));
+    __m256i top = v_not(v_is_zero(_mm256_and_si256(x, _mm256_set1_epi32((int32_t)0xC0000000))));
+    v_put(F + OF * w, mask, _mm256_and_si256(same_sign, top));
+}
+
+//cond_holds per lane, 0 / 1
+LOCKSTEP_AVX2 inline __m256i v_cond(const int32_t* F, int w, int cc){
+    __m256i t;
+    switch(cc >> 1){
+        case 0: t = v_load(F + OF * w); break;
+        case 1: t = v_load(F + CF * w); break;
+        case 2: t = v_load(F + ZF * w); break;
+        case 3: t = _mm256_or_si256(v_load(F + CF * w), v_load(F + ZF * w)); break;
+        case 4: t = v_load(F + SF * w); break;
+        case 5: t = v_load(F + PF * w); break;
+        case 6: t = _mm256_xor_si256(v_load(F + SF * w), v_load(F + OF * w)); break;
+        default: t = _mm256_or_si256(v_load(F + ZF * w), _mm256_xor_si256(v_load(F + SF * w), v_load(F + OF * w))); break;
+    }
+    return (cc & 1) ? v_not(t) : t;
+}
+
+//XCHG r/m8, r8 register form: both bytes from the old values, written in the interpreter's order
+//(the second write wins when both name the same GPR)
+LOCKSTEP_AVX2 inline void xchg8(int32_t* R, int w, __m256i mask, int r1, int r2){
+    int g1 = r1 & 3, g2 = r2 & 3;
+    __m128i s1 = _mm_cvtsi32_si128(r1 >= 4 ? 8 : 0), s2 = _mm_cvtsi32_si128(r2 >= 4 ? 8 : 0);
+    __m256i o1 = v_load(R + g1 * w), o2 = v_load(R + g2 * w), byte = _mm256_set1_epi32(0xFF);
+    __m256i v1 = _mm256_and_si256(_mm256_srl_epi32(o1, s1), byte), v2 = _mm256_and_si256(_mm256_srl_epi32(o2, s2), byte);
+    __m256i n1 = _mm256_or_si256(_mm256_andnot_si256(_mm256_sll_epi32(byte, s1), o1), _mm256_sll_epi32(v2, s1));
+    __m256i n2 = _mm256_or_si256(_mm256_andnot_si256(_mm256_sll_epi32(byte, s2), o2), _mm256_sll_epi32(v1, s2));
+    if(r1 < 4 && r2 >= 4){
+        v_put(R + g1 * w, mask, n1);
+        v_put(R + g2 * w, mask, n2);
+    }
+    else{
+        v_put(R + g2 * w, mask, n2);
+        v_put(R + g1 * w, mask, n1);
+    }
+}
+
+// Runs li on the lanes of the group. For branches the lanes' EIPs are set and the result says
+// which way they went (bit 0: some took it, bit 1: some fell through). Otherwise EIP and cycles
+// are only stored when `retire` is set; a converged run keeps them in one counter instead.
+LOCKSTEP_AVX2 int vector_step(lockstep_t* ls, const lane_insn_t& li, bool retire){
+    const int w = ls->width;
+    const insn_t& in = li.in;
+    bool branch = li.op == LANE_JCC || li.op == LANE_JMP || li.op == LANE_LOOP;
+    int outcome = 0;
+    __m256i one = v_one(), imm = _mm256_set1_epi32((int32_t)in.imm);
+    __m256i fall_through = _mm256_set1_epi32((int32_t)(in.eip + in.len)), target = _mm256_set1_epi32((int32_t)in.target);
+    for(int base = 0; base < w; base += LOCKSTEP_CHUNK){
+        __m256i mask = v_load(ls->group.data() + base);
+        if(_mm256_testz_si256(mask, mask)) continue;
+        int32_t* R = ls->gpr.data() + base;
+        int32_t* F = ls->flags.data() + base;
+        __m256i a = li.a >= 0 && li.op != LANE_XCHG8 ? v_load(R + li.a * w) : imm;
+        __m256i b = li.b >= 0 && li.op != LANE_XCHG8 ? v_load(R + li.b * w) : imm;
+        __m256i r = a, taken = one;
+        switch(li.op){
+            case LANE_ADD:
+                r = _mm256_add_epi32(a, b);
+                put_add_flags(F, w, mask, a, b);
+                break;
+            case LANE_OR: case LANE_AND: case LANE_XOR: case LANE_TEST:
+                r = li.op == LANE_OR ? _mm256_or_si256(a, b) : (li.op == LANE_XOR ? _mm256_xor_si256(a, b) : _mm256_and_si256(a, b));
+                put_result_flags(F, w, mask, r);
+                v_put(F + CF * w, mask, _mm256_setzero_si256());
+                v_put(F + OF * w, mask, _mm256_setzero_si256());
+                v_put(F + AF * w, mask, _mm256_setzero_si256());
+                break;
+            case LANE_SUB: case LANE_CMP:
+                r = _mm256_sub_epi32(a, b);
+                put_sub_flags(F, w, mask, a, b, r, true);
+                break;
+            case LANE_INC:
+                r = _mm256_add_epi32(a, one);
+                put_result_flags(F, w, mask, r);
+                v_put(F + OF * w, mask, _mm256_srli_epi32(_mm256_cmpeq_epi32(r, _mm256_set1_epi32((int32_t)0x80000000)), 31));
+                v_put(F + AF * w, mask, _mm256_srli_epi32(_mm256_cmpeq_epi32(_mm256_and_si256(a, _mm256_set1_epi32(0x0F)),
+                                                                             _mm256_set1_epi32(0x0F)), 31));
+                break;
+            case LANE_DEC:
+                r = _mm256_sub_epi32(a, one);
+                put_sub_flags(F, w, mask, a, one, r, false);
+                break;
+            case LANE_XCHG8:
+                xchg8(R, w, mask, li.a, li.b);
+                break;
+            case LANE_JCC:
+                taken = v_cond(F, w, in.op & 0x0F);
+                break;
+            case LANE_LOOP:{
+                __m256i count = v_load(R + ECX * w);
+                if(in.op == 0xE3) taken = v_is_zero(count); //JECXZ
+                else{
+                    count = _mm256_sub_epi32(count, one);
+                    v_put(R + ECX * w, mask, count);
+                    taken = v_not(v_is_zero(count));
+                    if(in.op == 0xE0) taken = _mm256_and_si256(taken, v_not(v_load(F + ZF * w))); //LOOPNE
+                    if(in.op == 0xE1) taken = _mm256_and_si256(taken, v_load(F + ZF * w));        //LOOPE
+                }
+                break;
+            }
+        }
+        if(li.dst >= 0) v_put(R + li.dst * w, mask, r);
+        if(branch){
+            __m256i taken_mask = _mm256_cmpeq_epi32(taken, one);
+            if(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(taken_mask, mask)))) outcome |= 1;
+            if(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(taken_mask, mask)))) outcome |= 2;
+            v_put(ls->eip.data() + base, mask, _mm256_blendv_epi8(fall_through, target, taken_mask));
+        }
+        else if(retire) v_put(ls->eip.data() + base, mask, fall_through);
+        if(retire){ //cycles++ for the group, 4 lanes of 64 bits at a time (subtracting the -1 mask)
+            __m256i* c = (__m256i*)(ls->cycles.data() + base);
+            __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask)), hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask, 1));
+            _mm256_storeu_si256(c, _mm256_sub_epi64(_mm256_loadu_si256(c), lo));
+            _mm256_storeu_si256(c + 1, _mm256_sub_epi64(_mm256_loadu_si256(c + 1), hi));
+        }
+    }
+    return outcome;
+}
+
+// Every running lane sits at insns[at] (and is in the group): runs them together until a branch
+// splits them, an instruction needs the interpreter or `budget` instructions are done, then puts
+// the cycles (and EIPs, unless the splitting branch stored them) back per lane.
+uint64_t run_converged(lockstep_t* ls, int at, uint64_t budget){
+    uint64_t done = 0;
+    bool eips_stored = false;
+    while(done < budget && ls->insns[at].op != LANE_SCALAR){
+        const lane_insn_t& li = ls->insns[at];
+        int outcome = vector_step(ls, li, false);
+        done++;
+        if(outcome == 3){
+            eips_stored = true;
+            break;
+        }
+        bool taken = outcome == 1;
+        uint16_t cs = li.cs;
+        uint32_t eip = taken ? li.in.target : li.in.eip + li.in.len;
+        int next = taken ? li.taken : li.next;
+        if(next < 0){
+            next = lane_insn(ls, cs, eip); //may grow insns, li is not used after this
+            (taken ? ls->insns[at].taken : ls->insns[at].next) = next;
+        }
+        at = next;
+    }
+    for(int i = 0; i < ls->lanes; i++){
+        if(!ls->running[i]) continue;
+        ls->cycles[i] += done;
+        if(!eips_stored) ls->eip[i] = (int32_t)ls->insns[at].in.eip;
+    }
+    ls->vector_instrs += done * count(ls->running.begin(), ls->running.end(), 1);
+    return done;
+}
+
+//new engine with `lanes` machines mapping the program; islx86_map_program a lane to start it over
+lockstep_t* islx86_create_lockstep(program_t* program, int lanes){
+    if(lanes < 1) throw runtime_error("A lockstep engine needs at least one lane");
+    if(!islx86_lockstep_supported()) throw runtime_error("Lockstep execution needs a CPU with AVX2");
+    lockstep_t* ls = new lockstep_t();
+    ls->program = program;
+    ls->decoder = islx86_create();
+    islx86_map_program(ls->decoder, program);
+    ls->lanes = lanes;
+    ls->width = (lanes + LOCKSTEP_CHUNK - 1) / LOCKSTEP_CHUNK * LOCKSTEP_CHUNK;
+    for(int i = 0; i < lanes; i++){
+        machine_t* m = islx86_create();
+        islx86_set_callbacks(m, {nullptr, nullptr, nullptr});
+        islx86_map_program(m, program);
+        m->lockstep = ls;
+        ls->machines.push_back(m);
+    }
+    ls->gpr.assign(8 * ls->width, 0);
+    ls->flags.assign(7 * ls->width, 0);
+    ls->eip.assign(ls->width, 0);
+    ls->group.assign(ls->width, 0);
+    ls->cs.assign(ls->width, 0);
+    ls->cycles.assign(ls->width, 0);
+    ls->limit.assign(ls->width, 0);
+    ls->running.assign(ls->width, 0);
+    ls->halt_reason.assign(ls->width, HALT_NONE);
+    ls->solo.assign(ls->width, 0);
+    return ls;
+}
+
+// Runs lanes 0 .. max_cycles.size() - 1 from their machines' current state until each halts, spins
+// forever or reaches its max_cycles (UINT64_MAX: none). The machines hold the final states after,
+// the result is what islx86_run_until would have returned for each.
+const vector<int>& islx86_run_lockstep(lockstep_t* ls, const vector<uint64_t>& max_cycles){
+    if((int)max_cycles.size() > ls->lanes) throw runtime_error("More cycle limits than lockstep lanes");
+    fill(ls->running.begin(), ls->running.end(), 0);
+    fill(ls->group.begin(), ls->group.end(), 0);
+    int lanes = (int)max_cycles.size();
+    for(int i = 0; i < lanes; i++){
+        machine_t* m = ls->machines[i];
+        ls->limit[i] = max_cycles[i];
+        ls->solo[i] = 0;
+        machine_to_lane(ls, i);
+        //pages may have been mapped again since the code was decoded: flag them and compare
+        m->lane_code_changed = false;
+        for(const auto& p : ls->code_bits){
+            for(uint32_t off = 0; off < PAGE_SIZE; off++){
+                if((p.second[off >> 6] >> (off & 63)) & 1) claim_lane_code(ls, i, (p.first << PAGE_BITS) + off, 1);
+            }
+        }
+        ls->running[i] = 1;
+        settle_lane(ls, i);
+    }
+
+    uint64_t turns = 0, next_spin_round = LOCKSTEP_SPIN_EVERY;
+    while(true){
+        if(turns >= next_spin_round){
+            spin_round(ls);
+            next_spin_round = turns + LOCKSTEP_SPIN_EVERY;
+        }
+        //the group: the running lanes at the lowest CS:EIP
+        uint64_t low = UINT64_MAX;
+        int running = 0, members = 0, first = -1;
+        for(int i = 0; i < lanes; i++){
+            if(!ls->running[i]) continue;
+            running++;
+            uint64_t key = ((uint64_t)ls->cs[i] << 32) | (uint32_t)ls->eip[i];
+            if(key < low){ low = key; members = 1; first = i; }
+            else if(key == low) members++;
+        }
+        if(!running) break;
+        for(int i = 0; i < lanes; i++){
+            ls->group[i] = ls->running[i] && (((uint64_t)ls->cs[i] << 32) | (uint32_t)ls->eip[i]) == low ? -1 : 0;
+        }
+        if(members == 1){
+            if(++ls->solo[first] > LOCKSTEP_SOLO_TURNS) finish_in_interpreter(ls, first);
+            else step_lane(ls, first);
+            turns++;
+            continue;
+        }
+        int at = lane_insn(ls, (uint16_t)(low >> 32), (uint32_t)low);
+        for(int i = 0; i < lanes; i++) if(ls->group[i]) ls->solo[i] = 0;
+        if(ls->insns[at].op == LANE_SCALAR){
+            for(int i = 0; i < lanes; i++) if(ls->group[i]) step_lane(ls, i);
+            turns++;
+            continue;
+        }
+        if(members == running){
+            uint64_t budget = next_spin_round - turns;
+            for(int i = 0; i < lanes; i++) if(ls->running[i]) budget = min(budget, ls->limit[i] - ls->cycles[i]);
+            turns += run_converged(ls, at, budget);
+            for(int i = 0; i < lanes; i++) if(ls->running[i] && ls->cycles[i] >= ls->limit[i]) stop_lane(ls, i, HALT_CYCLE_LIMIT);
+            continue;
+        }
+        vector_step(ls, ls->insns[at], true);
+        ls->vector_instrs += members;
+        for(int i = 0; i < lanes; i++) if(ls->group[i] && ls->cycles[i] >= ls->limit[i]) stop_lane(ls, i, HALT_CYCLE_LIMIT);
+        turns++;
+    }
+    for(int i = 0; i < lanes; i++) lane_to_machine(ls, i);
+    return ls->halt_reason;
+}
+
+void islx86_destroy_lockstep(lockstep_t* ls){
+    if(!ls) return;
+    for(machine_t* m : ls->machines) islx86_destroy(m);
+    islx86_destroy(ls->decoder);
+    delete ls;
+}
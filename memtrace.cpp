@@ -0,0 +1,182 @@
+#include "islx86.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Memory access trace files
+//   header  : "ISLXMA01"
+//   records : head byte, [size varint], address delta varint, [EIP delta varint]
+// head bits 0-1 are the type (ACCESS_FETCH / READ / WRITE), bit 2 set means the EIP is the
+// previous record's, bits 4-7 hold sizes 1-15 (0: a size varint follows). The address is stored
+// as the zigzag difference to where the previous access of the same type ended, so straight line
+// fetches and sequential data code as 0; the EIP as the zigzag difference to the previous EIP.
+// Most records take 2-3 bytes. A trace cut short (crashed run) reads back up to its last whole record.
+static const char ACCESS_MAGIC[8] = {'I','S','L','X','M','A','0','1'};
+const size_t ACCESS_BUFFER_SIZE = 1 << 20;
+const size_t ACCESS_MAX_RECORD = 1 + 3 * 5;
+
+inline void put_varint(vector<uint8_t>& out, uint32_t v){
+    while(v >= 0x80){
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+inline uint32_t zigzag(uint32_t delta){
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+inline uint32_t unzigzag(uint32_t v){
+    return (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+}
+
+//saves full buffers until told to stop; the simulation only waits when it fills a buffer while the other is still being saved
+void access_writer(access_trace_t* t){
+    unique_lock<mutex> guard(t->lock);
+    while(true){
+        t->cv.wait(guard, [t]{ return t->flush_ready || t->done; });
+        if(!t->flush_ready) return;
+        guard.unlock();
+        t->out.write((const char*)t->flush.data(), (streamsize)t->flush.size());
+        t->flush.clear();
+        guard.lock();
+        t->flush_ready = false;
+        t->cv.notify_all();
+    }
+}
+
+//hands the filled buffer to the writer thread and continues in the other one
+void access_swap_buffers(access_trace_t* t){
+    unique_lock<mutex> guard(t->lock);
+    t->cv.wait(guard, [t]{ return !t->flush_ready; });
+    t->fill.swap(t->flush);
+    t->flush_ready = true;
+    t->cv.notify_all();
+}
+
+void access_encode(access_trace_t* t){
+    const access_t& a = t->rec;
+    vector<uint8_t>& out = t->fill;
+    bool same_eip = a.eip == t->prev_eip;
+    out.push_back((uint8_t)(a.type | (same_eip ? 4 : 0) | (a.size < 16 ? a.size << 4 : 0)));
+    if(a.size >= 16) put_varint(out, a.size);
+    put_varint(out, zigzag(a.addr - t->prev_end[a.type]));
+    if(!same_eip) put_varint(out, zigzag(a.eip - t->prev_eip));
+    t->prev_end[a.type] = a.addr + a.size;
+    t->prev_eip = a.eip;
+    t->records++;
+    if(out.size() >= ACCESS_BUFFER_SIZE) access_swap_buffers(t);
+}
+
+//called by the memory paths while a trace is on: extends the pending record or starts a new one
+void trace_access(machine_t* m, int type, uint32_t addr, uint32_t size){
+    access_trace_t* t = m->access_trace;
+    access_t& r = t->rec;
+    if(t->pending && r.type == type && r.addr + r.size == addr && t->rec_cycle == m->cycles){
+        r.size += size;
+        return;
+    }
+    if(t->pending) access_encode(t);
+    r.type = type;
+    r.addr = addr;
+    r.size = size;
+    r.eip = (uint32_t)m->curr_state.EIP;
+    t->rec_cycle = m->cycles;
+    t->pending = true;
+}
+
+//from now on every guest memory access is recorded; fusion, translated code and spin skipping stay off meanwhile
+void islx86_start_access_trace(machine_t* m, const string& path){
+    islx86_stop_access_trace(m);
+    access_trace_t* t = new access_trace_t();
+    t->out.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if(!t->out.is_open()){
+        delete t;
+        throw runtime_error("Could not open " + path);
+    }
+    t->out.write(ACCESS_MAGIC, sizeof(ACCESS_MAGIC));
+    t->fill.reserve(ACCESS_BUFFER_SIZE + ACCESS_MAX_RECORD);
+    t->flush.reserve(ACCESS_BUFFER_SIZE + ACCESS_MAX_RECORD);
+    t->writer = thread(access_writer, t);
+    m->access_trace = t;
+}
+
+//writes out everything still buffered, returns the number of records in the trace
+uint64_t islx86_stop_access_trace(machine_t* m){
+    access_trace_t* t = m->access_trace;
+    if(!t) return 0;
+    if(t->pending) access_encode(t);
+    access_swap_buffers(t);
+    {
+        lock_guard<mutex> guard(t->lock);
+        t->done = true;
+    }
+    t->cv.notify_all();
+    t->writer.join();
+    uint64_t records = t->records;
+    delete t;
+    m->access_trace = nullptr;
+    return records;
+}
+
+access_reader_t* islx86_open_access_trace(const string& path){
+    access_reader_t* r = new access_reader_t();
+    r->in.open(path, std::ios::in | std::ios::binary);
+    char magic[sizeof(ACCESS_MAGIC)];
+    if(!r->in.is_open() || !r->in.read(magic, sizeof(magic)) || memcmp(magic, ACCESS_MAGIC, sizeof(magic))){
+        delete r;
+        throw runtime_error(path + " is not a memory access trace");
+    }
+    r->buf.resize(ACCESS_BUFFER_SIZE);
+    return r;
+}
+
+//false at the end of the trace
+bool islx86_next_access(access_reader_t* r, access_t& a){
+    if(r->len - r->pos < ACCESS_MAX_RECORD && r->in){ //refill, a record never spans more than what is kept
+        memmove(r->buf.data(), r->buf.data() + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+        r->in.read((char*)r->buf.data() + r->len, (streamsize)(r->buf.size() - r->len));
+        r->len += (size_t)r->in.gcount();
+    }
+    size_t p = r->pos;
+    auto varint = [&](uint32_t& v){
+        v = 0;
+        for(int shift = 0; shift < 35; shift += 7){
+            if(p >= r->len) return false;
+            uint8_t b = r->buf[p++];
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return false;
+    };
+    if(p >= r->len) return false;
+    uint8_t head = r->buf[p++];
+    a.type = head & 3;
+    if(a.type > ACCESS_WRITE) return false;
+    a.size = head >> 4;
+    uint32_t v;
+    if(!a.size && !varint(a.size)) return false;
+    if(!varint(v)) return false;
+    a.addr = r->prev_end[a.type] + unzigzag(v);
+    a.eip = r->prev_eip;
+    if(!(head & 4)){
+        if(!varint(v)) return false;
+        a.eip += unzigzag(v);
+    }
+    r->prev_end[a.type] = a.addr + a.size;
+    r->prev_eip = a.eip;
+    r->pos = p;
+    return true;
+}
+
+void islx86_close_access_trace(access_reader_t* r){
+    delete r;
+}
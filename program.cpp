@@ -0,0 +1,73 @@
+#include "islx86.h"
+
+#include <string>
+
+using namespace std;
+
+// Programs shared between machines. islx86_load_program parses mem.txt once into pages that are
+// never written again; islx86_map_program points a machine's page table at them, which costs one
+// pointer per page. The first change a machine makes to such a page (a store, a byte turning
+// present, translated code flagging it, a checkpoint put back over it) goes through unshare_page,
+// which swaps in a private copy; every other machine keeps seeing the program as loaded. Shared
+// pages are never dirty and never freed by free_pages, so checkpoints and snapshots only hold what
+// a run changed, and 1000 machines on one program take one image plus their own writes.
+
+//parses the file into a new program, the caller holds one reference
+program_t* islx86_load_program(const string& file_name){
+    machine_t* loader = islx86_create();
+    program_t* program = new program_t();
+    try{
+        init_mem(loader, file_name);
+    }
+    catch(...){
+        islx86_destroy(loader);
+        delete program;
+        throw;
+    }
+    for(const mem_span_t& span : islx86_mapped_pages(loader)){
+        page_t* page = mem_page_slow(loader, span.base >> PAGE_BITS, false);
+        page->dirty = false;
+        page->shared = true; //the loader machine no longer owns it
+        program->pages.push_back(page);
+    }
+    program->refs = 1;
+    islx86_destroy(loader);
+    return program;
+}
+
+//like islx86_load with the program's file, minus parsing and copying; the machine holds a reference until it loads something else
+void islx86_map_program(machine_t* m, program_t* program){
+    program->refs++; //before free_pages, which drops the reference to whatever was mapped (possibly this program)
+    islx86_unload_translation(m);
+    init_state(m);
+    free_pages(m);
+    m->image = nullptr;
+    for(page_t* page : program->pages){
+        page_t**& table = m->page_dir[page->page_num >> PT_BITS];
+        if(!table) table = new page_t*[PT_ENTRIES]();
+        table[page->page_num & (PT_ENTRIES - 1)] = page;
+    }
+    m->program = program;
+    map_device_pages(m);
+    if(m->fingerprint) fingerprint_rehash(m);
+}
+
+//drops one reference, the pages go with the last one
+void islx86_release_program(program_t* program){
+    if(!program || --program->refs > 0) return;
+    for(page_t* page : program->pages) delete page;
+    delete program;
+}
+
+//replaces a shared page in m's page table with a private copy, returns the copy (or the copy made earlier)
+page_t* unshare_page(machine_t* m, page_t* page){
+    page_t*& slot = m->page_dir[page->page_num >> PT_BITS][page->page_num & (PT_ENTRIES - 1)];
+    if(slot != page) return slot;
+    page_t* copy = new page_t(*page);
+    copy->shared = false;
+    slot = copy;
+    if(m->last_page == page) m->last_page = copy;
+    mark_dirty(m, copy);
+    m->pages_allocated++;
+    return copy;
+}
@@ -0,0 +1,117 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+uint64_t next_sample_gap(sampler_t* s){
+    if(!s->random) return s->interval;
+    //uniform over [1, 2*interval - 1] keeps the mean gap at interval
+    uniform_int_distribution<uint64_t> gap(1, 2 * s->interval - 1);
+    return gap(s->rng);
+}
+
+void islx86_start_sampling(machine_t* m, const string& path, uint64_t interval, bool random, uint64_t seed){
+    if(interval == 0) throw runtime_error("Sample interval must be at least 1");
+    islx86_stop_sampling(m);
+    sampler_t* s = new sampler_t();
+    s->interval = interval;
+    s->random = random;
+    s->rng.seed(seed);
+    s->samples = 0;
+    s->out.open(path, std::ios::out | std::ios::trunc);
+    if(!s->out.is_open()){
+        delete s;
+        throw runtime_error("Could not open " + path);
+    }
+    if(random) s->out << "# islx86 samples, random gaps with mean " << interval << ", seed " << seed << "\n";
+    else s->out << "# islx86 samples, every " << interval << " instructions\n";
+    s->out << "# cycles eip opcode | eax ecx edx ebx esp ebp esi edi | es cs ss ds fs gs | CPAZSDO | mm0-mm7 | watched bytes\n";
+    m->sampler = s;
+    m->sample_countdown = next_sample_gap(s);
+}
+
+//bytes [addr, addr+len) are appended to every sample line, in the order the watches were added
+void islx86_sample_watch(machine_t* m, uint32_t addr, uint32_t len){
+    if(!m->sampler) throw runtime_error("Sampling is not started");
+    m->sampler->watch.push_back({addr, len});
+}
+
+void take_sample(machine_t* m){
+    sampler_t* s = m->sampler;
+    if(!s){
+        m->sample_countdown = UINT64_MAX;
+        return;
+    }
+    const state_t& st = m->curr_state;
+    uint32_t eip = (uint32_t)st.EIP;
+    uint32_t cs_base = (uint32_t)((uint16_t)st.SEGR[CS]) << 16;
+
+    uint32_t op_addr = cs_base + eip;
+    uint32_t opcode = mem_peek(m, op_addr);
+    for(int i = 0; i < 14 && is_prefix((uint8_t)opcode); i++) opcode = mem_peek(m, ++op_addr);
+    if(opcode == 0x0F) opcode = 0x0F00 | mem_peek(m, op_addr + 1);
+    s->eip_hits[eip]++;
+    s->opcode_mix[opcode]++;
+    s->samples++;
+
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), "%llu %08x %0*x |", (unsigned long long)m->cycles, eip, opcode > 0xFF ? 4 : 2, opcode);
+    for(int i = 0; i < 8; i++) n += snprintf(buf + n, sizeof(buf) - n, " %x", (uint32_t)st.GPR[i]);
+    n += snprintf(buf + n, sizeof(buf) - n, " |");
+    for(int i = 0; i < 6; i++) n += snprintf(buf + n, sizeof(buf) - n, " %x", (uint16_t)st.SEGR[i]);
+    n += snprintf(buf + n, sizeof(buf) - n, " | ");
+    for(int i = 0; i < 7; i++) buf[n++] = st.FLAGS[i] ? '1' : '0';
+    n += snprintf(buf + n, sizeof(buf) - n, " |");
+    for(int i = 0; i < 8; i++) n += snprintf(buf + n, sizeof(buf) - n, " %llx", (unsigned long long)st.MMX[i]);
+    s->out.write(buf, n);
+
+    if(!s->watch.empty()){
+        s->out << " |";
+        for(const auto& w : s->watch){
+            s->out << ' ';
+            for(uint32_t i = 0; i < w.second; i++){
+                snprintf(buf, sizeof(buf), "%02x", mem_peek(m, w.first + i));
+                s->out << buf;
+            }
+        }
+    }
+    s->out << '\n';
+    m->sample_countdown = next_sample_gap(s);
+}
+
+//writes the hot EIP table and the sampled instruction mix, then closes the sample file
+void islx86_stop_sampling(machine_t* m){
+    sampler_t* s = m->sampler;
+    if(!s) return;
+
+    auto by_count = [](const pair<uint32_t, uint64_t>& a, const pair<uint32_t, uint64_t>& b){
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    };
+    vector<pair<uint32_t, uint64_t>> hot(s->eip_hits.begin(), s->eip_hits.end());
+    vector<pair<uint32_t, uint64_t>> mix(s->opcode_mix.begin(), s->opcode_mix.end());
+    sort(hot.begin(), hot.end(), by_count);
+    sort(mix.begin(), mix.end(), by_count);
+
+    char buf[128];
+    s->out << "# " << s->samples << " samples over " << m->cycles << " instructions\n";
+    s->out << "# hot EIPs (eip samples percent)\n";
+    for(size_t i = 0; i < hot.size() && i < 32; i++){
+        snprintf(buf, sizeof(buf), "# 0x%08x %llu %.1f%%\n", hot[i].first, (unsigned long long)hot[i].second,
+                 100.0 * hot[i].second / s->samples);
+        s->out << buf;
+    }
+    s->out << "# instruction mix (opcode samples percent)\n";
+    for(const auto& op : mix){
+        snprintf(buf, sizeof(buf), "# %0*x %llu %.1f%%\n", op.first > 0xFF ? 4 : 2, op.first, (unsigned long long)op.second,
+                 100.0 * op.second / s->samples);
+        s->out << buf;
+    }
+    delete s;
+    m->sampler = nullptr;
+    m->sample_countdown = UINT64_MAX;
+}
@@ -0,0 +1,240 @@
+#include "islx86.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// SimPoint style phase selection:
+//   1. run the program once, splitting it into fixed length intervals and counting how many
+//      instructions each basic block (ended by a branch, jump or HLT) ran in each interval
+//   2. randomly project every interval's block vector down to BBV_DIMS dimensions
+//   3. k-means the projected vectors for k = 1..max_k and keep the smallest k whose BIC score is
+//      within 90% of the best one
+//   4. the interval closest to each cluster centre is a simulation point, weighted by the share
+//      of all instructions its cluster covers, and gets a standalone checkpoint
+const int BBV_DIMS = 15;
+const int KMEANS_ITERATIONS = 100;
+
+typedef vector<double> point_t;
+
+double distance2(const point_t& a, const point_t& b){
+    double d = 0;
+    for(size_t i = 0; i < a.size(); i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+//same random direction for a block every time it is seen, derived from its start EIP
+point_t block_direction(uint32_t eip, uint64_t seed){
+    mt19937_64 rng(seed * 0x9E3779B97F4A7C15ull ^ eip);
+    uniform_real_distribution<double> uni(-1.0, 1.0);
+    point_t dir(BBV_DIMS);
+    for(int d = 0; d < BBV_DIMS; d++) dir[d] = uni(rng);
+    return dir;
+}
+
+//returns the cluster of every point, centres are left in centres
+vector<int> kmeans(const vector<point_t>& points, int k, mt19937_64& rng, vector<point_t>& centres){
+    size_t n = points.size();
+    //k-means++ seeding
+    centres.clear();
+    centres.push_back(points[uniform_int_distribution<size_t>(0, n - 1)(rng)]);
+    vector<double> best(n, numeric_limits<double>::max());
+    while((int)centres.size() < k){
+        double total = 0;
+        for(size_t i = 0; i < n; i++){
+            best[i] = min(best[i], distance2(points[i], centres.back()));
+            total += best[i];
+        }
+        if(total == 0){ //fewer distinct points than k
+            centres.push_back(centres.back());
+            continue;
+        }
+        double pick = uniform_real_distribution<double>(0, total)(rng);
+        size_t i = 0;
+        for(; i + 1 < n && pick > best[i]; i++) pick -= best[i];
+        centres.push_back(points[i]);
+    }
+
+    vector<int> cluster(n, -1);
+    for(int iter = 0; iter < KMEANS_ITERATIONS; iter++){
+        bool changed = false;
+        for(size_t i = 0; i < n; i++){
+            int closest = 0;
+            for(int c = 1; c < k; c++){
+                if(distance2(points[i], centres[c]) < distance2(points[i], centres[closest])) closest = c;
+            }
+            if(cluster[i] != closest){
+                cluster[i] = closest;
+                changed = true;
+            }
+        }
+        if(!changed) break;
+        vector<point_t> sums(k, point_t(BBV_DIMS, 0.0));
+        vector<size_t> sizes(k, 0);
+        for(size_t i = 0; i < n; i++){
+            sizes[cluster[i]]++;
+            for(int d = 0; d < BBV_DIMS; d++) sums[cluster[i]][d] += points[i][d];
+        }
+        for(int c = 0; c < k; c++){
+            if(!sizes[c]) continue; //empty cluster keeps its old centre
+            for(int d = 0; d < BBV_DIMS; d++) centres[c][d] = sums[c][d] / sizes[c];
+        }
+    }
+    return cluster;
+}
+
+//Bayesian information criterion of a clustering (Pelleg & Moore, X-means)
+double bic_score(const vector<point_t>& points, const vector<int>& cluster, const vector<point_t>& centres){
+    double R = (double)points.size();
+    double M = BBV_DIMS;
+    double k = (double)centres.size();
+    vector<double> sizes(centres.size(), 0.0);
+    double sse = 0;
+    for(size_t i = 0; i < points.size(); i++){
+        sizes[cluster[i]]++;
+        sse += distance2(points[i], centres[cluster[i]]);
+    }
+    double variance = R > k ? sse / (M * (R - k)) : 0;
+    if(variance < 1e-12) variance = 1e-12;
+
+    double loglik = 0;
+    for(double Rn : sizes){
+        if(Rn == 0) continue;
+        loglik += Rn * log(Rn) - Rn * log(R) - Rn * M / 2 * log(2 * M_PI * variance) - (Rn - 1) * M / 2;
+    }
+    double params = (k - 1) + M * k + 1;
+    return loglik - params / 2 * log(R);
+}
+
+vector<simpoint_t> islx86_simpoints(machine_t* m, uint64_t interval, int max_k, uint64_t seed, const string& prefix){
+    if(interval == 0) throw runtime_error("Interval length must be at least 1");
+    if(max_k < 1) max_k = 1;
+
+    //1. profile
+    vector<map<uint32_t, uint64_t>> bbvs;
+    vector<uint64_t> lengths;
+    vector<checkpoint_t*> chain;
+    map<uint32_t, uint64_t> current;
+    uint64_t length = 0, block_count = 0;
+    uint32_t block_start = (uint32_t)m->curr_state.EIP;
+
+    m->dumps_enabled = false;
+    while(m->run){
+        if(length == 0) chain.push_back(islx86_checkpoint(m));
+        islx86_step(m);
+        block_count++;
+        length++;
+        if(is_block_end(m->last_instr)){
+            current[block_start] += block_count;
+            block_count = 0;
+            block_start = (uint32_t)m->curr_state.EIP;
+        }
+        if(length == interval || !m->run){
+            if(block_count) current[block_start] += block_count;
+            block_count = 0;
+            bbvs.push_back(current);
+            lengths.push_back(length);
+            current.clear();
+            length = 0;
+        }
+    }
+    if(bbvs.empty()){
+        for(checkpoint_t* cp : chain) islx86_free_checkpoint(cp);
+        return {};
+    }
+
+    //block ids in first seen order for bbv.txt
+    map<uint32_t, size_t> block_ids;
+    ofstream bbv_out(prefix + "bbv.txt", std::ios::out | std::ios::trunc);
+    for(const auto& bbv : bbvs){
+        bbv_out << 'T';
+        for(const auto& b : bbv){
+            size_t id = block_ids.emplace(b.first, block_ids.size() + 1).first->second;
+            bbv_out << ':' << id << ':' << b.second << ' ';
+        }
+        bbv_out << '\n';
+    }
+
+    //2. random projection of the instruction normalised vectors
+    map<uint32_t, point_t> directions;
+    vector<point_t> points;
+    for(size_t i = 0; i < bbvs.size(); i++){
+        point_t p(BBV_DIMS, 0.0);
+        for(const auto& b : bbvs[i]){
+            auto dir = directions.find(b.first);
+            if(dir == directions.end()) dir = directions.emplace(b.first, block_direction(b.first, seed)).first;
+            double share = (double)b.second / lengths[i];
+            for(int d = 0; d < BBV_DIMS; d++) p[d] += share * dir->second[d];
+        }
+        points.push_back(p);
+    }
+
+    //3. k-means for every k, pick by BIC
+    mt19937_64 rng(seed);
+    int k_limit = (int)min<size_t>((size_t)max_k, points.size());
+    vector<vector<int>> clusterings;
+    vector<vector<point_t>> all_centres;
+    vector<double> scores;
+    for(int k = 1; k <= k_limit; k++){
+        vector<point_t> centres;
+        clusterings.push_back(kmeans(points, k, rng, centres));
+        all_centres.push_back(centres);
+        scores.push_back(bic_score(points, clusterings.back(), centres));
+    }
+    double lo = scores[0], hi = scores[0];
+    for(double s : scores){ lo = min(lo, s); hi = max(hi, s); }
+    size_t chosen = 0;
+    while(chosen + 1 < scores.size() && scores[chosen] < lo + 0.9 * (hi - lo)) chosen++;
+    const vector<int>& cluster = clusterings[chosen];
+    const vector<point_t>& centres = all_centres[chosen];
+
+    //4. representatives, weights and checkpoints
+    uint64_t total = 0;
+    for(uint64_t l : lengths) total += l;
+    vector<simpoint_t> simpoints;
+    for(size_t c = 0; c < centres.size(); c++){
+        size_t best = bbvs.size();
+        uint64_t covered = 0;
+        for(size_t i = 0; i < points.size(); i++){
+            if(cluster[i] != (int)c) continue;
+            covered += lengths[i];
+            if(best == bbvs.size() || distance2(points[i], centres[c]) < distance2(points[best], centres[c])) best = i;
+        }
+        if(best == bbvs.size()) continue; //empty cluster
+        simpoint_t sp;
+        sp.interval = best;
+        sp.start_cycle = chain[best]->cycles;
+        sp.weight = (double)covered / total;
+        sp.cluster = (int)c;
+        simpoints.push_back(sp);
+    }
+
+    ofstream sp_out(prefix + "simpoints.txt", std::ios::out | std::ios::trunc);
+    sp_out << "# " << bbvs.size() << " intervals of " << interval << " instructions, k = " << centres.size() << "\n";
+    sp_out << "# interval start_cycle weight cluster checkpoint\n";
+    for(const simpoint_t& sp : simpoints){
+        machine_t* w = islx86_create();
+        w->image = m->image;
+        if(m->program) islx86_map_program(w, m->program); //the chain only holds what the run changed
+        for(size_t c = 0; c <= sp.interval; c++) islx86_apply_checkpoint(w, chain[c]);
+        checkpoint_t* cp = islx86_full_checkpoint(w);
+        string ckpt_path = prefix + "simpoint." + to_string(sp.interval) + ".ckpt";
+        islx86_save_checkpoint(cp, ckpt_path);
+        islx86_free_checkpoint(cp);
+        islx86_destroy(w);
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6f", sp.weight);
+        sp_out << sp.interval << ' ' << sp.start_cycle << ' ' << buf << ' ' << sp.cluster << ' ' << ckpt_path << '\n';
+    }
+    for(checkpoint_t* cp : chain) islx86_free_checkpoint(cp);
+    return simpoints;
+}
@@ -0,0 +1,65 @@
+#include "islx86.h"
+
+#include <cstring>
+
+using namespace std;
+
+// Spin-loop fast-forward. A loop whose registers (EIP, GPRs, flags, segments, MMX) are the same
+// at its head as one iteration earlier, with no memory changed in between, repeats that iteration
+// forever: nothing inside the machine can ever make it exit. islx86_run_until then skips straight
+// to max_cycles, adding the skipped iterations to cycles (the state at the limit is exactly what
+// running them would have left), or returns HALT_SPIN when there is no limit. A pending timer event
+// is a limit too: the loop is only skipped up to it, and must not have moved it (reprogrammed the timer).
+// Every SPIN_CHECK_INTERVAL backward jumps the next loop head is recorded and compared on the
+// following backward jump to it. Only done while nothing watches single cycles (dumps, sampling,
+// access traces, fingerprints, call graphs, which would miss the skipped iterations' CALLs and RETs);
+// coverage is fine since a repeated iteration cannot add coverage.
+const uint32_t SPIN_CHECK_INTERVAL = 64;
+
+//the registers a repeated iteration must leave unchanged
+bool same_arch_state(const state_t& a, const state_t& b){
+    return a.EIP == b.EIP && !memcmp(a.GPR, b.GPR, sizeof(a.GPR)) && !memcmp(a.FLAGS, b.FLAGS, sizeof(a.FLAGS)) &&
+           !memcmp(a.SEGR, b.SEGR, sizeof(a.SEGR)) && !memcmp(a.MMX, b.MMX, sizeof(a.MMX)) && a.IF == b.IF;
+}
+
+void copy_arch_state(state_t& to, const state_t& from){
+    to.EIP = from.EIP;
+    memcpy(to.GPR, from.GPR, sizeof(to.GPR));
+    memcpy(to.FLAGS, from.FLAGS, sizeof(to.FLAGS));
+    memcpy(to.SEGR, from.SEGR, sizeof(to.SEGR));
+    memcpy(to.MMX, from.MMX, sizeof(to.MMX));
+    to.IF = from.IF;
+}
+
+void spin_reset(machine_t* m){
+    m->spin.armed = false;
+    m->spin.countdown = SPIN_CHECK_INTERVAL;
+}
+
+// Called by islx86_run_until after every backward jump (or translated block ending in one).
+// Returns true when the machine is caught in a loop it can never leave and max_cycles is unlimited.
+bool spin_check(machine_t* m, uint64_t max_cycles){
+    uint32_t pc = fetch_address(m->curr_state);
+    spin_t& s = m->spin;
+    if(!s.armed){
+        if(--s.countdown) return false;
+        s.armed = true;
+        s.head = pc;
+        s.cycles = m->cycles;
+        s.mem_version = m->mem_version;
+        s.next_event = m->next_event_cycle;
+        copy_arch_state(s.state, m->curr_state);
+        return false;
+    }
+    if(pc != s.head) return false; //an inner loop, keep waiting for the recorded head
+    if(s.mem_version != m->mem_version || s.next_event != m->next_event_cycle || !same_arch_state(s.state, m->curr_state)){
+        spin_reset(m);
+        return false;
+    }
+    uint64_t period = m->cycles - s.cycles;
+    spin_reset(m);
+    if(m->next_event_cycle < max_cycles) max_cycles = m->next_event_cycle; //a timer interrupt may still end the loop
+    if(max_cycles == UINT64_MAX) return true;
+    if(max_cycles > m->cycles) m->cycles += (max_cycles - m->cycles) / period * period;
+    return false;
+}
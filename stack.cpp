@@ -0,0 +1,157 @@
+#include "islx86.h"
+
+#include <cstring>
+
+using namespace std;
+
+// Stack instructions:
+//   PUSH POP r16/32         50-57, 58-5F
+//   PUSH imm                68 (imm16/32), 6A (imm8 sign extended)
+//   PUSH r/m, POP r/m       FF /6, 8F /0
+//   CALL rel, CALL r/m      E8 (rel16/32), FF /2
+//   RET, RET imm16          C3, C2
+//   ENTER imm16, imm8       C8
+//   LEAVE                   C9
+// The stack is SS:ESP (SS base like the other segments, ESP always 32 bit); 0x66 makes the pushed
+// and popped values 2 bytes and wraps CALL / RET targets to 16 bits like the jumps. POP r/m computes
+// an ESP based address after the pop, PUSH ESP pushes the value from before it.
+// Stack accesses have their own one entry page cache (machine_t::stack_page) next to the data one,
+// so a push or pop that stays inside the page SS:ESP was on last time is a memcpy on its bytes
+// instead of a page lookup and a byte loop. Shared, code and MMIO pages, page crossings, access
+// traces and fingerprints take the mem_read / mem_write path.
+
+uint32_t stack_address(const state_t& s){
+    return ((uint32_t)(uint16_t)s.SEGR[SS] << 16) + (uint32_t)s.GPR[ESP];
+}
+
+//host pointer to the size bytes at addr, marked present; null when the access has to go byte by byte
+uint8_t* stack_bytes(machine_t* m, uint32_t addr, int size, bool write){
+    uint32_t off = addr & PAGE_MASK;
+    if((off & 63) + size > 64 || m->access_trace || m->fingerprint) return nullptr; //also keeps it inside the page
+    uint32_t page_num = addr >> PAGE_BITS;
+    page_t* page = m->stack_page;
+    if(!page || page->page_num != page_num || page->shared){
+        page = mem_page_slow(m, page_num, true);
+        if(page->shared && write) page = unshare_page(m, page);
+        m->stack_page = page;
+    }
+    if(page->shared || page->code || page->mmio) return nullptr;
+    uint64_t mask = (((uint64_t)1 << size) - 1) << (off & 63);
+    uint64_t& present = page->present[off >> 6];
+    if((present & mask) != mask){
+        present |= mask;
+        m->mem_version++;
+        mark_dirty(m, page);
+    }
+    else if(write) mark_dirty(m, page);
+    return page->bytes + off;
+}
+
+void push_value(machine_t* m, state_t& s, uint32_t value, int size){
+    s.GPR[ESP] -= size;
+    uint32_t addr = stack_address(s);
+    uint8_t* p = stack_bytes(m, addr, size, true);
+    if(!p){
+        for(int i = 0; i < size; i++) mem_write(m, addr + i, (uint8_t)(value >> (8*i)));
+        return;
+    }
+    if(memcmp(p, &value, size)){
+        memcpy(p, &value, size);
+        m->mem_version++;
+    }
+}
+
+uint32_t pop_value(machine_t* m, state_t& s, int size){
+    uint32_t addr = stack_address(s), value = 0;
+    const uint8_t* p = stack_bytes(m, addr, size, false);
+    if(p) memcpy(&value, p, size);
+    else for(int i = 0; i < size; i++) value |= (uint32_t)mem_read(m, addr + i) << (8*i);
+    s.GPR[ESP] += size;
+    return value;
+}
+
+//opcodes execute_stack_op handles, modrm is the byte after the opcode (for 8F and FF)
+bool is_stack_op(uint8_t opcode, uint8_t modrm){
+    int reg = (modrm >> 3) & 7;
+    if(opcode >= 0x50 && opcode <= 0x5F) return true;
+    if(opcode == 0xFF) return reg == 2 || reg == 6;
+    if(opcode == 0x8F) return reg == 0;
+    return opcode == 0x68 || opcode == 0x6A || opcode == 0xE8 || opcode == 0xC2 || opcode == 0xC3 ||
+           opcode == 0xC8 || opcode == 0xC9;
+}
+
+void execute_stack_op(machine_t* m, uint8_t opcode, bool has_prefix_x66, int instr_len){
+    state_t& curr_state = m->curr_state;
+    state_t& next_state = m->next_state;
+    int len = instr_len;
+    int size = has_prefix_x66 ? 2 : 4;
+    uint32_t ip_mask = has_prefix_x66 ? 0xFFFF : 0xFFFFFFFF;
+    uint32_t cs_base = (uint32_t)(uint16_t)curr_state.SEGR[CS] << 16;
+    int reg_field = 0;
+    bool jumped = false;
+
+    if(opcode <= 0x57) push_value(m, next_state, get_reg(curr_state, opcode & 0x07, size), size);
+    else if(opcode <= 0x5F) set_reg(next_state, opcode & 0x07, size, pop_value(m, next_state, size)); //POP ESP keeps the popped value
+    else if(opcode == 0x68 || opcode == 0x6A){
+        uint32_t imm = (uint32_t)fetch_simm(m, len, opcode == 0x6A ? 1 : size);
+        push_value(m, next_state, imm, size);
+    }
+    else if(opcode == 0x8F){
+        uint32_t value = pop_value(m, next_state, size);
+        int32_t esp = curr_state.GPR[ESP];
+        curr_state.GPR[ESP] = next_state.GPR[ESP]; //the destination address sees ESP after the pop
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        curr_state.GPR[ESP] = esp;
+        write_operand(m, rm, value);
+    }
+    else if(opcode == 0xFF){
+        operand_t rm = decode_rm(m, len, size, reg_field);
+        uint32_t value = read_operand(m, rm);
+        uint32_t ret = (uint32_t)curr_state.EIP + len;
+        push_value(m, next_state, reg_field == 2 ? ret : value, size);
+        if(reg_field == 2){ //CALL r/m
+            next_state.EIP = (int32_t)(value & ip_mask);
+            jumped = true;
+            if(m->call_graph) call_graph_call(m, cs_base + (ret & ip_mask), cs_base + (value & ip_mask));
+        }
+    }
+    else if(opcode == 0xE8){
+        int32_t disp = fetch_simm(m, len, size);
+        uint32_t ret = (uint32_t)curr_state.EIP + len;
+        uint32_t target = (ret + disp) & ip_mask;
+        push_value(m, next_state, ret, size);
+        next_state.EIP = (int32_t)target;
+        jumped = true;
+        if(m->call_graph) call_graph_call(m, cs_base + (ret & ip_mask), cs_base + target);
+    }
+    else if(opcode == 0xC2 || opcode == 0xC3){
+        uint32_t release = opcode == 0xC2 ? (uint32_t)fetch_simm(m, len, 2) & 0xFFFF : 0;
+        uint32_t target = pop_value(m, next_state, size) & ip_mask;
+        next_state.GPR[ESP] += release;
+        next_state.EIP = (int32_t)target;
+        jumped = true;
+        if(m->call_graph) call_graph_return(m, cs_base + target);
+    }
+    else if(opcode == 0xC8){ //ENTER: push EBP, copy `level - 1` outer frame pointers, point EBP at the frame, reserve alloc bytes
+        uint32_t alloc = (uint32_t)fetch_simm(m, len, 2) & 0xFFFF;
+        int level = fetch_byte(m, len) & 0x1F;
+        push_value(m, next_state, get_reg(curr_state, EBP, size), size);
+        uint32_t frame = (uint32_t)next_state.GPR[ESP];
+        uint32_t bp = (uint32_t)curr_state.GPR[EBP]; //the stack is always 32 bit, so is the frame pointer walking it
+        uint32_t ss_base = (uint32_t)(uint16_t)curr_state.SEGR[SS] << 16;
+        for(int i = 1; i < level; i++){
+            bp -= size;
+            uint32_t outer = 0;
+            for(int b = 0; b < size; b++) outer |= (uint32_t)mem_read(m, ss_base + bp + b) << (8*b);
+            push_value(m, next_state, outer, size);
+        }
+        if(level > 0) push_value(m, next_state, frame, size);
+        next_state.GPR[EBP] = (int32_t)frame;
+        next_state.GPR[ESP] -= alloc;
+    }
+    else{ //LEAVE
+        next_state.GPR[ESP] = curr_state.GPR[EBP];
+        set_reg(next_state, EBP, size, pop_value(m, next_state, size));
+    }
+    if(!jumped) next_state.EIP = curr_state.EIP + len;
+}
@@ -0,0 +1,185 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// String instructions: MOVS (A4/A5), CMPS (A6/A7), STOS (AA/AB), LODS (AC/AD), SCAS (AE/AF).
+// The source is DS:ESI and the destination ES:EDI. Elements are 1 byte (even opcodes), 2 bytes
+// with 0x66 or 4 bytes, and ESI/EDI move forward, or backward when DF is set.
+// With F3 (REP/REPE) or F2 (REPNE), ECX counts the elements. CMPS/SCAS also stop on ZF: REPE
+// stops at the first difference, REPNE at the first match.
+// A REP instruction runs at most REP_CHUNK elements per step and leaves EIP on itself until it is
+// done, like an interrupted REP on real hardware. That way breakpoints, cycle limits and the
+// per-cycle dumps keep working. Runs that stay inside one guest page on each side (and do not
+// overlap, for MOVS) work straight on page storage; everything else goes one element at a time.
+const uint32_t REP_CHUNK = 4096;
+
+//sets the present bits of [off, off + len) in one page, dirtying it if that changed anything (or on writes);
+//a shared program page is swapped for the machine's private copy first if its bits change
+void mark_present(machine_t* m, page_t*& page, uint32_t off, uint32_t len, bool write){
+    if(m->access_trace) trace_access(m, write ? ACCESS_WRITE : ACCESS_READ, (page->page_num << PAGE_BITS) | off, len);
+    if(m->fingerprint && !write) fingerprint_range(m, page, off, len, false); //writers take their old bytes out before storing
+    bool changed = false;
+    for(uint32_t o = off, end = off + len; o < end; ){
+        uint32_t bit = o & 63;
+        uint32_t n = min(64 - bit, end - o);
+        uint64_t mask = (n == 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1)) << bit;
+        if((page->present[o >> 6] & mask) != mask){
+            if(page->shared) page = unshare_page(m, page);
+            page->present[o >> 6] |= mask;
+            changed = true;
+        }
+        o += n;
+    }
+    if(changed || write){
+        mark_dirty(m, page);
+        m->mem_version++;
+    }
+    if(m->fingerprint) fingerprint_range(m, page, off, len, true);
+    if(write) revalidate_code_page(m, page);
+}
+
+uint32_t read_elem(machine_t* m, uint32_t addr, int size){
+    uint32_t value = 0;
+    for(int i = 0; i < size; i++) value |= (uint32_t)mem_read(m, addr + i) << (8*i);
+    return value;
+}
+
+void write_elem(machine_t* m, uint32_t addr, int size, uint32_t value){
+    for(int i = 0; i < size; i++) mem_write(m, addr + i, (uint8_t)(value >> (8*i)));
+}
+
+inline uint32_t load_elem(const uint8_t* p, int size){
+    uint32_t value = 0;
+    memcpy(&value, p, size);
+    return value;
+}
+
+//elements starting at addr (and going the way of step) that lie whole inside addr's page
+inline uint32_t elems_in_page(uint32_t addr, int32_t step){
+    uint32_t off = addr & PAGE_MASK;
+    int size = step < 0 ? -step : step;
+    uint32_t bytes = step > 0 ? PAGE_SIZE - off : off + size;
+    if(step < 0 && off + size > PAGE_SIZE) return 0;
+    return bytes / size;
+}
+
+//page offset of the lowest byte of a run of k elements starting at addr
+inline uint32_t run_low(uint32_t addr, int32_t step, uint32_t k){
+    return (addr & PAGE_MASK) - (step < 0 ? (k - 1) * (uint32_t)(-step) : 0);
+}
+
+// CMPS/SCAS scan: index of the first element pair that ends a REPE/REPNE run, k if none does.
+// a (stride a_step) against b, or against the constant value when a is null
+uint32_t scan_elems(const uint8_t* a, int32_t a_step, uint32_t value, const uint8_t* b, int32_t b_step,
+                    uint32_t k, int size, bool until_equal){
+    if(!a && size == 1 && until_equal && b_step == 1){ //REPNE SCASB: memchr
+        const void* hit = memchr(b, (int)(value & 0xFF), k);
+        return hit ? (uint32_t)((const uint8_t*)hit - b) : k;
+    }
+    for(uint32_t i = 0; i < k; i++){
+        uint32_t x = a ? load_elem(a + (int64_t)i * a_step, size) : value;
+        uint32_t y = load_elem(b + (int64_t)i * b_step, size);
+        if((x == y) == until_equal) return i;
+    }
+    return k;
+}
+
+//called by fetch_and_execute with the string opcode, its REP prefix (0, 0xF2 or 0xF3) and the instruction length
+void execute_string_op(machine_t* m, uint8_t opcode, uint8_t rep, bool has_prefix_x66, int instr_len){
+    state_t& s = m->next_state;
+    uint32_t DS_BASE = (uint32_t)((uint16_t)s.SEGR[DS]) << 16;
+    uint32_t ES_BASE = (uint32_t)((uint16_t)s.SEGR[ES]) << 16;
+    int size = (opcode & 0x01) ? (has_prefix_x66 ? 2 : 4) : 1;
+    uint32_t size_mask = size == 4 ? 0xFFFFFFFF : ((1u << (8*size)) - 1);
+    int32_t step = s.FLAGS[DF] ? -size : size;
+    uint8_t op = opcode & 0xFE;
+    bool compares = op == 0xA6 || op == 0xAE;
+    bool uses_src = op == 0xA4 || op == 0xA6 || op == 0xAC;
+    bool uses_dst = op != 0xAC;
+    bool until_equal = rep == 0xF2; //REPNE
+
+    uint32_t todo = rep ? min((uint32_t)s.GPR[ECX], REP_CHUNK) : 1;
+    uint32_t done = 0;
+    bool stopped = false; //REPE/REPNE condition ended the run
+    while(done < todo && !stopped){
+        uint32_t src = DS_BASE + (uint32_t)s.GPR[ESI];
+        uint32_t dst = ES_BASE + (uint32_t)s.GPR[EDI];
+        uint32_t k = todo - done;
+        if(uses_src) k = min(k, elems_in_page(src, step));
+        if(uses_dst) k = min(k, elems_in_page(dst, step));
+        page_t* src_page = uses_src && k >= 2 ? mem_page(m, src) : nullptr;
+        page_t* dst_page = uses_dst && k >= 2 ? mem_page(m, dst) : nullptr;
+        uint32_t src_lo = run_low(src, step, k), dst_lo = run_low(dst, step, k);
+        if(op == 0xA4 && k >= 2 && src_page == dst_page && src_lo < dst_lo + k * size && dst_lo < src_lo + k * size){
+            k = 1; //overlapping MOVS repeats patterns, leave that to the element path
+        }
+        if((src_page && src_page->mmio) || (dst_page && dst_page->mmio)) k = 1; //device registers see every access
+
+        uint32_t n = 1; //elements this pass
+        if(k < 2){
+            uint32_t a = 0, b = 0;
+            switch(op){
+                case 0xA4: write_elem(m, dst, size, read_elem(m, src, size)); break;
+                case 0xAA: write_elem(m, dst, size, (uint32_t)s.GPR[EAX]); break;
+                case 0xAC: s.GPR[EAX] = (int32_t)(((uint32_t)s.GPR[EAX] & ~size_mask) | read_elem(m, src, size)); break;
+                case 0xA6: a = read_elem(m, src, size); b = read_elem(m, dst, size); break;
+                case 0xAE: a = (uint32_t)s.GPR[EAX] & size_mask; b = read_elem(m, dst, size); break;
+            }
+            if(compares){
+                update_flags_sub(s, a, b, 8*size);
+                stopped = rep && (a == b) == until_equal;
+            }
+        }
+        else{
+            n = k;
+            switch(op){
+                case 0xA4:
+                    mark_present(m, src_page, src_lo, k * size, false);
+                    if(dst_page->shared) dst_page = unshare_page(m, dst_page);
+                    if(m->fingerprint) fingerprint_range(m, dst_page, dst_lo, k * size, false);
+                    memcpy(dst_page->bytes + dst_lo, src_page->bytes + src_lo, k * size);
+                    mark_present(m, dst_page, dst_lo, k * size, true);
+                    break;
+                case 0xAA:
+                    if(dst_page->shared) dst_page = unshare_page(m, dst_page);
+                    if(m->fingerprint) fingerprint_range(m, dst_page, dst_lo, k * size, false);
+                    if(size == 1) memset(dst_page->bytes + dst_lo, s.GPR[EAX] & 0xFF, k);
+                    else for(uint32_t i = 0; i < k; i++) memcpy(dst_page->bytes + dst_lo + i * size, &s.GPR[EAX], size);
+                    mark_present(m, dst_page, dst_lo, k * size, true);
+                    break;
+                case 0xAC: //only the last element read survives in EAX
+                    mark_present(m, src_page, src_lo, k * size, false);
+                    s.GPR[EAX] = (int32_t)(((uint32_t)s.GPR[EAX] & ~size_mask) |
+                                           load_elem(src_page->bytes + (src & PAGE_MASK) + (int64_t)(k - 1) * step, size));
+                    break;
+                case 0xA6:
+                case 0xAE:
+                    {
+                        const uint8_t* a = op == 0xA6 ? src_page->bytes + (src & PAGE_MASK) : nullptr;
+                        const uint8_t* b = dst_page->bytes + (dst & PAGE_MASK);
+                        uint32_t value = (uint32_t)s.GPR[EAX] & size_mask;
+                        uint32_t hit = scan_elems(a, step, value, b, step, k, size, until_equal);
+                        n = hit < k ? hit + 1 : k;
+                        stopped = hit < k;
+                        //only what was actually compared gets marked present
+                        uint32_t last = n - 1;
+                        if(a) mark_present(m, src_page, run_low(src, step, n), n * size, false);
+                        mark_present(m, dst_page, run_low(dst, step, n), n * size, false);
+                        update_flags_sub(s, a ? load_elem(a + (int64_t)last * step, size) : value,
+                                         load_elem(b + (int64_t)last * step, size), 8*size);
+                    }
+                    break;
+            }
+        }
+        if(uses_src) s.GPR[ESI] += (int32_t)n * step;
+        if(uses_dst) s.GPR[EDI] += (int32_t)n * step;
+        done += n;
+    }
+
+    if(rep) s.GPR[ECX] -= (int32_t)done;
+    bool finished = !rep || s.GPR[ECX] == 0 || stopped;
+    s.EIP = m->curr_state.EIP + (finished ? instr_len : 0);
+}
@@ -0,0 +1,194 @@
+#include "islx86.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Parameter sweeps. Every patch set runs on a machine mapping the shared program (program.cpp),
+// so a variant costs the pages it writes, not a copy of the image. Patch tables look like
+//   # name   patches
+//   base
+//   big      EAX=0x1000 ECX=200 cycles=50000
+//   buf      0x2000=01020304 ZF=1 MM0=0xffff
+// Registers: EIP, the 32 bit GPRs, segment registers, MM0-MM7 and flags (CF PF AF ZF SF DF OF),
+// values decimal or 0x hex. 0xADDR=bytes stores the hex bytes from ADDR on, after the registers.
+static const char* SWEEP_GPR[8] = {"EAX","ECX","EDX","EBX","ESP","EBP","ESI","EDI"};
+static const char* SWEEP_SEGR[6] = {"ES","CS","SS","DS","FS","GS"};
+static const char* SWEEP_FLAG[7] = {"CF","PF","AF","ZF","SF","DF","OF"};
+
+//register kind and index for a name, false if it is none
+bool find_reg(const string& name, int& kind, int& idx){
+    if(name == "EIP"){ kind = REG_EIP; idx = 0; return true; }
+    for(idx = 0; idx < 8; idx++) if(name == SWEEP_GPR[idx]){ kind = REG_GPR; return true; }
+    for(idx = 0; idx < 6; idx++) if(name == SWEEP_SEGR[idx]){ kind = REG_SEGR; return true; }
+    for(idx = 0; idx < 7; idx++) if(name == SWEEP_FLAG[idx]){ kind = REG_FLAG; return true; }
+    if(name.size() == 3 && name.compare(0, 2, "MM") == 0 && name[2] >= '0' && name[2] <= '7'){
+        kind = REG_MMX;
+        idx = name[2] - '0';
+        return true;
+    }
+    return false;
+}
+
+//decimal, or hex with 0x (no octal surprises from leading zeros)
+uint64_t parse_patch_value(const string& value){
+    size_t used = 0;
+    bool hex = value.size() > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X');
+    uint64_t v = stoull(value, &used, hex ? 16 : 10);
+    if(used != value.size()) throw runtime_error("bad number");
+    return v;
+}
+
+vector<patch_set_t> islx86_load_patch_sets(const string& path){
+    ifstream in(path);
+    if(!in.is_open()) throw runtime_error("Could not open " + path);
+    vector<patch_set_t> sets;
+    string line;
+    for(int line_num = 1; getline(in, line); line_num++){
+        istringstream fields(line);
+        patch_set_t p;
+        if(!(fields >> p.name) || p.name[0] == '#') continue;
+        p.max_cycles = 0;
+        string patch;
+        while(fields >> patch){
+            size_t eq = patch.find('=');
+            string key = patch.substr(0, eq), value = eq == string::npos ? "" : patch.substr(eq + 1);
+            string where = path + " line " + to_string(line_num) + ": " + patch;
+            if(eq == string::npos || value.empty()) throw runtime_error("Bad patch in " + where);
+            transform(key.begin(), key.end(), key.begin(), [](unsigned char c){ return (char)toupper(c); });
+            try{
+                int kind, idx;
+                if(key == "CYCLES") p.max_cycles = parse_patch_value(value);
+                else if(find_reg(key, kind, idx)) p.regs.push_back({kind, idx, parse_patch_value(value)});
+                else if(key.compare(0, 2, "0X") == 0){
+                    if(value.size() % 2) throw runtime_error("odd number of hex digits");
+                    vector<uint8_t> bytes;
+                    for(size_t i = 0; i < value.size(); i += 2) bytes.push_back((uint8_t)stoul(value.substr(i, 2), nullptr, 16));
+                    p.mem.push_back({(uint32_t)stoul(key, nullptr, 16), bytes});
+                }
+                else throw runtime_error("unknown register");
+            }
+            catch(const exception& e){
+                throw runtime_error("Bad patch in " + where + " (" + e.what() + ")");
+            }
+        }
+        sets.push_back(p);
+    }
+    return sets;
+}
+
+//registers first, then memory, on a freshly loaded or mapped machine
+void islx86_apply_patch_set(machine_t* m, const patch_set_t& patch){
+    for(const reg_patch_t& r : patch.regs) islx86_write_reg(m, r.kind, r.idx, r.value);
+    for(const auto& w : patch.mem) islx86_load_bytes(m, w.first, w.second.data(), w.second.size());
+}
+
+//final state of a variant, the watched bytes read from its machine
+void record_sweep_result(machine_t* m, int halt_reason, const vector<pair<uint32_t, uint32_t>>& watch, sweep_result_t& r){
+    r.halt_reason = halt_reason;
+    r.cycles = m->cycles;
+    r.state = m->curr_state;
+    r.state.INSTR.clear();
+    for(const auto& range : watch){
+        for(uint32_t a = 0; a < range.second; a++) r.watched.push_back(mem_peek(m, range.first + a));
+    }
+}
+
+//runs every patch set on `threads` workers, results in the order of the patch sets; max_cycles 0 means no limit.
+//With lanes > 1 (and AVX2) each worker runs `lanes` patch sets at a time in a lockstep engine (lockstep.cpp).
+vector<sweep_result_t> islx86_sweep(program_t* program, const vector<patch_set_t>& patches,
+                                    const vector<pair<uint32_t, uint32_t>>& watch, uint64_t max_cycles, int threads, int lanes){
+    if(threads < 1) threads = 1;
+    if(lanes > 1 && !islx86_lockstep_supported()) lanes = 1;
+    vector<sweep_result_t> results(patches.size());
+    atomic<size_t> next_set(0);
+    auto limit_of = [&](const patch_set_t& p){
+        uint64_t limit = p.max_cycles ? p.max_cycles : max_cycles;
+        return limit ? limit : UINT64_MAX;
+    };
+    auto worker = [&](){
+        machine_t* w = islx86_create();
+        islx86_set_callbacks(w, {nullptr, nullptr, nullptr}); //one line per variant in the table instead
+        for(size_t i = next_set++; i < patches.size(); i = next_set++){
+            islx86_map_program(w, program); //drops the previous variant's private pages
+            islx86_apply_patch_set(w, patches[i]);
+            record_sweep_result(w, islx86_run_until(w, NO_STOP_EIP, limit_of(patches[i])), watch, results[i]);
+        }
+        islx86_destroy(w);
+    };
+    auto lockstep_worker = [&](){
+        lockstep_t* ls = islx86_create_lockstep(program, lanes);
+        vector<uint64_t> limits;
+        for(size_t first = next_set.fetch_add(lanes); first < patches.size(); first = next_set.fetch_add(lanes)){
+            size_t n = min((size_t)lanes, patches.size() - first);
+            limits.clear();
+            for(size_t j = 0; j < n; j++){
+                islx86_map_program(ls->machines[j], program);
+                islx86_apply_patch_set(ls->machines[j], patches[first + j]);
+                limits.push_back(limit_of(patches[first + j]));
+            }
+            const vector<int>& reasons = islx86_run_lockstep(ls, limits);
+            for(size_t j = 0; j < n; j++) record_sweep_result(ls->machines[j], reasons[j], watch, results[first + j]);
+        }
+        islx86_destroy_lockstep(ls);
+    };
+    vector<thread> pool;
+    for(int t = 0; t < threads; t++){
+        if(lanes > 1) pool.emplace_back(lockstep_worker);
+        else pool.emplace_back(worker);
+    }
+    for(thread& t : pool) t.join();
+    return results;
+}
+
+//one line per patch set, laid out like sample.dump lines
+void islx86_write_sweep(const string& path, const vector<patch_set_t>& patches, const vector<pair<uint32_t, uint32_t>>& watch,
+                        const vector<sweep_result_t>& results){
+    ofstream out(path, std::ios::out | std::ios::trunc);
+    if(!out.is_open()) throw runtime_error("Could not open " + path);
+    out << "# name halt cycles eip | eax ecx edx ebx esp ebp esi edi | es cs ss ds fs gs | CPAZSDO | mm0-mm7";
+    if(!watch.empty()){
+        out << " |";
+        for(const auto& w : watch){
+            char range[32];
+            snprintf(range, sizeof(range), " %x:%u", w.first, w.second);
+            out << range;
+        }
+    }
+    out << '\n';
+    char buf[512];
+    for(size_t i = 0; i < results.size(); i++){
+        const sweep_result_t& r = results[i];
+        const state_t& st = r.state;
+        out << patches[i].name << ' ' << islx86_halt_name(r.halt_reason);
+        int n = snprintf(buf, sizeof(buf), " %llu %08x |", (unsigned long long)r.cycles, (uint32_t)st.EIP);
+        for(int g = 0; g < 8; g++) n += snprintf(buf + n, sizeof(buf) - n, " %x", (uint32_t)st.GPR[g]);
+        n += snprintf(buf + n, sizeof(buf) - n, " |");
+        for(int g = 0; g < 6; g++) n += snprintf(buf + n, sizeof(buf) - n, " %x", (uint16_t)st.SEGR[g]);
+        n += snprintf(buf + n, sizeof(buf) - n, " | ");
+        for(int f = 0; f < 7; f++) buf[n++] = st.FLAGS[f] ? '1' : '0';
+        n += snprintf(buf + n, sizeof(buf) - n, " |");
+        for(int g = 0; g < 8; g++) n += snprintf(buf + n, sizeof(buf) - n, " %llx", (unsigned long long)st.MMX[g]);
+        out.write(buf, n);
+        if(!watch.empty()){
+            out << " |";
+            size_t at = 0;
+            for(const auto& w : watch){
+                out << ' ';
+                for(uint32_t b = 0; b < w.second; b++, at++){
+                    snprintf(buf, sizeof(buf), "%02x", r.watched[at]);
+                    out << buf;
+                }
+            }
+        }
+        out << '\n';
+    }
+}
@@ -0,0 +1,782 @@
+#include "islx86.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+using namespace std;
+
+// Ahead of time translation. islx86_translate walks the code reachable from the current CS:EIP
+// (Jcc / JMP / LOOP / CALL targets, JMP ptr16:32, fall-throughs), cuts it into basic blocks and writes C++
+// with one function per block, which the host compiler turns into a shared object.
+// The ADD, ALU, XCHG and branch instructions are translated with exactly the interpreter's semantics
+// (flag quirks included). Everything else (MOVQ, MOV Sreg, CMPXCHG, strings, HLT, INT / IRET, CLI / STI,
+// IN / OUT, the stack instructions) ends a block and runs in the interpreter, as does code only reached
+// indirectly (CALL r/m targets) or whose bytes were not loaded yet.
+// A block only runs while its bytes still match memory: stores into translated code drop the blocks
+// they hit, and pages put back in bulk (checkpoints, fuzz resets) have their blocks checked again.
+// Blocks retire all their instructions at once, so islx86_run_until only uses them while nothing
+// looks at single steps (same rule as branch fusion) and stop_eip / max_cycles / the next timer
+// event are not inside one.
+const uint32_t AOT_VERSION = 1;
+const int MAX_BLOCK_INSTRS = 64;
+
+typedef struct{
+    uint16_t cs;
+    uint32_t eip, exit_eip; //exit_eip: where execution goes on when the block does not end in a branch
+    vector<insn_t> insns;
+    vector<uint8_t> code;
+}block_t;
+
+string strf(const char* fmt, ...){
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return buf;
+}
+
+//code byte at a linear address, false unless the loader or the guest put it there
+bool code_byte(machine_t* m, uint32_t addr, uint8_t& b){
+    page_t* page = mem_page_slow(m, addr >> PAGE_BITS, false);
+    uint32_t off = addr & PAGE_MASK;
+    if(!page || !((page->present[off >> 6] >> (off & 63)) & 1)) return false;
+    b = page->bytes[off];
+    return true;
+}
+
+//decodes the instruction at CS:eip the way fetch_and_execute dispatches it, false if a byte of it is missing
+bool decode_insn(machine_t* m, uint32_t cs_base, uint32_t eip, insn_t& in){
+    int len = 0;
+    bool ok = true;
+    auto next = [&](){
+        uint8_t b = 0;
+        if(!code_byte(m, cs_base + eip + len, b)) ok = false;
+        len++;
+        return b;
+    };
+    auto uimm = [&](int bytes){
+        uint32_t value = 0;
+        for(int i = 0; i < bytes; i++) value |= (uint32_t)next() << (8*i);
+        return value;
+    };
+    auto simm = [&](int bytes){
+        uint32_t value = uimm(bytes);
+        if(bytes == 1) return (uint32_t)(int8_t)value;
+        if(bytes == 2) return (uint32_t)(int16_t)value;
+        return value;
+    };
+    auto rm = [&](){ //ModRM, SIB, displacement
+        in.modrm = get_modrm_byte(next());
+        if(in.modrm.mod == 3) return;
+        if(!in.a16 && in.modrm.r_m == 4) in.sib = get_modrm_byte(next());
+        in.disp = (int32_t)simm(ea_disp_bytes(in.modrm, in.sib, in.a16));
+    };
+
+    in = insn_t();
+    in.eip = eip;
+    in.falls_through = true;
+    uint8_t op = next();
+    while(is_prefix(op) && len < 15){
+        if(op == 0x66) in.o16 = true;
+        if(op == 0x67) in.a16 = true;
+        op = next();
+    }
+    in.op = op;
+    int full_size = in.o16 ? 2 : 4;
+    bool w_bit = op & 0x01, s_bit = op & 0x02;
+
+    if(is_alu_opcode(op, mem_peek(m, cs_base + eip + len))){
+        in.kind = INSN_ALU;
+        int size = w_bit ? full_size : 1;
+        if(op < 0x40 && (op & 0x07) <= 3) rm();
+        else if(op < 0x40 || op == 0xA8 || op == 0xA9) in.imm = simm(size);
+        else if(op <= 0x4F){}
+        else if(op == 0x80 || op == 0x81 || op == 0x83){
+            rm();
+            in.imm = simm(op == 0x81 ? size : 1);
+        }
+        else if(op == 0xF6 || op == 0xF7){
+            rm();
+            in.imm = simm(size);
+        }
+        else rm(); //84 85 FE FF
+    }
+    else if((op >= 0x70 && op <= 0x7F) || (op >= 0xE0 && op <= 0xE3) || op == 0xE9 || op == 0xEB){
+        uint32_t disp = simm(op == 0xE9 ? full_size : 1);
+        in.kind = (op == 0xE9 || op == 0xEB) ? INSN_JMP : (op >= 0xE0 ? INSN_LOOP : INSN_JCC);
+        in.target = eip + len + disp;
+        if(in.o16) in.target &= 0xFFFF;
+        in.falls_through = in.kind != INSN_JMP;
+    }
+    else if(op == 0x04 || op == 0x05){
+        in.kind = INSN_ADD;
+        in.imm = uimm(in.o16 ? 2 : (w_bit ? 4 : 1));
+    }
+    else if(op == 0x80 || op == 0x81 || op == 0x83){
+        in.kind = INSN_ADD;
+        rm();
+        if(in.o16 || w_bit) in.imm = s_bit ? simm(1) : uimm(in.o16 ? 2 : 4);
+        else in.imm = uimm(1);
+    }
+    else if(op <= 0x03){
+        in.kind = INSN_ADD;
+        rm();
+    }
+    else if(op == 0x0F){
+        in.op = next();
+        if((in.op & 0xF0) == 0x80){
+            in.kind = INSN_JCC;
+            uint32_t disp = simm(full_size);
+            in.target = eip + len + disp;
+            if(in.o16) in.target &= 0xFFFF;
+        }
+        else{ //CMPXCHG, MOVQ
+            in.kind = INSN_INTERP;
+            rm();
+        }
+    }
+    else if(op == 0x8E){
+        in.kind = INSN_INTERP;
+        rm();
+        in.falls_through = in.modrm.reg != CS; //continues in a segment only known at run time
+    }
+    else if(op == 0x86){
+        in.kind = INSN_XCHG;
+        rm();
+    }
+    else if(op == 0xEA){
+        in.kind = INSN_JMPFAR;
+        in.target = uimm(4);
+        in.sel = (uint16_t)uimm(2);
+        in.falls_through = false;
+    }
+    else if(op >= 0xA4 && op <= 0xAF) in.kind = INSN_INTERP; //strings (A8/A9 are TEST, above)
+    else if(is_system_op(op, 0) || op == 0xF4){ //INT, IRET, CLI, STI, IN, OUT, HLT (which may idle and go on)
+        in.kind = INSN_INTERP;
+        if(op == 0xCD || (op >= 0xE4 && op <= 0xE7)) uimm(1);
+        in.falls_through = op != 0xCF;
+    }
+    else if(is_stack_op(op, mem_peek(m, cs_base + eip + len))){ //PUSH, POP, CALL, RET, ENTER, LEAVE
+        in.kind = INSN_INTERP;
+        if(op == 0x68 || op == 0x6A) uimm(op == 0x6A ? 1 : full_size);
+        else if(op == 0xC2) uimm(2);
+        else if(op == 0xC8) uimm(3);
+        else if(op == 0x8F || op == 0xFF) rm();
+        else if(op == 0xE8){
+            uint32_t disp = simm(full_size);
+            in.target = eip + len + disp;
+            if(in.o16) in.target &= 0xFFFF;
+        }
+        in.falls_through = op != 0xC2 && op != 0xC3; //a CALL's return lands behind it
+    }
+    else{ //unimplemented opcodes
+        in.kind = INSN_INTERP;
+        in.falls_through = false;
+    }
+    in.len = len;
+    return ok;
+}
+
+uint64_t block_key(uint32_t cs, uint32_t eip){
+    return ((uint64_t)cs << 32) | eip;
+}
+
+//the translated blocks reachable from start_cs:start_eip
+vector<block_t> find_blocks(machine_t* m, uint16_t start_cs, uint32_t start_eip){
+    vector<block_t> blocks;
+    set<uint64_t> seen;
+    deque<uint64_t> work(1, block_key(start_cs, start_eip));
+    while(!work.empty()){
+        uint64_t key = work.front();
+        work.pop_front();
+        if(!seen.insert(key).second) continue;
+        block_t b;
+        b.cs = (uint16_t)(key >> 32);
+        b.eip = (uint32_t)key;
+        uint32_t cs_base = (uint32_t)b.cs << 16;
+        uint32_t eip = b.eip;
+        while(true){
+            insn_t in;
+            if(!decode_insn(m, cs_base, eip, in)) break;
+            if(in.kind == INSN_INTERP){
+                if(in.falls_through) work.push_back(block_key(b.cs, eip + in.len));
+                if(in.op == 0xE8) work.push_back(block_key(b.cs, in.target)); //CALL rel
+                break;
+            }
+            b.insns.push_back(in);
+            eip += in.len;
+            if(in.kind == INSN_JMPFAR){
+                work.push_back(block_key(in.sel, in.target));
+                break;
+            }
+            if(in.kind == INSN_JCC || in.kind == INSN_JMP || in.kind == INSN_LOOP){
+                work.push_back(block_key(b.cs, in.target));
+                if(in.falls_through) work.push_back(block_key(b.cs, eip));
+                break;
+            }
+            if(b.insns.size() == MAX_BLOCK_INSTRS){
+                work.push_back(block_key(b.cs, eip));
+                break;
+            }
+        }
+        if(b.insns.empty()) continue;
+        b.exit_eip = eip;
+        for(uint32_t a = b.eip; a != eip; a++) b.code.push_back(mem_peek(m, cs_base + a));
+        blocks.push_back(b);
+    }
+    return blocks;
+}
+
+// Everything the generated source needs. The context and block table mirror aot_ctx_t and
+// aot_block_t in islx86.h; the flag helpers are copies of the interpreter's.
+static const char* AOT_PRELUDE = R"(#include <cstdint>
+
+typedef struct{
+    int32_t* GPR;
+    bool* FLAGS;
+    int16_t* SEGR;
+    int32_t* EIP;
+    void* m;
+    uint8_t (*read8)(void* m, uint32_t addr);
+    void (*write8)(void* m, uint32_t addr, uint8_t value);
+    bool code_written;
+}aot_ctx_t;
+
+typedef struct{
+    uint32_t cs, eip;
+    uint32_t instrs, size;
+    const uint8_t* code;
+    uint32_t (*fn)(aot_ctx_t* c);
+}aot_block_t;
+
+enum { CF, PF, AF, ZF, SF, DF, OF };
+
+static inline bool parity(int num, int num_bits){
+    num &= 0x0FF;
+    while(num_bits > 1){
+        num ^= num >> (num_bits/2);
+        num_bits /= 2;
+    }
+    return !(num & 0x00000001);
+}
+
+static inline void add_flags(bool* F, int operand1, int operand2, int num_bits){
+    int64_t sum = (operand1 & 0x0FFFFFFFF) + (operand1 & 0x0FFFFFFFF);
+    int sign_mask = 1 << (num_bits - 1);
+    F[CF] = (sum >> num_bits) & 0x01;
+    F[PF] = parity(sum, 8);
+    F[AF] = (((operand1 & 0x0F) + (operand2 & 0x0F)) & 0x10) != 0;
+    F[ZF] = sum == 0;
+    F[SF] = (sum & sign_mask) != 0;
+    F[OF] = (((operand1 ^ operand2) & sign_mask) == 0) && (((operand1 ^ sum) & sign_mask) != 0);
+}
+
+static inline void sub_flags(bool* F, uint32_t operand1, uint32_t operand2, int num_bits){
+    uint64_t mask = num_bits == 32 ? 0xFFFFFFFFull : ((1ull << num_bits) - 1);
+    uint64_t a = operand1 & mask, b = operand2 & mask;
+    uint64_t diff = (a - b) & mask;
+    uint64_t sign_mask = 1ull << (num_bits - 1);
+    F[CF] = a < b;
+    F[PF] = parity((int)diff, 8);
+    F[AF] = ((a ^ b ^ diff) & 0x10) != 0;
+    F[ZF] = diff == 0;
+    F[SF] = (diff & sign_mask) != 0;
+    F[OF] = ((a ^ b) & (a ^ diff) & sign_mask) != 0;
+}
+
+static inline void logic_flags(bool* F, uint32_t result, int num_bits){
+    uint32_t mask = num_bits == 32 ? 0xFFFFFFFF : ((1u << num_bits) - 1);
+    result &= mask;
+    F[CF] = false;
+    F[OF] = false;
+    F[AF] = false;
+    F[PF] = parity((int)result, 8);
+    F[ZF] = result == 0;
+    F[SF] = (result >> (num_bits - 1)) & 1;
+}
+
+static inline void incdec_flags(bool* F, uint32_t operand, int num_bits, bool inc){
+    bool carry = F[CF];
+    if(inc){
+        uint32_t mask = num_bits == 32 ? 0xFFFFFFFF : ((1u << num_bits) - 1);
+        uint32_t result = (operand + 1) & mask;
+        logic_flags(F, result, num_bits);
+        F[OF] = result == (1u << (num_bits - 1));
+        F[AF] = (operand & 0x0F) == 0x0F;
+    }
+    else sub_flags(F, operand, 1, num_bits);
+    F[CF] = carry;
+}
+
+static inline bool cond(const bool* F, int cc){
+    bool result = false;
+    switch(cc >> 1){
+        case 0: result = F[OF]; break;
+        case 1: result = F[CF]; break;
+        case 2: result = F[ZF]; break;
+        case 3: result = F[CF] || F[ZF]; break;
+        case 4: result = F[SF]; break;
+        case 5: result = F[PF]; break;
+        case 6: result = F[SF] != F[OF]; break;
+        case 7: result = F[ZF] || F[SF] != F[OF]; break;
+    }
+    return (cc & 1) ? !result : result;
+}
+
+static inline uint32_t get_reg(const uint32_t* R, int reg, int size){
+    if(size == 1) return reg < 4 ? R[reg] & 0xFF : (R[reg - 4] >> 8) & 0xFF;
+    if(size == 2) return R[reg] & 0xFFFF;
+    return R[reg];
+}
+
+static inline void set_reg(uint32_t* R, int reg, int size, uint32_t value){
+    if(size == 1){
+        if(reg < 4) R[reg] = (R[reg] & 0xFFFFFF00) | (value & 0xFF);
+        else R[reg - 4] = (R[reg - 4] & 0xFFFF00FF) | ((value & 0xFF) << 8);
+    }
+    else if(size == 2) R[reg] = (R[reg] & 0xFFFF0000) | (value & 0xFFFF);
+    else R[reg] = value;
+}
+
+static inline uint32_t rd(aot_ctx_t* c, uint32_t addr, int size){
+    uint32_t value = 0;
+    for(int i = 0; i < size; i++) value |= (uint32_t)c->read8(c->m, addr + i) << (8*i);
+    return value;
+}
+
+static inline void wr(aot_ctx_t* c, uint32_t addr, int size, uint32_t value){
+    for(int i = 0; i < size; i++) c->write8(c->m, addr + i, (uint8_t)(value >> (8*i)));
+}
+
+static inline void load(aot_ctx_t* c, uint32_t* R, bool* F){
+    for(int i = 0; i < 8; i++) R[i] = (uint32_t)c->GPR[i];
+    for(int i = 0; i < 7; i++) F[i] = c->FLAGS[i];
+}
+
+static inline uint32_t leave(aot_ctx_t* c, const uint32_t* R, const bool* F, uint32_t eip, uint32_t instrs){
+    for(int i = 0; i < 8; i++) c->GPR[i] = (int32_t)R[i];
+    for(int i = 0; i < 7; i++) c->FLAGS[i] = F[i];
+    *c->EIP = (int32_t)eip;
+    return instrs;
+}
+
+)";
+
+//linear address of a memory operand, ds is the block's DS base
+string ea_expr(const insn_t& in){
+    const modrm_t& modrm = in.modrm;
+    string base;
+    if(in.a16){ //BX+SI BX+DI BP+SI BP+DI SI DI BP BX, disp16 alone for mod 0 r/m 6
+        static const char* const FORMS[8] = {"R[3] + R[6]", "R[3] + R[7]", "R[5] + R[6]", "R[5] + R[7]", "R[6]", "R[7]", "R[5]", "R[3]"};
+        base = (modrm.mod == 0 && modrm.r_m == 6) ? "0" : FORMS[modrm.r_m];
+        return strf("ds + ((uint32_t)(%s + 0x%08xu) & 0xFFFF)", base.c_str(), (uint32_t)in.disp);
+    }
+    if(modrm.r_m == 4){ //SIB
+        string sib_base = (in.sib.r_m == 5 && modrm.mod == 0) ? "0" : strf("R[%d]", in.sib.r_m);
+        if(in.sib.reg == 4) base = sib_base;
+        else base = strf("R[%d] * %d + %s", in.sib.reg, 1 << in.sib.mod, sib_base.c_str());
+    }
+    else if(modrm.mod == 0 && modrm.r_m == 5) base = "0";
+    else base = strf("R[%d]", modrm.r_m);
+    return strf("ds + (uint32_t)(%s + 0x%08xu)", base.c_str(), (uint32_t)in.disp);
+}
+
+//the r/m operand as an expression / a store of value into it
+string rm_get(const insn_t& in, int size){
+    if(in.modrm.mod == 3) return strf("get_reg(R, %d, %d)", in.modrm.r_m, size);
+    return strf("rd(c, ea, %d)", size);
+}
+
+string rm_set(const insn_t& in, int size, const string& value){
+    if(in.modrm.mod == 3) return strf("set_reg(R, %d, %d, %s);", in.modrm.r_m, size, value.c_str());
+    return strf("wr(c, ea, %d, %s);", size, value.c_str());
+}
+
+string add_flags(const string& op1, const string& op2, int bits){
+    return strf("add_flags(F, (int)(%s), (int)(%s), %d);", op1.c_str(), op2.c_str(), bits);
+}
+
+//statements of one of the original ADD forms, same operand orders and widths as fetch_and_execute
+string emit_add(const insn_t& in){
+    const modrm_t& modrm = in.modrm;
+    uint8_t op = in.op;
+    bool w_bit = op & 0x01;
+    string s;
+    if(op == 0x04 || op == 0x05){
+        uint32_t imm = in.imm;
+        if(in.o16){
+            s += add_flags(strf("0x%xu", imm), "R[0] & 0xFFFF", 16);
+            s += strf(" R[0] = (R[0] & 0xFFFF0000) + (((R[0] & 0xFFFF) + 0x%xu) & 0xFFFF);", imm);
+        }
+        else if(w_bit){
+            s += add_flags(strf("0x%xu", imm), "R[0]", 32);
+            s += strf(" R[0] = R[0] + 0x%xu;", imm);
+        }
+        else{
+            s += add_flags(strf("0x%xu", imm), "R[0] & 0xFF", 8);
+            s += strf(" R[0] = (R[0] & 0xFFFFFF00) + (((R[0] & 0xFF) + 0x%xu) & 0xFF);", imm);
+        }
+        return s;
+    }
+    if(op >= 0x80){ //80 81 83: r/m += imm
+        string imm = strf("0x%xu", in.imm);
+        if(modrm.mod == 3){
+            int d = modrm.r_m;
+            if(in.o16){
+                s += add_flags(strf("R[%d] & 0xFFFF", d), imm, 16);
+                s += strf(" R[%d] = (R[%d] & 0xFFFF0000) + (((R[%d] & 0xFFFF) + %s) & 0xFFFF);", d, d, d, imm.c_str());
+            }
+            else if(w_bit){
+                s += add_flags(strf("R[%d]", d), imm, 32);
+                s += strf(" R[%d] = R[%d] + %s;", d, d, imm.c_str());
+            }
+            else if(d < 4){
+                s += add_flags(strf("R[%d] & 0xFF", d), imm, 8);
+                s += strf(" R[%d] = (R[%d] & 0xFFFFFF00) + (((R[%d] & 0xFF) + %s) & 0xFF);", d, d, d, imm.c_str());
+            }
+            else{
+                d %= 4;
+                s += add_flags(strf("(R[%d] >> 8) & 0xFF", d), imm, 8);
+                s += strf(" R[%d] = (R[%d] & 0xFFFF00FF) + ((((R[%d] >> 8) & 0xFF) + %s) & 0xFF) * 0x100;", d, d, d, imm.c_str());
+            }
+            return s;
+        }
+        int size = in.o16 ? 2 : (w_bit ? 4 : 1);
+        s += strf("uint32_t v = rd(c, ea, %d); ", size);
+        s += add_flags(imm, "v", 8*size);
+        s += strf(" wr(c, ea, %d, v + %s);", size, imm.c_str());
+        return s;
+    }
+    //00-03: r/m + reg, bit 1 picks the destination
+    int reg = modrm.reg;
+    if(modrm.mod == 3){
+        int rm = modrm.r_m;
+        int d = (op & 0x02) ? reg : rm;
+        if(in.o16){
+            s += add_flags(strf("R[%d] & 0xFFFF", reg), strf("R[%d] & 0xFFFF", rm), 16);
+            s += strf(" R[%d] = (R[%d] & 0xFFFF0000) + (((R[%d] & 0xFFFF) + (R[%d] & 0xFFFF)) & 0xFFFF);", d, d, reg, rm);
+        }
+        else if(w_bit){
+            s += add_flags(strf("R[%d]", reg), strf("R[%d]", rm), 32);
+            s += strf(" R[%d] = R[%d] + R[%d];", d, reg, rm);
+        }
+        else{ //low bytes only, like the interpreter
+            s += add_flags(strf("R[%d] & 0xFF", reg), strf("R[%d] & 0xFF", rm), 8);
+            s += strf(" R[%d] = (R[%d] & 0xFFFFFF00) + (((R[%d] & 0xFF) + (R[%d] & 0xFF)) & 0xFF);", d, d, reg, rm);
+        }
+        return s;
+    }
+    bool store_to_mem = !(op & 0x02);
+    int size = in.o16 ? 2 : (w_bit ? 4 : 1);
+    string reg_val;
+    if(size == 2) reg_val = strf("(R[%d] & 0xFFFF)", reg);
+    else if(size == 4) reg_val = strf("R[%d]", reg);
+    else if(reg < 4) reg_val = strf("(R[%d] & 0xFF)", reg);
+    else reg_val = strf("((R[%d] >> 8) & 0xFF)", reg % 4);
+    s += strf("uint32_t v = rd(c, ea, %d); ", size);
+    s += add_flags(reg_val, "v", 8*size);
+    if(store_to_mem) s += strf(" wr(c, ea, %d, v + %s);", size, reg_val.c_str());
+    else if(size == 2) s += strf(" R[%d] = (R[%d] & 0xFFFF0000) + ((v + %s) & 0xFFFF);", reg, reg, reg_val.c_str());
+    else if(size == 4) s += strf(" R[%d] = v + %s;", reg, reg_val.c_str());
+    else if(reg < 4) s += strf(" R[%d] = (R[%d] & 0xFFFFFF00) + ((v + %s) & 0xFF);", reg, reg, reg_val.c_str());
+    else s += strf(" R[%d] = (R[%d] & 0xFFFF00FF) + ((v + %s) & 0xFF) * 0x100;", reg % 4, reg % 4, reg_val.c_str());
+    return s;
+}
+
+//a op b into r with its flags, then the store (skipped for CMP)
+string alu_body(int alu, int bits, const string& store){
+    switch(alu){
+        case 1: return strf("uint32_t r = a | b; logic_flags(F, r, %d); %s", bits, store.c_str()); //OR
+        case 4: return strf("uint32_t r = a & b; logic_flags(F, r, %d); %s", bits, store.c_str()); //AND
+        case 6: return strf("uint32_t r = a ^ b; logic_flags(F, r, %d); %s", bits, store.c_str()); //XOR
+        case 5: return strf("uint32_t r = a - b; sub_flags(F, a, b, %d); %s", bits, store.c_str()); //SUB
+        default: return strf("sub_flags(F, a, b, %d);", bits); //CMP
+    }
+}
+
+//statements of an execute_alu instruction
+string emit_alu(const insn_t& in){
+    uint8_t op = in.op;
+    int full_size = in.o16 ? 2 : 4;
+    int size = (op & 0x01) ? full_size : 1;
+    int bits = 8*size;
+    string imm = strf("0x%xu", in.imm);
+    if(op < 0x40 && (op & 0x07) <= 3){
+        string reg = strf("get_reg(R, %d, %d)", in.modrm.reg, size);
+        bool to_reg = op & 0x02;
+        string a = to_reg ? reg : rm_get(in, size), b = to_reg ? rm_get(in, size) : reg;
+        string store = to_reg ? strf("set_reg(R, %d, %d, r);", in.modrm.reg, size) : rm_set(in, size, "r");
+        return "uint32_t a = " + a + ", b = " + b + "; " + alu_body(op >> 3, bits, store);
+    }
+    if(op < 0x40) return strf("uint32_t a = get_reg(R, 0, %d), b = %s; ", size, imm.c_str()) +
+                         alu_body(op >> 3, bits, strf("set_reg(R, 0, %d, r);", size));
+    if(op <= 0x4F){
+        bool inc = op < 0x48;
+        return strf("uint32_t a = get_reg(R, %d, %d); incdec_flags(F, a, %d, %s); set_reg(R, %d, %d, a %s 1);", op & 0x07, full_size,
+                    8*full_size, inc ? "true" : "false", op & 0x07, full_size, inc ? "+" : "-");
+    }
+    if(op == 0x80 || op == 0x81 || op == 0x83){
+        return "uint32_t a = " + rm_get(in, size) + ", b = " + imm + "; " + alu_body(in.modrm.reg, bits, rm_set(in, size, "r"));
+    }
+    if(op == 0x84 || op == 0x85){
+        return "uint32_t a = " + rm_get(in, size) + strf(", b = get_reg(R, %d, %d); ", in.modrm.reg, size) +
+               strf("logic_flags(F, a & b, %d);", bits);
+    }
+    if(op == 0xA8 || op == 0xA9) return strf("logic_flags(F, get_reg(R, 0, %d) & %s, %d);", size, imm.c_str(), bits);
+    if(op == 0xF6 || op == 0xF7) return "uint32_t a = " + rm_get(in, size) + strf("; logic_flags(F, a & %s, %d);", imm.c_str(), bits);
+    bool inc = in.modrm.reg == 0; //FE FF
+    return "uint32_t a = " + rm_get(in, size) + strf("; incdec_flags(F, a, %d, %s); ", bits, inc ? "true" : "false") +
+           rm_set(in, size, inc ? "a + 1" : "a - 1");
+}
+
+//XCHG r/m8, r8 exactly as fetch_and_execute: both halves are computed from the registers before the instruction
+string emit_xchg(const insn_t& in){
+    int r1 = in.modrm.reg, r2 = in.modrm.r_m;
+    if(in.modrm.mod != 3){
+        if(r1 < 4) return strf("uint32_t v = rd(c, ea, 1); uint32_t r = R[%d] & 0xFF; R[%d] = (R[%d] & 0xFFFFFF00) + v; wr(c, ea, 1, r);", r1, r1, r1);
+        r1 %= 4;
+        return strf("uint32_t v = rd(c, ea, 1); uint32_t r = (R[%d] >> 8) & 0xFF; R[%d] = (R[%d] & 0xFFFF00FF) + v * 0x100; wr(c, ea, 1, r);", r1, r1, r1);
+    }
+    string s = "uint32_t C[8]; for(int i = 0; i < 8; i++) C[i] = R[i];";
+    auto val = [](int r){ return r < 4 ? strf("(C[%d] & 0xFF)", r) : strf("((C[%d] >> 8) & 0xFF)", r % 4); };
+    auto put = [](int r, const string& v){
+        if(r < 4) return strf(" R[%d] = (C[%d] & 0xFFFFFF00) + %s;", r, r, v.c_str());
+        return strf(" R[%d] = (C[%d] & 0xFFFF00FF) + %s * 0x100;", r % 4, r % 4, v.c_str());
+    };
+    if(r1 < 4 && r2 >= 4) return s + put(r1, val(r2)) + put(r2, val(r1));
+    return s + put(r2, val(r1)) + put(r1, val(r2));
+}
+
+bool writes_memory(const insn_t& in){
+    if(in.modrm.mod == 3) return false;
+    switch(in.kind){
+        case INSN_XCHG: return true;
+        case INSN_ADD: return in.op != 0x04 && in.op != 0x05 && !(in.op <= 0x03 && (in.op & 0x02));
+        case INSN_ALU:
+            if(in.op < 0x40 && (in.op & 0x07) <= 3) return !(in.op & 0x02) && (in.op >> 3) != 7;
+            if(in.op == 0x80 || in.op == 0x81 || in.op == 0x83) return in.modrm.reg != 7;
+            return in.op == 0xFE || in.op == 0xFF;
+    }
+    return false;
+}
+
+bool has_memory_operand(const insn_t& in){
+    switch(in.kind){
+        case INSN_ADD: return in.op != 0x04 && in.op != 0x05 && in.modrm.mod != 3;
+        case INSN_XCHG: return in.modrm.mod != 3;
+        case INSN_ALU:
+            if((in.op < 0x40 && (in.op & 0x07) > 3) || (in.op >= 0x40 && in.op <= 0x4F) || in.op == 0xA8 || in.op == 0xA9) return false;
+            return in.modrm.mod != 3;
+    }
+    return false;
+}
+
+string block_name(const block_t& b){
+    return strf("blk_%04x_%08x", b.cs, b.eip);
+}
+
+void emit_block(ostream& out, const block_t& b){
+    out << "static uint32_t " << block_name(b) << "(aot_ctx_t* c){\n";
+    out << "    uint32_t R[8];\n    bool F[7];\n    load(c, R, F);\n";
+    out << "    const uint32_t ds = (uint32_t)(uint16_t)c->SEGR[3] << 16;\n    (void)ds;\n";
+    uint32_t cs_base = (uint32_t)b.cs << 16;
+    for(size_t i = 0; i < b.insns.size(); i++){
+        const insn_t& in = b.insns[i];
+        uint32_t next = in.eip + in.len;
+        string bytes;
+        for(int k = 0; k < in.len; k++) bytes += strf(" %02x", b.code[in.eip - b.eip + k]);
+        out << strf("    //%08x:%s\n", cs_base + in.eip, bytes.c_str());
+        string pre = has_memory_operand(in) ? "const uint32_t ea = " + ea_expr(in) + "; " : "";
+        switch(in.kind){
+            case INSN_ADD: out << "    { " << pre << emit_add(in) << " }\n"; break;
+            case INSN_ALU: out << "    { " << pre << emit_alu(in) << " }\n"; break;
+            case INSN_XCHG: out << "    { " << pre << emit_xchg(in) << " }\n"; break;
+            case INSN_JCC:
+                out << strf("    return leave(c, R, F, cond(F, %d) ? 0x%08xu : 0x%08xu, %zu);\n", in.op & 0x0F, in.target, next, i + 1);
+                break;
+            case INSN_JMP: out << strf("    return leave(c, R, F, 0x%08xu, %zu);\n", in.target, i + 1); break;
+            case INSN_LOOP:
+                {
+                    uint32_t mask = in.a16 ? 0xFFFF : 0xFFFFFFFF; //counter width: CX with 0x67
+                    string taken;
+                    if(in.op == 0xE3) taken = strf("(R[1] & 0x%xu) == 0", mask);
+                    else{
+                        out << strf("    { uint32_t n = ((R[1] & 0x%xu) - 1) & 0x%xu; R[1] = (R[1] & ~0x%xu) | n; }\n", mask, mask, mask);
+                        taken = strf("(R[1] & 0x%xu) != 0", mask);
+                        if(in.op == 0xE0) taken += " && !F[ZF]";
+                        if(in.op == 0xE1) taken += " && F[ZF]";
+                    }
+                    out << strf("    return leave(c, R, F, (%s) ? 0x%08xu : 0x%08xu, %zu);\n", taken.c_str(), in.target, next, i + 1);
+                }
+                break;
+            case INSN_JMPFAR:
+                out << strf("    c->SEGR[1] = (int16_t)0x%04x;\n", in.sel);
+                out << strf("    return leave(c, R, F, 0x%08xu, %zu);\n", in.target, i + 1);
+                break;
+        }
+        //a store into translated code: the rest of the block may be stale, go back to the dispatcher
+        if(writes_memory(in) && i + 1 < b.insns.size()) out << strf("    if(c->code_written) return leave(c, R, F, 0x%08xu, %zu);\n", next, i + 1);
+    }
+    const insn_t& last = b.insns.back();
+    if(last.kind != INSN_JCC && last.kind != INSN_JMP && last.kind != INSN_LOOP && last.kind != INSN_JMPFAR){
+        out << strf("    return leave(c, R, F, 0x%08xu, %zu);\n", b.exit_eip, b.insns.size());
+    }
+    out << "}\n\n";
+}
+
+//writes the blocks reachable from the current CS:EIP to so_path.cpp and compiles so_path ($CXX, default c++)
+size_t islx86_translate(machine_t* m, const string& so_path){
+    vector<block_t> blocks = find_blocks(m, (uint16_t)m->curr_state.SEGR[CS], (uint32_t)m->curr_state.EIP);
+    string cpp_path = so_path + ".cpp";
+    ofstream out(cpp_path, std::ios::out | std::ios::trunc);
+    if(!out.is_open()) throw runtime_error("Could not open " + cpp_path);
+    out << "//generated by islx86_translate\n" << AOT_PRELUDE;
+    for(const block_t& b : blocks) emit_block(out, b);
+    for(size_t i = 0; i < blocks.size(); i++){
+        out << "static const uint8_t code_" << i << "[] = {";
+        for(size_t k = 0; k < blocks[i].code.size(); k++) out << (k ? "," : "") << strf("0x%02x", blocks[i].code[k]);
+        out << "};\n";
+    }
+    out << "\nextern \"C\" const aot_block_t islx86_aot_blocks[] = {\n";
+    for(size_t i = 0; i < blocks.size(); i++){
+        const block_t& b = blocks[i];
+        out << strf("    {0x%04x, 0x%08x, %zu, %zu, code_%zu, ", b.cs, b.eip, b.insns.size(), b.code.size(), i) << block_name(b) << "},\n";
+    }
+    if(blocks.empty()) out << "    {0, 0, 0, 0, nullptr, nullptr}\n";
+    out << "};\n";
+    out << "extern \"C\" const uint32_t islx86_aot_count = " << blocks.size() << ";\n";
+    out << "extern \"C\" const uint32_t islx86_aot_version = " << AOT_VERSION << ";\n";
+    out.close();
+
+    const char* cxx = getenv("CXX");
+    string cmd = string(cxx && *cxx ? cxx : "c++") + " -std=c++17 -O2 -shared -fPIC -o '" + so_path + "' '" + cpp_path + "'";
+    if(system(cmd.c_str()) != 0) throw runtime_error("Could not compile " + cpp_path);
+    return blocks.size();
+}
+
+uint8_t aot_read8(void* m, uint32_t addr){
+    return mem_read((machine_t*)m, addr);
+}
+
+void aot_write8(void* m, uint32_t addr, uint8_t value){
+    mem_write((machine_t*)m, addr, value);
+}
+
+//true if every byte the block was translated from is in memory unchanged
+bool block_matches(machine_t* m, const aot_block_t* b){
+    uint32_t start = (b->cs << 16) + b->eip;
+    for(uint32_t i = 0; i < b->size; i++){
+        uint8_t byte = 0;
+        if(!code_byte(m, start + i, byte) || byte != b->code[i]) return false;
+    }
+    return true;
+}
+
+//loads a shared object written by islx86_translate; only blocks whose bytes match the loaded program are used
+void islx86_load_translation(machine_t* m, const string& so_path){
+    islx86_unload_translation(m);
+    string path = so_path.find('/') == string::npos ? "./" + so_path : so_path;
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!handle) throw runtime_error("Could not load " + so_path + ": " + dlerror());
+    const aot_block_t* table = (const aot_block_t*)dlsym(handle, "islx86_aot_blocks");
+    const uint32_t* count = (const uint32_t*)dlsym(handle, "islx86_aot_count");
+    const uint32_t* version = (const uint32_t*)dlsym(handle, "islx86_aot_version");
+    if(!table || !count || !version || *version != AOT_VERSION){
+        dlclose(handle);
+        throw runtime_error(so_path + " is not an islx86 translation");
+    }
+
+    aot_t* t = new aot_t();
+    t->handle = handle;
+    t->translated_instrs = 0;
+    state_t& s = m->curr_state;
+    t->ctx = {s.GPR, s.FLAGS, s.SEGR, &s.EIP, m, aot_read8, aot_write8, false};
+    for(uint32_t i = 0; i < *count; i++){
+        const aot_block_t* b = &table[i];
+        uint32_t start = (b->cs << 16) + b->eip;
+        for(uint32_t p = start >> PAGE_BITS; p <= (start + b->size - 1) >> PAGE_BITS; p++) t->page_blocks[p].push_back(b);
+        if(block_matches(m, b)) t->blocks[block_key(b->cs, b->eip)] = b;
+    }
+    m->aot = t;
+    for(const auto& p : t->page_blocks){ //program pages are shared with other machines, the flag goes on a private copy
+        page_t* page = mem_page_slow(m, p.first, true);
+        if(page->shared) page = unshare_page(m, page);
+        page->code = true;
+    }
+}
+
+void islx86_unload_translation(machine_t* m){
+    aot_t* t = m->aot;
+    if(!t) return;
+    m->aot = nullptr;
+    for(const auto& p : t->page_blocks){
+        page_t* page = mem_page_slow(m, p.first, false);
+        if(page) page->code = false;
+    }
+    dlclose(t->handle);
+    delete t;
+}
+
+//mem_write hook for pages holding translated (or lockstep decoded) code: blocks covering addr stop running if the byte changed
+void code_written(machine_t* m, uint32_t addr, uint8_t value){
+    if(m->lockstep) lockstep_code_written(m, addr, value);
+    aot_t* t = m->aot;
+    if(!t) return;
+    auto p = t->page_blocks.find(addr >> PAGE_BITS);
+    if(p == t->page_blocks.end()) return;
+    for(const aot_block_t* b : p->second){
+        uint32_t off = addr - ((b->cs << 16) + b->eip);
+        if(off >= b->size || b->code[off] == value) continue;
+        if(t->blocks.erase(block_key(b->cs, b->eip))) t->ctx.code_written = true;
+    }
+}
+
+//after a page was overwritten in bulk: every block on it runs again exactly when its bytes match
+void revalidate_code_page(machine_t* m, page_t* page){
+    if(m->lockstep && page->code) lockstep_code_replaced(m, page);
+    aot_t* t = m->aot;
+    if(!t || !page->code) return;
+    auto p = t->page_blocks.find(page->page_num);
+    if(p == t->page_blocks.end()) return;
+    for(const aot_block_t* b : p->second){
+        if(block_matches(m, b)) t->blocks[block_key(b->cs, b->eip)] = b;
+        else t->blocks.erase(block_key(b->cs, b->eip));
+    }
+}
+
+//runs the translated block at CS:EIP if there is one that fits before stop_eip / max_cycles / the next event, false otherwise
+bool run_translated(machine_t* m, uint64_t stop_eip, uint64_t max_cycles){
+    aot_t* t = m->aot;
+    state_t& s = m->curr_state;
+    t->lookups++;
+    auto it = t->blocks.find(block_key((uint16_t)s.SEGR[CS], (uint32_t)s.EIP));
+    if(it == t->blocks.end()) return false;
+    const aot_block_t* b = it->second;
+    if(m->cycles + b->instrs > max_cycles || m->cycles + b->instrs > m->next_event_cycle) return false;
+    if(stop_eip > b->eip && stop_eip < (uint64_t)b->eip + b->size) return false;
+
+    t->ctx.code_written = false;
+    uint32_t n = b->fn(&t->ctx);
+    state_t& next = m->next_state;
+    next.EIP = s.EIP;
+    memcpy(next.GPR, s.GPR, sizeof(s.GPR));
+    memcpy(next.SEGR, s.SEGR, sizeof(s.SEGR));
+    memcpy(next.FLAGS, s.FLAGS, sizeof(s.FLAGS));
+    m->cycles += n;
+    t->translated_instrs += n;
+    t->hits++;
+    m->last_instr.clear();
+    return true;
+}